@@ -0,0 +1,143 @@
+#include "async_compute.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+namespace {
+    vk::raii::Semaphore create_timeline_semaphore(const vk::raii::Device &device) {
+        const vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> create_info{
+                {}, {vk::SemaphoreType::eTimeline, 0}};
+        return vk::raii::Semaphore{device, create_info.get<vk::SemaphoreCreateInfo>()};
+    }
+
+    struct Placement {
+        size_t compute_index;
+        size_t anchor;
+        size_t deadline;
+    };
+}
+
+AsyncComputeScheduler::AsyncComputeScheduler(const vk::raii::Device &device, const QueuePlan &queue_plan)
+        : has_async_queue{queue_plan.get_location(QueueRole::AsyncCompute) != queue_plan.get_location(QueueRole::Frame)},
+          graphics_timeline{create_timeline_semaphore(device)}, compute_timeline{create_timeline_semaphore(device)} {}
+
+AsyncComputeSchedule AsyncComputeScheduler::plan(const std::span<const GraphicsPass> graphics_passes,
+                                                 const std::span<const ComputePass> compute_passes) const {
+    const auto graphics_count = graphics_passes.size();
+
+    std::vector<Placement> async_placements;
+    std::vector<Placement> inline_placements;
+    for (const auto &[index, pass]: std::views::enumerate(compute_passes)) {
+        const auto earliest = pass.after ? *pass.after + 1 : 0;
+        const auto deadline = pass.before ? *pass.before : graphics_count;
+        if (earliest > deadline || deadline > graphics_count)
+            throw std::invalid_argument{"Compute pass " + pass.name + " has to run before its own inputs"};
+        Placement placement{static_cast<size_t>(index), earliest, deadline};
+        if (!pass.async || !has_async_queue) {
+            inline_placements.emplace_back(placement);
+            continue;
+        }
+        // Start alongside the first depth only or shadow pass in the window, those leave most shader units idle.
+        for (auto graphics_index = earliest; graphics_index < deadline; ++graphics_index) {
+            if (const auto kind = graphics_passes[graphics_index].kind;
+                    kind == GraphicsPassKind::DepthOnly || kind == GraphicsPassKind::Shadow) {
+                placement.anchor = graphics_index;
+                break;
+            }
+        }
+        async_placements.emplace_back(placement);
+    }
+    std::ranges::stable_sort(async_placements, {}, &Placement::anchor);
+    std::ranges::stable_sort(inline_placements, {}, &Placement::anchor);
+
+    AsyncComputeSchedule schedule{};
+    // Async passes sharing an anchor form one compute segment, every anchor and deadline splits the graphics work.
+    std::vector<size_t> compute_segment_of(compute_passes.size());
+    std::vector<size_t> anchors;
+    for (const auto &placement: async_placements) {
+        if (anchors.empty() || anchors.back() != placement.anchor) {
+            anchors.emplace_back(placement.anchor);
+            schedule.compute_segments.emplace_back();
+        }
+        schedule.compute_segments.back().passes.emplace_back(true, placement.compute_index);
+        compute_segment_of[placement.compute_index] = schedule.compute_segments.size() - 1;
+    }
+
+    std::vector<std::optional<size_t>> compute_wait_before(graphics_count + 1);
+    for (const auto &placement: async_placements) {
+        auto &wait = compute_wait_before[placement.deadline];
+        wait = std::max(wait.value_or(0), compute_segment_of[placement.compute_index]);
+    }
+
+    std::vector<size_t> graphics_segment_of(graphics_count + 1);
+    auto inline_placement = inline_placements.begin();
+    for (size_t graphics_index{}; graphics_index <= graphics_count; ++graphics_index) {
+        const auto is_cut = std::ranges::contains(anchors, graphics_index) ||
+                            compute_wait_before[graphics_index].has_value();
+        if (schedule.graphics_segments.empty() || is_cut) {
+            auto &segment = schedule.graphics_segments.emplace_back();
+            segment.wait_segment = compute_wait_before[graphics_index];
+        }
+        auto &segment = schedule.graphics_segments.back();
+        for (; inline_placement != inline_placements.end() && inline_placement->anchor == graphics_index;
+               ++inline_placement)
+            segment.passes.emplace_back(true, inline_placement->compute_index);
+        graphics_segment_of[graphics_index] = schedule.graphics_segments.size() - 1;
+        if (graphics_index < graphics_count)
+            segment.passes.emplace_back(false, graphics_index);
+    }
+
+    // A compute segment waits for the graphics segment ending right before its anchor, which the cut above created.
+    for (auto &&[segment, anchor]: std::views::zip(schedule.compute_segments, anchors))
+        if (anchor > 0)
+            segment.wait_segment = graphics_segment_of[anchor - 1];
+    return schedule;
+}
+
+void AsyncComputeScheduler::execute(const AsyncComputeSchedule &schedule,
+                                    const std::span<const GraphicsPass> graphics_passes,
+                                    const std::span<const ComputePass> compute_passes,
+                                    const std::function<const vk::raii::CommandBuffer &(QueueRole)> &acquire_command_buffer,
+                                    FrameSubmitAggregator &aggregator, SubmissionThread &graphics_queue,
+                                    SubmissionThread &compute_queue) {
+    const auto record = [&](const QueueRole role, const ScheduledSegment &segment) {
+        const auto &command_buffer = acquire_command_buffer(role);
+        command_buffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        for (const auto &[is_compute, index]: segment.passes) {
+            if (is_compute)
+                compute_passes[index].record(command_buffer);
+            else
+                graphics_passes[index].record(command_buffer);
+        }
+        command_buffer.end();
+        return vk::CommandBufferSubmitInfo{*command_buffer};
+    };
+
+    const auto graphics_base = graphics_value;
+    const auto compute_base = compute_value;
+    for (const auto &[index, segment]: std::views::enumerate(schedule.graphics_segments)) {
+        SubmitBatch batch{};
+        if (!segment.passes.empty())
+            batch.command_buffers.emplace_back(record(QueueRole::Frame, segment));
+        if (segment.wait_segment)
+            batch.wait_semaphores.emplace_back(*compute_timeline, compute_base + *segment.wait_segment + 1,
+                                               vk::PipelineStageFlagBits2::eAllCommands);
+        if (has_async_queue)
+            batch.signal_semaphores.emplace_back(*graphics_timeline, graphics_base + static_cast<uint64_t>(index) + 1,
+                                                 vk::PipelineStageFlagBits2::eAllCommands);
+        aggregator.add(graphics_queue, std::move(batch));
+    }
+    for (const auto &[index, segment]: std::views::enumerate(schedule.compute_segments)) {
+        SubmitBatch batch{};
+        batch.command_buffers.emplace_back(record(QueueRole::AsyncCompute, segment));
+        if (segment.wait_segment)
+            batch.wait_semaphores.emplace_back(*graphics_timeline, graphics_base + *segment.wait_segment + 1,
+                                               vk::PipelineStageFlagBits2::eComputeShader);
+        batch.signal_semaphores.emplace_back(*compute_timeline, compute_base + static_cast<uint64_t>(index) + 1,
+                                             vk::PipelineStageFlagBits2::eComputeShader);
+        aggregator.add(compute_queue, std::move(batch));
+    }
+    graphics_value += has_async_queue ? schedule.graphics_segments.size() : 0;
+    compute_value += schedule.compute_segments.size();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "frame_submitter.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+#include "queues.hpp"
+
+enum class GraphicsPassKind {
+    DepthOnly,
+    Shadow,
+    Color,
+};
+
+struct GraphicsPass {
+    std::string name;
+    GraphicsPassKind kind;
+    std::function<void(const vk::raii::CommandBuffer &)> record;
+};
+
+// Resources shared with graphics passes have to use concurrent sharing when async compute runs on another family.
+struct ComputePass {
+    std::string name;
+    bool async;
+    // Graphics pass whose results it reads, and the one that reads its results, as indices into the graphics passes.
+    std::optional<size_t> after;
+    std::optional<size_t> before;
+    std::function<void(const vk::raii::CommandBuffer &)> record;
+};
+
+struct PassReference {
+    bool is_compute;
+    size_t index;
+};
+
+// A run of passes recorded into one command buffer, waiting on the other queue's timeline up to a segment of it.
+struct ScheduledSegment {
+    std::vector<PassReference> passes;
+    std::optional<size_t> wait_segment;
+};
+
+struct AsyncComputeSchedule {
+    std::vector<ScheduledSegment> graphics_segments;
+    std::vector<ScheduledSegment> compute_segments;
+};
+
+// Places async compute passes on a compute queue next to depth only or shadow graphics work, which leaves most shader
+// units idle, and synchronizes both queues with timeline semaphores. Without a separate queue the passes are recorded
+// inline on the graphics queue in the same order.
+class AsyncComputeScheduler : Noncopyable {
+    const bool has_async_queue;
+    const vk::raii::Semaphore graphics_timeline;
+    const vk::raii::Semaphore compute_timeline;
+    uint64_t graphics_value{};
+    uint64_t compute_value{};
+
+public:
+    AsyncComputeScheduler(const vk::raii::Device &device, const QueuePlan &queue_plan);
+
+    [[nodiscard]] bool uses_async_queue() const {
+        return has_async_queue;
+    }
+
+    [[nodiscard]] AsyncComputeSchedule plan(std::span<const GraphicsPass> graphics_passes,
+                                            std::span<const ComputePass> compute_passes) const;
+
+    // Records every segment into a command buffer handed out by the callback and registers it with the aggregator.
+    void execute(const AsyncComputeSchedule &schedule, std::span<const GraphicsPass> graphics_passes,
+                 std::span<const ComputePass> compute_passes,
+                 const std::function<const vk::raii::CommandBuffer &(QueueRole)> &acquire_command_buffer,
+                 FrameSubmitAggregator &aggregator, SubmissionThread &graphics_queue, SubmissionThread &compute_queue);
+};
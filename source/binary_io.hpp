@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Little helpers for the small binary files written next to shaders and pipeline caches. Values are stored in the
+// machine's byte order, the files never leave the machine that wrote them.
+
+template<typename T>
+void write(std::vector<std::byte> &data, const T value) {
+    const auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>>(value);
+    data.insert(data.end(), bytes.begin(), bytes.end());
+}
+
+// Length prefixed, without terminator.
+inline void write_string(std::vector<std::byte> &data, const std::string_view string) {
+    write(data, static_cast<uint32_t>(string.size()));
+    const auto bytes = std::as_bytes(std::span{string});
+    data.insert(data.end(), bytes.begin(), bytes.end());
+}
+
+// Writes beside and renames, so neither a crash nor a full disk while saving replaces a good file with a truncated
+// one. The name only ends up in the error message.
+inline void write_file(const std::filesystem::path &path, const std::span<const std::byte> data, const char *name) {
+    auto temporary_path{path};
+    temporary_path += ".tmp";
+    {
+        std::ofstream file{temporary_path, std::ios::binary | std::ios::trunc};
+        if (!file)
+            throw std::runtime_error{std::string{"Couldn't write "} + name + " " + temporary_path.string()};
+        file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        // A full disk may only show up when the last buffered bytes are written on close.
+        file.close();
+        if (!file) {
+            std::error_code error;
+            std::filesystem::remove(temporary_path, error);
+            throw std::runtime_error{std::string{"Couldn't write "} + name + " " + temporary_path.string()};
+        }
+    }
+    std::filesystem::rename(temporary_path, path);
+}
+
+class Reader {
+    std::span<const std::byte> data;
+    const char *name;
+
+public:
+    // The name only ends up in the error message of truncated data.
+    Reader(const std::span<const std::byte> data, const char *name) : data{data}, name{name} {}
+
+    template<typename T>
+    T read() {
+        return std::bit_cast<T>(read_bytes<sizeof(T)>());
+    }
+
+    [[nodiscard]] std::span<const std::byte> read_span(const size_t size) {
+        if (data.size() < size)
+            throw std::runtime_error{std::string{"Truncated "} + name};
+        const auto result = data.first(size);
+        data = data.subspan(size);
+        return result;
+    }
+
+    [[nodiscard]] std::string read_string() {
+        const auto bytes = read_span(read<uint32_t>());
+        return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+    }
+
+    [[nodiscard]] bool is_empty() const {
+        return data.empty();
+    }
+
+private:
+    template<size_t Size>
+    std::array<std::byte, Size> read_bytes() {
+        std::array<std::byte, Size> bytes;
+        std::ranges::copy(read_span(Size), bytes.begin());
+        return bytes;
+    }
+};
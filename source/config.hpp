@@ -0,0 +1,36 @@
+#pragma once
+
+#include <charconv>
+#include <cstdlib>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+// Runtime configuration is read from environment variables so it can be tweaked per machine without rebuilding.
+template<typename T>
+[[nodiscard]] std::optional<T> get_config(const char *name) {
+    const auto raw = std::getenv(name);
+    if (!raw || !*raw)
+        return std::nullopt;
+    const std::string_view value{raw};
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        return value;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        if (value == "1" || value == "true" || value == "on")
+            return true;
+        if (value == "0" || value == "false" || value == "off")
+            return false;
+        return std::nullopt;
+    } else {
+        T result{};
+        if (const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+                error != std::errc{} || end != value.data() + value.size())
+            return std::nullopt;
+        return result;
+    }
+}
+
+template<typename T>
+[[nodiscard]] T get_config(const char *name, const T fallback) {
+    return get_config<T>(name).value_or(fallback);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include "noncopyable.hpp"
+
+// Keeps objects alive until the frames that may still use them on the GPU are done, then destroys them on the
+// thread calling begin_frame.
+class DeferredDeletionQueue : Noncopyable {
+    struct Retired {
+        uint64_t frame;
+        // The object lives in the closure, destroying the function destroys the object.
+        std::move_only_function<void()> holder;
+    };
+
+    const uint32_t frames_in_flight;
+    std::mutex mutex;
+    std::deque<Retired> retired;
+    uint64_t frame{};
+
+public:
+    explicit DeferredDeletionQueue(const uint32_t frames_in_flight) : frames_in_flight{frames_in_flight} {}
+
+    // Thread safe.
+    template<typename T>
+    void retire(T &&object) {
+        const std::scoped_lock lock{mutex};
+        retired.emplace_back(frame, [object = std::forward<T>(object)]() {});
+    }
+
+    // Call once the frame about to be recorded waited for its fence, which means everything retired
+    // frames_in_flight frames ago is no longer in use.
+    void begin_frame() {
+        // Destroyed after the lock is released, so destructors may retire further objects.
+        std::deque<Retired> expired;
+        {
+            const std::scoped_lock lock{mutex};
+            ++frame;
+            while (!retired.empty() && retired.front().frame + frames_in_flight <= frame) {
+                expired.emplace_back(std::move(retired.front()));
+                retired.pop_front();
+            }
+        }
+    }
+};
@@ -0,0 +1,185 @@
+#include "descriptors.hpp"
+
+#include <algorithm>
+#include <array>
+#include <ranges>
+
+#include "hashing.hpp"
+
+namespace {
+    bool is_out_of_pool(const vk::Result result) {
+        return result == vk::Result::eErrorOutOfPoolMemory || result == vk::Result::eErrorFragmentedPool;
+    }
+}
+
+DescriptorSetLayoutKey::DescriptorSetLayoutKey(const std::span<const vk::DescriptorSetLayoutBinding> bindings,
+                                               const vk::DescriptorSetLayoutCreateFlags flags)
+        : flags{flags}, bindings(bindings.begin(), bindings.end()) {
+    std::ranges::sort(this->bindings, {}, &vk::DescriptorSetLayoutBinding::binding);
+    for (auto &binding: this->bindings) {
+        auto &samplers = immutable_samplers.emplace_back();
+        if (binding.pImmutableSamplers)
+            samplers.assign(binding.pImmutableSamplers, binding.pImmutableSamplers + binding.descriptorCount);
+        binding.pImmutableSamplers = nullptr;
+    }
+}
+
+bool DescriptorSetLayoutKey::operator==(const DescriptorSetLayoutKey &other) const {
+    return flags == other.flags && bindings == other.bindings && immutable_samplers == other.immutable_samplers;
+}
+
+size_t std::hash<DescriptorSetLayoutKey>::operator()(const DescriptorSetLayoutKey &key) const noexcept {
+    auto seed = hash_values(static_cast<VkFlags>(key.flags), key.bindings.size());
+    for (const auto &[binding, samplers]: std::views::zip(key.bindings, key.immutable_samplers)) {
+        hash_combine(seed, binding.binding);
+        hash_combine(seed, binding.descriptorType);
+        hash_combine(seed, binding.descriptorCount);
+        hash_combine(seed, static_cast<VkFlags>(binding.stageFlags));
+        for (const auto sampler: samplers)
+            hash_combine(seed, static_cast<VkSampler>(sampler));
+    }
+    return seed;
+}
+
+vk::DescriptorSetLayout DescriptorSetLayoutCache::get(const std::span<const vk::DescriptorSetLayoutBinding> bindings,
+                                                      const vk::DescriptorSetLayoutCreateFlags flags) {
+    DescriptorSetLayoutKey key{bindings, flags};
+    const std::scoped_lock lock{mutex};
+    if (const auto layout = layouts.find(key); layout != layouts.end())
+        return *layout->second;
+
+    // The key dropped the sampler pointers, point them back at its own copies.
+    auto create_bindings{key.bindings};
+    for (auto &&[binding, samplers]: std::views::zip(create_bindings, key.immutable_samplers))
+        if (!samplers.empty())
+            binding.pImmutableSamplers = samplers.data();
+    vk::DescriptorSetLayoutCreateInfo create_info{};
+    create_info.flags = flags;
+    create_info.setBindings(create_bindings);
+    vk::raii::DescriptorSetLayout layout{device, create_info};
+    const auto handle = *layout;
+    layouts.emplace(std::move(key), std::move(layout));
+    return handle;
+}
+
+size_t DescriptorSetLayoutCache::get_size() {
+    const std::scoped_lock lock{mutex};
+    return layouts.size();
+}
+
+TransientDescriptorAllocator::TransientDescriptorAllocator(const vk::raii::Device &device,
+                                                           const uint32_t frames_in_flight,
+                                                           const uint32_t sets_per_pool)
+        : device{device}, sets_per_pool{sets_per_pool}, pool_sizes{[&]() {
+    // Typical descriptors per set, pools are sized for the average set rather than the worst case.
+    constexpr std::array ratios{
+            std::pair{vk::DescriptorType::eUniformBuffer, 2.0f},
+            std::pair{vk::DescriptorType::eUniformBufferDynamic, 1.0f},
+            std::pair{vk::DescriptorType::eStorageBuffer, 2.0f},
+            std::pair{vk::DescriptorType::eCombinedImageSampler, 4.0f},
+            std::pair{vk::DescriptorType::eSampledImage, 2.0f},
+            std::pair{vk::DescriptorType::eSampler, 1.0f},
+            std::pair{vk::DescriptorType::eStorageImage, 1.0f},
+    };
+    std::vector<vk::DescriptorPoolSize> sizes;
+    for (const auto &[type, ratio]: ratios)
+        sizes.emplace_back(type, static_cast<uint32_t>(ratio * static_cast<float>(sets_per_pool)));
+    return sizes;
+}()}, frames(frames_in_flight) {}
+
+vk::raii::DescriptorPool TransientDescriptorAllocator::create_pool() const {
+    vk::DescriptorPoolCreateInfo create_info{};
+    create_info.maxSets = sets_per_pool;
+    create_info.setPoolSizes(pool_sizes);
+    return vk::raii::DescriptorPool{device, create_info};
+}
+
+void TransientDescriptorAllocator::begin_frame(const size_t frame_index) {
+    this->frame_index = frame_index;
+    auto &frame = frames[frame_index];
+    for (const auto &pool: frame.pools | std::views::take(frame.current_pool + 1))
+        pool.reset();
+    frame.current_pool = 0;
+    frame.allocation_count = 0;
+    frame.pool_allocation_count = 0;
+}
+
+vk::DescriptorSet TransientDescriptorAllocator::allocate(const vk::DescriptorSetLayout layout) {
+    auto &frame = frames[frame_index];
+    for (;;) {
+        if (frame.current_pool == frame.pools.size())
+            frame.pools.emplace_back(create_pool());
+
+        vk::DescriptorSetAllocateInfo allocate_info{};
+        allocate_info.descriptorPool = *frame.pools[frame.current_pool];
+        allocate_info.setSetLayouts(layout);
+        // Going through the dispatcher keeps the pool exhaustion path free of exceptions, it is the expected way to grow.
+        VkDescriptorSet set;
+        const auto result = static_cast<vk::Result>(device.getDispatcher()->vkAllocateDescriptorSets(
+                *device, reinterpret_cast<const VkDescriptorSetAllocateInfo *>(&allocate_info), &set));
+        if (result == vk::Result::eSuccess) {
+            ++frame.allocation_count;
+            ++frame.pool_allocation_count;
+            return set;
+        }
+        // An empty pool that can't hold the set never will, its descriptor types are missing or it's too large.
+        if (!is_out_of_pool(result) || frame.pool_allocation_count == 0)
+            throw vk::SystemError{vk::make_error_code(result), "vkAllocateDescriptorSets"};
+        ++frame.current_pool;
+        frame.pool_allocation_count = 0;
+    }
+}
+
+size_t TransientDescriptorAllocator::get_pool_count() const {
+    return std::ranges::fold_left(frames | std::views::transform([](const Frame &frame) {
+        return frame.pools.size();
+    }), size_t{}, std::plus{});
+}
+
+vk::DescriptorSetLayout PackedDescriptorSetBase::get_set_layout(DescriptorSetLayoutCache &cache,
+                                                                const std::span<const DescriptorField> fields,
+                                                                const vk::ShaderStageFlags stages,
+                                                                const bool use_push_descriptor) {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    for (const auto &field: fields)
+        bindings.emplace_back(field.binding, field.type, field.count, stages);
+    return cache.get(bindings, use_push_descriptor ? vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR
+                                                   : vk::DescriptorSetLayoutCreateFlags{});
+}
+
+PackedDescriptorSetBase::PackedDescriptorSetBase(const vk::raii::Device &device,
+                                                 const std::span<const DescriptorField> fields,
+                                                 const vk::DescriptorSetLayout set_layout,
+                                                 const vk::PipelineLayout pipeline_layout,
+                                                 const vk::PipelineBindPoint bind_point, const uint32_t set,
+                                                 const bool use_push_descriptor)
+        : device{device}, bind_point{bind_point}, pipeline_layout{pipeline_layout}, set{set},
+          uses_push_descriptor{use_push_descriptor}, set_layout{set_layout}, update_template{[&]() {
+    std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+    for (const auto &field: fields)
+        entries.emplace_back(field.binding, 0, field.count, field.type, field.offset, field.stride);
+    vk::DescriptorUpdateTemplateCreateInfo create_info{};
+    create_info.setDescriptorUpdateEntries(entries);
+    if (use_push_descriptor) {
+        create_info.templateType = vk::DescriptorUpdateTemplateType::ePushDescriptorsKHR;
+        create_info.pipelineBindPoint = bind_point;
+        create_info.pipelineLayout = pipeline_layout;
+        create_info.set = set;
+    } else {
+        create_info.templateType = vk::DescriptorUpdateTemplateType::eDescriptorSet;
+        create_info.descriptorSetLayout = set_layout;
+    }
+    return vk::raii::DescriptorUpdateTemplate{device, create_info};
+}()} {}
+
+void PackedDescriptorSetBase::bind(const vk::raii::CommandBuffer &command_buffer, const void *const data,
+                                   TransientDescriptorAllocator &allocator) const {
+    if (uses_push_descriptor) {
+        command_buffer.getDispatcher()->vkCmdPushDescriptorSetWithTemplateKHR(
+                *command_buffer, *update_template, pipeline_layout, set, data);
+        return;
+    }
+    const auto descriptor_set = allocator.allocate(set_layout);
+    device.getDispatcher()->vkUpdateDescriptorSetWithTemplate(*device, descriptor_set, *update_template, data);
+    command_buffer.bindDescriptorSets(bind_point, pipeline_layout, set, descriptor_set, {});
+}
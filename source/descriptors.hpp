@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "noncopyable.hpp"
+#include "platform.hpp"
+
+struct DescriptorSetLayoutKey {
+    vk::DescriptorSetLayoutCreateFlags flags;
+    // Sorted by binding, immutable samplers are copied so the key owns everything it compares.
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    std::vector<std::vector<vk::Sampler>> immutable_samplers;
+
+    DescriptorSetLayoutKey(std::span<const vk::DescriptorSetLayoutBinding> bindings,
+                           vk::DescriptorSetLayoutCreateFlags flags);
+
+    bool operator==(const DescriptorSetLayoutKey &other) const;
+};
+
+template<>
+struct std::hash<DescriptorSetLayoutKey> {
+    size_t operator()(const DescriptorSetLayoutKey &key) const noexcept;
+};
+
+// Hands out one layout object per distinct binding description, no matter how many pipelines ask for it.
+class DescriptorSetLayoutCache : Noncopyable {
+    const vk::raii::Device &device;
+    std::mutex mutex;
+    std::unordered_map<DescriptorSetLayoutKey, vk::raii::DescriptorSetLayout> layouts;
+
+public:
+    explicit DescriptorSetLayoutCache(const vk::raii::Device &device) : device{device} {}
+
+    // Thread safe, the returned handle lives as long as the cache.
+    [[nodiscard]] vk::DescriptorSetLayout get(std::span<const vk::DescriptorSetLayoutBinding> bindings,
+                                              vk::DescriptorSetLayoutCreateFlags flags = {});
+
+    [[nodiscard]] size_t get_size();
+};
+
+// Allocates descriptor sets that only live for one frame. Every frame in flight owns a growing list of pools that are
+// reset as a whole once the frame retired, instead of freeing sets one by one. Meant to be used from one thread.
+class TransientDescriptorAllocator : Noncopyable {
+    struct Frame {
+        std::vector<vk::raii::DescriptorPool> pools;
+        size_t current_pool{};
+        uint32_t allocation_count{};
+        // Sets allocated from the current pool.
+        uint32_t pool_allocation_count{};
+    };
+
+    const vk::raii::Device &device;
+    const uint32_t sets_per_pool;
+    const std::vector<vk::DescriptorPoolSize> pool_sizes;
+    std::vector<Frame> frames;
+    size_t frame_index{};
+
+    vk::raii::DescriptorPool create_pool() const;
+
+public:
+    TransientDescriptorAllocator(const vk::raii::Device &device, uint32_t frames_in_flight,
+                                 uint32_t sets_per_pool = 1024);
+
+    // The frame's fence must have been waited on, its sets are invalidated.
+    void begin_frame(size_t frame_index);
+
+    [[nodiscard]] vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+
+    [[nodiscard]] size_t get_pool_count() const;
+
+    [[nodiscard]] uint32_t get_allocation_count() const {
+        return frames[frame_index].allocation_count;
+    }
+};
+
+// Where one descriptor binding lives inside a packed struct of vk::DescriptorBufferInfo, vk::DescriptorImageInfo or
+// vk::BufferView members, the layout descriptor update templates read from.
+struct DescriptorField {
+    uint32_t binding;
+    vk::DescriptorType type;
+    uint32_t count;
+    size_t offset;
+    size_t stride;
+};
+
+template<typename>
+struct MemberPointerTraits;
+
+template<typename Class, typename Field>
+struct MemberPointerTraits<Field Class::*> {
+    using Struct = Class;
+    using Type = Field;
+};
+
+template<auto Member>
+[[nodiscard]] DescriptorField make_descriptor_field(const uint32_t binding, const vk::DescriptorType type) {
+    using Traits = MemberPointerTraits<decltype(Member)>;
+    using Element = std::remove_all_extents_t<typename Traits::Type>;
+    static_assert(std::is_default_constructible_v<typename Traits::Struct>);
+    const typename Traits::Struct object{};
+    const auto offset = reinterpret_cast<const std::byte *>(&(object.*Member)) -
+                        reinterpret_cast<const std::byte *>(&object);
+    const auto count = std::is_array_v<typename Traits::Type> ? std::extent_v<typename Traits::Type> : 1;
+    return {binding, type, static_cast<uint32_t>(count), static_cast<size_t>(offset), sizeof(Element)};
+}
+
+// Writes a whole set from one packed struct through a descriptor update template. With VK_KHR_push_descriptor the
+// descriptors are pushed straight into the command buffer, otherwise a transient set is allocated, updated and bound.
+class PackedDescriptorSetBase : Noncopyable {
+    const vk::raii::Device &device;
+    const vk::PipelineBindPoint bind_point;
+    const vk::PipelineLayout pipeline_layout;
+    const uint32_t set;
+    const bool uses_push_descriptor;
+    const vk::DescriptorSetLayout set_layout;
+    const vk::raii::DescriptorUpdateTemplate update_template;
+
+protected:
+    PackedDescriptorSetBase(const vk::raii::Device &device, std::span<const DescriptorField> fields,
+                            vk::DescriptorSetLayout set_layout, vk::PipelineLayout pipeline_layout,
+                            vk::PipelineBindPoint bind_point, uint32_t set, bool use_push_descriptor);
+
+    void bind(const vk::raii::CommandBuffer &command_buffer, const void *data,
+              TransientDescriptorAllocator &allocator) const;
+
+public:
+    // The layout to build the pipeline layout with, push descriptor sets need a dedicated flag.
+    [[nodiscard]] static vk::DescriptorSetLayout get_set_layout(DescriptorSetLayoutCache &cache,
+                                                                std::span<const DescriptorField> fields,
+                                                                vk::ShaderStageFlags stages, bool use_push_descriptor);
+};
+
+template<typename T>
+class PackedDescriptorSet : public PackedDescriptorSetBase {
+public:
+    PackedDescriptorSet(const vk::raii::Device &device, const std::span<const DescriptorField> fields,
+                        const vk::DescriptorSetLayout set_layout, const vk::PipelineLayout pipeline_layout,
+                        const vk::PipelineBindPoint bind_point, const uint32_t set, const bool use_push_descriptor)
+            : PackedDescriptorSetBase{device, fields, set_layout, pipeline_layout, bind_point, set,
+                                      use_push_descriptor} {}
+
+    void bind(const vk::raii::CommandBuffer &command_buffer, const T &data,
+              TransientDescriptorAllocator &allocator) const {
+        PackedDescriptorSetBase::bind(command_buffer, &data, allocator);
+    }
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+// Optional device functionality that was found and enabled when the device got created, subsystems pick their fast
+// paths from it.
+struct DeviceFeatures {
+    bool global_priority{};
+    bool push_descriptor{};
+    // VK_EXT_extended_dynamic_state3, on top of the dynamic state Vulkan 1.3 always has.
+    bool dynamic_polygon_mode{};
+    bool dynamic_color_blend{};
+    bool dynamic_primitive_topology_unrestricted{};
+    // VK_KHR_pipeline_executable_properties, only enabled when a statistics report was asked for since capturing
+    // slows pipeline creation down.
+    bool capture_pipeline_statistics{};
+    bool capture_pipeline_internal_representations{};
+    // VK_EXT_memory_budget, MemoryGovernor estimates the budget without it.
+    bool memory_budget{};
+    // sparseBinding, sparseResidencyImage2D and shaderResourceMinLod for VirtualTextureSystem.
+    bool sparse_residency{};
+};
@@ -0,0 +1,140 @@
+#include "downsampler.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <ranges>
+#include <stdexcept>
+
+#include "gpu_helpers.hpp"
+
+namespace {
+    constexpr uint32_t tile_size{64};
+    constexpr uint32_t max_groups{64};
+
+    struct Parameters {
+        std::array<uint32_t, 2> group_count;
+        uint32_t level_count;
+    };
+
+    // Shuffles stand in for shared memory only when a subgroup holds at least one 2x2 quad of invocations.
+    bool supports_subgroup_shuffle(const vk::raii::PhysicalDevice &physical_device) {
+        const auto properties_chain{physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                vk::PhysicalDeviceSubgroupProperties>()};
+        const auto &subgroup_properties = properties_chain.get<vk::PhysicalDeviceSubgroupProperties>();
+        return (subgroup_properties.supportedStages & vk::ShaderStageFlagBits::eCompute) &&
+               (subgroup_properties.supportedOperations & vk::SubgroupFeatureFlagBits::eShuffle) &&
+               subgroup_properties.subgroupSize >= 4;
+    }
+
+    uint32_t get_group_count(const uint32_t extent) {
+        return (extent + tile_size - 1) / tile_size;
+    }
+}
+
+MipChainViews create_mip_chain_views(const vk::raii::Device &device, const vk::Image image, const vk::Format format,
+                                     const uint32_t mip_levels) {
+    MipChainViews views{vk::raii::ImageView{device, vk::ImageViewCreateInfo{
+            {}, image, vk::ImageViewType::e2D, format, {}, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}}}, {}};
+    for (const auto mip: std::views::iota(1u, mip_levels))
+        views.levels.emplace_back(device, vk::ImageViewCreateInfo{
+                {}, image, vk::ImageViewType::e2D, format, {}, {vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1}});
+    return views;
+}
+
+SinglePassDownsampler::SinglePassDownsampler(const vk::raii::PhysicalDevice &physical_device,
+                                             const vk::raii::Device &device, const ShaderRegistry &shader_registry,
+                                             PipelineStateCache &pipelines, PipelineLayoutCache &layouts,
+                                             SpecializationRegistry &specializations, DeviceAllocator &allocator,
+                                             const ShaderId shader, const ShaderId subgroup_shuffle_shader)
+        : allocator{allocator}, pipelines{pipelines},
+          sampler{device, vk::SamplerCreateInfo{{}, vk::Filter::eNearest, vk::Filter::eNearest,
+                                                vk::SamplerMipmapMode::eNearest, vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge}},
+          pipeline_layout{get_reflected_layout(shader_registry, layouts, shader).pipeline_layout},
+          descriptor_set{device, std::array{
+                  DescriptorField{0, vk::DescriptorType::eCombinedImageSampler, 1, offsetof(Bindings, source),
+                                  sizeof(vk::DescriptorImageInfo)},
+                  DescriptorField{1, vk::DescriptorType::eStorageImage, max_levels, offsetof(Bindings, levels),
+                                  sizeof(vk::DescriptorImageInfo)},
+                  DescriptorField{2, vk::DescriptorType::eStorageBuffer, 1, offsetof(Bindings, intermediate),
+                                  sizeof(vk::DescriptorBufferInfo)},
+                  DescriptorField{3, vk::DescriptorType::eStorageBuffer, 1, offsetof(Bindings, counter),
+                                  sizeof(vk::DescriptorBufferInfo)},
+          }, get_reflected_layout(shader_registry, layouts, shader).set_layouts.at(0), pipeline_layout,
+                         vk::PipelineBindPoint::eCompute, 0, false},
+          intermediate{allocator.create_buffer(
+                  vk::BufferCreateInfo{{}, max_groups * max_groups * 4 * sizeof(float),
+                                       vk::BufferUsageFlagBits::eStorageBuffer},
+                  MemoryUsage::DeviceLocal)},
+          counter{allocator.create_buffer(
+                  vk::BufferCreateInfo{{}, sizeof(uint32_t),
+                                       vk::BufferUsageFlagBits::eStorageBuffer |
+                                       vk::BufferUsageFlagBits::eTransferDst},
+                  MemoryUsage::DeviceLocal)} {
+    // Both variants have the same interface, so the layout above fits either.
+    const auto compute_shader = supports_subgroup_shuffle(physical_device) ? subgroup_shuffle_shader : shader;
+    for (const auto [index, key]: std::views::enumerate(keys)) {
+        key.compute_shader = compute_shader;
+        key.specialization = specializations.get_id(DownsampleVariant{static_cast<uint32_t>(index)});
+    }
+}
+
+SinglePassDownsampler::~SinglePassDownsampler() {
+    allocator.destroy(intermediate);
+    allocator.destroy(counter);
+}
+
+void SinglePassDownsampler::record(const vk::raii::CommandBuffer &command_buffer,
+                                   TransientDescriptorAllocator &descriptor_allocator, const vk::ImageView source,
+                                   const vk::Extent2D source_extent, const vk::Image destination,
+                                   const uint32_t first_mip, const std::span<const vk::ImageView> levels,
+                                   const DownsampleReduction reduction) {
+    const std::array group_count{get_group_count(source_extent.width), get_group_count(source_extent.height)};
+    if (levels.empty() || levels.size() > max_levels || group_count[0] > max_groups || group_count[1] > max_groups)
+        throw std::invalid_argument{"Downsampling takes up to 12 levels covering up to 4096x4096"};
+
+    const auto counter_buffer = allocator.get_buffer(counter);
+    if (!is_counter_cleared) {
+        // The last workgroup of every dispatch leaves the counter at zero again.
+        command_buffer.fillBuffer(counter_buffer, 0, vk::WholeSize, 0);
+        is_counter_cleared = true;
+    }
+
+    // Orders this dispatch's use of the shared buffers after the previous one.
+    const auto memory_barrier = get_memory_barrier();
+    const vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, first_mip,
+                                          static_cast<uint32_t>(levels.size()), 0, 1};
+    const auto barrier = get_image_barrier(destination, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+                                           range);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, memory_barrier, {}, barrier});
+
+    Bindings bindings{{*sampler, source, vk::ImageLayout::eShaderReadOnlyOptimal}, {},
+                      {allocator.get_buffer(intermediate), 0, vk::WholeSize}, {counter_buffer, 0, vk::WholeSize}};
+    // Unused entries repeat the last level, the shader never writes them.
+    for (const auto [index, level]: std::views::enumerate(bindings.levels))
+        level = {{}, levels[std::min(static_cast<size_t>(index), levels.size() - 1)], vk::ImageLayout::eGeneral};
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                pipelines.get(keys[static_cast<size_t>(reduction)]));
+    descriptor_set.bind(command_buffer, bindings, descriptor_allocator);
+    command_buffer.pushConstants<Parameters>(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                             Parameters{group_count, static_cast<uint32_t>(levels.size())});
+    command_buffer.dispatch(group_count[0], group_count[1], 1);
+
+    const auto final_barrier = get_image_barrier(destination, vk::ImageLayout::eGeneral,
+                                                 vk::ImageLayout::eShaderReadOnlyOptimal, range);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, final_barrier});
+}
+
+void SinglePassDownsampler::record(const vk::raii::CommandBuffer &command_buffer,
+                                   TransientDescriptorAllocator &descriptor_allocator, const vk::Image image,
+                                   const vk::Extent2D extent, const MipChainViews &views,
+                                   const DownsampleReduction reduction) {
+    if (views.levels.empty())
+        return;
+    std::vector<vk::ImageView> levels;
+    for (const auto &view: views.levels | std::views::take(max_levels))
+        levels.emplace_back(*view);
+    record(command_buffer, descriptor_allocator, *views.source, extent, image, 1, levels, reduction);
+}
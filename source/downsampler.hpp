@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "descriptors.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+#include "specialization.hpp"
+
+enum class DownsampleReduction : uint32_t {
+    Average,
+    // Hi-Z pyramids, the minimum is the farthest depth with reversed depth.
+    Min,
+    Max,
+};
+
+struct DownsampleVariant {
+    // A DownsampleReduction.
+    uint32_t reduction{};
+
+    bool operator==(const DownsampleVariant &) const = default;
+};
+
+template<>
+struct SpecializationTraits<DownsampleVariant> {
+    using Map = SpecializationMap<SpecializationMember<0, &DownsampleVariant::reduction>>;
+};
+
+// The sampled view of mip 0 and storage views of every further mip of an image, for generating its mips. Storage views
+// can't be sRGB, such images need the mutable format flag and a UNORM format here.
+struct MipChainViews {
+    vk::raii::ImageView source;
+    std::vector<vk::raii::ImageView> levels;
+};
+
+[[nodiscard]] MipChainViews create_mip_chain_views(const vk::raii::Device &device, vk::Image image, vk::Format format,
+                                                   uint32_t mip_levels);
+
+// Generates a whole mip chain or depth pyramid with a single compute dispatch, see shaders/downsample.comp, instead of
+// a blit and a barrier per level.
+class SinglePassDownsampler : Noncopyable {
+public:
+    static constexpr uint32_t max_levels{12};
+
+private:
+    struct Bindings {
+        vk::DescriptorImageInfo source;
+        std::array<vk::DescriptorImageInfo, max_levels> levels;
+        vk::DescriptorBufferInfo intermediate;
+        vk::DescriptorBufferInfo counter;
+    };
+
+    DeviceAllocator &allocator;
+    PipelineStateCache &pipelines;
+    const vk::raii::Sampler sampler;
+    const vk::PipelineLayout pipeline_layout;
+    const PackedDescriptorSet<Bindings> descriptor_set;
+    std::array<PipelineStateKey, 3> keys;
+    // Level 6 of every workgroup and the count of finished workgroups, shared by all dispatches one after another.
+    const AllocationId intermediate;
+    const AllocationId counter;
+    bool is_counter_cleared{};
+
+public:
+    // The shaders are downsample.comp and its downsample_subgroup_shuffle.comp variant, which is used where the device
+    // supports subgroup shuffles in compute shaders.
+    SinglePassDownsampler(const vk::raii::PhysicalDevice &physical_device, const vk::raii::Device &device,
+                          const ShaderRegistry &shader_registry, PipelineStateCache &pipelines,
+                          PipelineLayoutCache &layouts, SpecializationRegistry &specializations,
+                          DeviceAllocator &allocator, ShaderId shader, ShaderId subgroup_shuffle_shader);
+
+    ~SinglePassDownsampler();
+
+    // Writes up to max_levels levels below the source, sampled in shader read only layout. The levels halve
+    // source_extent of at most 4096x4096, which may exceed the source, its edge repeats then. They are mips first_mip and
+    // up of destination, which start undefined and end in shader read only layout.
+    void record(const vk::raii::CommandBuffer &command_buffer, TransientDescriptorAllocator &descriptor_allocator,
+                vk::ImageView source, vk::Extent2D source_extent, vk::Image destination, uint32_t first_mip,
+                std::span<const vk::ImageView> levels, DownsampleReduction reduction);
+
+    // Fills every mip of image from mip 0, which is in shader read only layout.
+    void record(const vk::raii::CommandBuffer &command_buffer, TransientDescriptorAllocator &descriptor_allocator,
+                vk::Image image, vk::Extent2D extent, const MipChainViews &views,
+                DownsampleReduction reduction = DownsampleReduction::Average);
+};
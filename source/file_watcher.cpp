@@ -0,0 +1,94 @@
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <SDL.h>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::FileWatcher(const std::span<const std::filesystem::path> roots)
+        : descriptor{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)} {
+    if (descriptor < 0)
+        throw std::runtime_error{std::string{"inotify_init1 failed: "} + std::strerror(errno)};
+    try {
+        for (const auto &root: roots)
+            watch(root);
+    } catch (...) {
+        close(descriptor);
+        throw;
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    close(descriptor);
+}
+
+void FileWatcher::watch(const std::filesystem::path &directory) {
+    constexpr uint32_t mask{IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR};
+    const auto watch_descriptor = inotify_add_watch(descriptor, directory.c_str(), mask);
+    if (watch_descriptor < 0)
+        throw std::runtime_error{"Couldn't watch " + directory.string() + ": " + std::strerror(errno)};
+    directories.insert_or_assign(watch_descriptor, directory);
+    for (const auto &entry: std::filesystem::directory_iterator{directory})
+        if (entry.is_directory())
+            watch(entry.path());
+}
+
+std::vector<std::filesystem::path> FileWatcher::wait(const std::chrono::milliseconds timeout) {
+    pollfd poll_descriptor{descriptor, POLLIN, 0};
+    if (poll(&poll_descriptor, 1, static_cast<int>(timeout.count())) <= 0)
+        return {};
+
+    std::vector<std::filesystem::path> changed;
+    alignas(inotify_event) std::array<char, 4096> buffer;
+    for (ssize_t size; (size = read(descriptor, buffer.data(), buffer.size())) > 0;) {
+        for (ssize_t offset{}; offset < size;) {
+            const auto &event = *reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+            const auto directory = directories.find(event.wd);
+            if (directory == directories.end() || event.len == 0)
+                continue;
+            const auto path = directory->second / event.name;
+            if (event.mask & IN_ISDIR) {
+                // New subdirectories are watched as well, files copied in before the watch was added are missed.
+                // One that vanished again or hit the watch limit is skipped, the rest keeps being watched.
+                if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                    try {
+                        watch(path);
+                    } catch (const std::exception &error) {
+                        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Not watching %s: %s", path.string().c_str(),
+                                    error.what());
+                    }
+                }
+            } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                if (!std::ranges::contains(changed, path))
+                    changed.emplace_back(path);
+            }
+        }
+    }
+    return changed;
+}
+
+#else
+
+FileWatcher::FileWatcher(std::span<const std::filesystem::path>) {
+    throw std::runtime_error{"File watching is only implemented with inotify"};
+}
+
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::watch(const std::filesystem::path &) {}
+
+std::vector<std::filesystem::path> FileWatcher::wait(std::chrono::milliseconds) {
+    return {};
+}
+
+#endif
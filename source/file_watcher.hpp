@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "noncopyable.hpp"
+
+// Reports files written in a set of directories and their subdirectories. Only implemented with inotify, the
+// constructor throws std::runtime_error elsewhere.
+class FileWatcher : Noncopyable {
+    int descriptor{-1};
+    std::unordered_map<int, std::filesystem::path> directories;
+
+    void watch(const std::filesystem::path &directory);
+
+public:
+    explicit FileWatcher(std::span<const std::filesystem::path> roots);
+
+    ~FileWatcher();
+
+    // Waits up to the timeout for changes and returns every file finished writing or moved in since the last call.
+    // Editors saving through a temporary file show up with the final name.
+    [[nodiscard]] std::vector<std::filesystem::path> wait(std::chrono::milliseconds timeout);
+};
@@ -0,0 +1,132 @@
+#include "frame_submitter.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+namespace {
+    struct Signal {
+        vk::Semaphore semaphore;
+        uint64_t value;
+        SubmissionThread *queue;
+    };
+
+    bool satisfies(const Signal &signal, const vk::SemaphoreSubmitInfo &wait) {
+        // Binary semaphores carry a zero value on both sides, timeline ones are satisfied by any later value.
+        return signal.semaphore == wait.semaphore && signal.value >= wait.value;
+    }
+
+    // Folding the next batch into the previous one moves its waits before the previous command buffers and the previous
+    // signals after its own, which is only harmless when neither exists.
+    bool can_merge(const SubmitBatch &previous, const SubmitBatch &next) {
+        return previous.signal_semaphores.empty() && next.wait_semaphores.empty();
+    }
+}
+
+void FrameSubmitAggregator::add(SubmissionThread &queue, SubmitBatch batch, const int32_t order) {
+    const std::scoped_lock lock{mutex};
+    registrations.emplace_back(&queue, order, next_sequence++, std::move(batch));
+}
+
+void FrameSubmitAggregator::set_fence(SubmissionThread &queue, const vk::Fence fence) {
+    const std::scoped_lock lock{mutex};
+    fences.emplace_back(&queue, fence);
+}
+
+void FrameSubmitAggregator::flush() {
+    const std::scoped_lock lock{mutex};
+    std::ranges::stable_sort(registrations, {}, [](const Registration &registration) {
+        return std::pair{registration.order, registration.sequence};
+    });
+
+    std::vector<SubmissionThread *> queues;
+    for (const auto &registration: registrations)
+        if (!std::ranges::contains(queues, registration.queue))
+            queues.emplace_back(registration.queue);
+
+    // Semaphores signaled by this frame's batches, a wait on them has to be submitted after its signal.
+    std::vector<Signal> pending_signals;
+    for (const auto &registration: registrations)
+        for (const auto &signal: registration.batch.signal_semaphores)
+            pending_signals.emplace_back(signal.semaphore, signal.value, registration.queue);
+    std::vector<Signal> submitted_signals;
+
+    const auto is_ready = [&](const SubmitBatch &batch, const std::span<const Signal> local_signals) {
+        return std::ranges::all_of(batch.wait_semaphores, [&](const vk::SemaphoreSubmitInfo &wait) {
+            const auto satisfied_by = [&](const Signal &signal) { return satisfies(signal, wait); };
+            return std::ranges::none_of(pending_signals, satisfied_by) ||
+                   std::ranges::any_of(submitted_signals, satisfied_by) ||
+                   std::ranges::any_of(local_signals, satisfied_by);
+        });
+    };
+
+    std::vector<std::vector<Registration *>> remaining(queues.size());
+    for (auto &registration: registrations)
+        remaining[std::ranges::find(queues, registration.queue) - queues.begin()].emplace_back(&registration);
+
+    uint32_t submit_calls{};
+    uint32_t batch_count{};
+    for (auto progress{true}; progress;) {
+        progress = false;
+        for (auto &&[queue, pending]: std::views::zip(queues, remaining)) {
+            // Take the longest prefix whose waits are already satisfied, it becomes a single vkQueueSubmit2 call.
+            QueueSubmission submission{};
+            std::vector<Signal> local_signals;
+            size_t taken{};
+            for (; taken < pending.size() && is_ready(pending[taken]->batch, local_signals); ++taken) {
+                auto &batch = pending[taken]->batch;
+                for (const auto &signal: batch.signal_semaphores)
+                    local_signals.emplace_back(signal.semaphore, signal.value, queue);
+                if (!submission.batches.empty() && can_merge(submission.batches.back(), batch)) {
+                    // The merged batch signals what the next one would have, after all of its command buffers.
+                    auto &merged = submission.batches.back();
+                    std::ranges::move(batch.command_buffers, std::back_inserter(merged.command_buffers));
+                    std::ranges::move(batch.signal_semaphores, std::back_inserter(merged.signal_semaphores));
+                } else
+                    submission.batches.emplace_back(std::move(batch));
+            }
+            if (!taken)
+                continue;
+            pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(taken));
+            // Every queue's thread calls the driver on its own schedule, so a binary semaphore signaled through
+            // another queue may not have reached the driver yet, and waiting on it before that is invalid. Timeline
+            // semaphores allow waits submitted before their signal.
+            std::vector<SubmissionThread *> signaling_queues;
+            for (const auto &batch: submission.batches)
+                for (const auto &wait: batch.wait_semaphores)
+                    for (const auto &signal: submitted_signals)
+                        if (signal.queue != queue && signal.value == 0 && satisfies(signal, wait) &&
+                            !std::ranges::contains(signaling_queues, signal.queue))
+                            signaling_queues.emplace_back(signal.queue);
+            for (auto *const signaling_queue: signaling_queues)
+                signaling_queue->flush();
+            std::ranges::move(local_signals, std::back_inserter(submitted_signals));
+            if (pending.empty())
+                if (const auto fence = std::ranges::find(fences, queue, &std::pair<SubmissionThread *, vk::Fence>::first);
+                        fence != fences.end())
+                    submission.fence = fence->second;
+            batch_count += static_cast<uint32_t>(submission.batches.size());
+            ++submit_calls;
+            queue->submit(std::move(submission));
+            progress = true;
+        }
+    }
+
+    // A queue that got no work this frame still has to signal its fence, an empty submit does exactly that.
+    for (const auto &[queue, fence]: fences) {
+        if (std::ranges::contains(queues, queue))
+            continue;
+        queue->submit({{}, fence});
+        ++submit_calls;
+    }
+
+    const auto stuck = std::ranges::any_of(remaining, [](const auto &pending) { return !pending.empty(); });
+    stats.submit_calls = submit_calls;
+    stats.batches = batch_count;
+    stats.registrations = static_cast<uint32_t>(registrations.size());
+    stats.max_submit_calls = std::max(stats.max_submit_calls, submit_calls);
+    registrations.clear();
+    fences.clear();
+    if (stuck)
+        throw std::logic_error{"Frame submissions wait on each other in a cycle"};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "noncopyable.hpp"
+#include "submission.hpp"
+
+struct FrameSubmitStats {
+    uint32_t submit_calls{};
+    uint32_t batches{};
+    uint32_t registrations{};
+    uint32_t max_submit_calls{};
+};
+
+// Collects the command buffers every producer records during a frame and turns them into as few vkQueueSubmit2
+// calls per queue as the semaphore dependencies between queues allow. A batch waiting on a binary semaphore another
+// queue signals is only handed over once that signal reached the driver.
+class FrameSubmitAggregator : Noncopyable {
+    struct Registration {
+        SubmissionThread *queue;
+        int32_t order;
+        uint64_t sequence;
+        SubmitBatch batch;
+    };
+
+    std::mutex mutex;
+    std::vector<Registration> registrations;
+    std::vector<std::pair<SubmissionThread *, vk::Fence>> fences;
+    uint64_t next_sequence{};
+    FrameSubmitStats stats{};
+
+public:
+    // Thread safe, batches on the same queue keep ascending order, then registration order.
+    void add(SubmissionThread &queue, SubmitBatch batch, int32_t order = 0);
+
+    // Signaled by the last submit of that queue for the current frame.
+    void set_fence(SubmissionThread &queue, vk::Fence fence);
+
+    void flush();
+
+    [[nodiscard]] FrameSubmitStats get_stats() const {
+        return stats;
+    }
+};
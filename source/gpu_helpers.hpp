@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+
+#include "pipeline_layouts.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+
+// Small helpers shared by the compute passes and texture streaming.
+
+// Orders everything before against everything after while transitioning the layout. Cheap enough where it runs once
+// or twice a frame, finer barriers aren't worth their bookkeeping there.
+[[nodiscard]] inline vk::ImageMemoryBarrier2 get_image_barrier(const vk::Image image, const vk::ImageLayout old_layout,
+                                                               const vk::ImageLayout new_layout,
+                                                               const vk::ImageSubresourceRange &range) {
+    vk::ImageMemoryBarrier2 barrier{};
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+    barrier.srcAccessMask = vk::AccessFlagBits2::eMemoryWrite;
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    return barrier;
+}
+
+// The same without a layout transition.
+[[nodiscard]] inline vk::MemoryBarrier2 get_memory_barrier() {
+    return {vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite,
+            vk::PipelineStageFlagBits2::eAllCommands,
+            vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite};
+}
+
+// Block compressed formats store whole blocks even for regions smaller than one.
+[[nodiscard]] inline vk::DeviceSize get_image_bytes(const vk::Format format, const vk::Extent2D extent) {
+    const auto block_extent = vk::blockExtent(format);
+    const auto blocks_x = (extent.width + block_extent[0] - 1) / block_extent[0];
+    const auto blocks_y = (extent.height + block_extent[1] - 1) / block_extent[1];
+    return vk::DeviceSize{blocks_x} * blocks_y * vk::blockSize(format);
+}
+
+// The layout of a compute pipeline made of one shader.
+[[nodiscard]] inline ReflectedPipelineLayout get_reflected_layout(const ShaderRegistry &shader_registry,
+                                                                  PipelineLayoutCache &layouts,
+                                                                  const ShaderId shader) {
+    const std::array stages{shader_registry.get_reflection(shader)};
+    return layouts.get(stages);
+}
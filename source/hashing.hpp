@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Boost's hash_combine with the 64 bit golden ratio constant.
+template<typename T>
+void hash_combine(size_t &seed, const T &value) {
+    seed ^= std::hash<T>{}(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+template<typename... Ts>
+[[nodiscard]] size_t hash_values(const Ts &... values) {
+    size_t seed{};
+    (hash_combine(seed, values), ...);
+    return seed;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+
+#include "noncopyable.hpp"
+
+// Bounded multi producer multi consumer queue, every cell carries a sequence number telling producers and consumers
+// whose turn it is, so neither side ever takes a lock (Dmitry Vyukov's design).
+template<typename T>
+class LockFreeQueue : Noncopyable {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        std::optional<T> value;
+    };
+
+    static constexpr size_t cache_line_size{64};
+
+    const size_t mask;
+    const std::unique_ptr<Cell[]> cells;
+    alignas(cache_line_size) std::atomic<size_t> enqueue_position{0};
+    alignas(cache_line_size) std::atomic<size_t> dequeue_position{0};
+
+public:
+    explicit LockFreeQueue(const size_t capacity) : mask{capacity - 1}, cells{new Cell[capacity]} {
+        if (capacity < 2 || !std::has_single_bit(capacity))
+            throw std::invalid_argument{"LockFreeQueue capacity must be a power of two"};
+        for (size_t index{}; index < capacity; ++index)
+            cells[index].sequence.store(index, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool try_push(T &&value) {
+        auto position = enqueue_position.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &cell = cells[position & mask];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value.emplace(std::move(value));
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    [[nodiscard]] std::optional<T> try_pop() {
+        auto position = dequeue_position.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &cell = cells[position & mask];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    std::optional<T> value{std::move(cell.value)};
+                    cell.value.reset();
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return value;
+                }
+            } else if (difference < 0) {
+                return std::nullopt;
+            } else {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only a snapshot, other threads may change it right after.
+    [[nodiscard]] size_t get_size() const {
+        const auto enqueued = enqueue_position.load(std::memory_order_relaxed);
+        const auto dequeued = dequeue_position.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    [[nodiscard]] size_t get_capacity() const {
+        return mask + 1;
+    }
+};
@@ -1,33 +1,32 @@
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <expected>
+#include <limits>
 #include <ranges>
 
-#include <SDL.h>
-#include <SDL_vulkan.h>
-#include <SDL_syswm.h>
-
-#ifdef SDL_ENABLE_SYSWM_WINDOWS
-#define VK_USE_PLATFORM_WIN32_KHR
-#endif
-#ifdef SDL_ENABLE_SYSWM_WAYLAND
-#define VK_USE_PLATFORM_WAYLAND_KHR
-#endif
-#ifdef SDL_ENABLE_SYSWM_X11
-#define VK_USE_PLATFORM_XLIB_KHR
-#endif
-#define VULKAN_HPP_ENABLE_DYNAMIC_LOADER_TOOL 0
-#define VULKAN_HPP_NO_DEFAULT_DISPATCHER
-
-#include <vulkan/vulkan_raii.hpp>
-
-class Noncopyable {
-public:
-    Noncopyable() = default;
-
-    Noncopyable(const Noncopyable &) = delete;
-
-    const Noncopyable &operator=(const Noncopyable &) = delete;
-};
+#include "async_compute.hpp"
+#include "config.hpp"
+#include "deferred_deletion.hpp"
+#include "descriptors.hpp"
+#include "device_features.hpp"
+#include "frame_submitter.hpp"
+#include "memory.hpp"
+#include "memory_allocator.hpp"
+#include "memory_budget.hpp"
+#include "noncopyable.hpp"
+#include "pipeline_layouts.hpp"
+#include "pipeline_manifest.hpp"
+#include "pipeline_statistics.hpp"
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "queues.hpp"
+#include "shader_hot_reload.hpp"
+#include "simd_math.hpp"
+#include "submission.hpp"
+#include "texture_residency.hpp"
+#include "threading.hpp"
+#include "virtual_texture.hpp"
 
 class SDLException : private std::runtime_error {
     const int code;
@@ -171,12 +170,27 @@ class Surface : Noncopyable {
 public:
     static auto create_swapchain(const vk::raii::Device &device, const QueueFamily &queue_family,
                                  const vk::raii::SurfaceKHR &surface,
-                                 const std::optional<vk::SwapchainKHR> old_swapchain) {
+                                 const std::optional<vk::SwapchainKHR> old_swapchain,
+                                 const bool writes_with_compute) {
         const auto &[physical_device, queue_family_index] = queue_family;
 
         const auto surface_capabilities{physical_device.getSurfaceCapabilitiesKHR(*surface)};
+        // When post-processing writes the final image with compute it needs a storage capable UNORM format, its last
+        // pass encodes sRGB itself then. Everything else renders into the sRGB format, which encodes for free.
+        const auto supports_storage{
+                writes_with_compute && (surface_capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage) &&
+                (physical_device.getFormatProperties(vk::Format::eB8G8R8A8Unorm).optimalTilingFeatures &
+                 vk::FormatFeatureFlagBits::eStorageImage)};
         const auto surface_format{[&]() {
             const auto surface_formats{physical_device.getSurfaceFormatsKHR(*surface)};
+            if (supports_storage) {
+                for (const auto &surface_format: surface_formats) {
+                    if (surface_format.format == vk::Format::eB8G8R8A8Unorm &&
+                        surface_format.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
+                        return surface_format;
+                    }
+                }
+            }
             for (const auto &surface_format: surface_formats) {
                 if (surface_format.format == vk::Format::eB8G8R8A8Srgb &&
                     surface_format.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear) {
@@ -199,6 +213,8 @@ public:
                                                          surface_capabilities.minImageCount,
                                                          surface_capabilities.maxImageCount);
         swapchain_create_info.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+        if (supports_storage && surface_format.format == vk::Format::eB8G8R8A8Unorm)
+            swapchain_create_info.imageUsage |= vk::ImageUsageFlagBits::eStorage;
         swapchain_create_info.imageArrayLayers = 1;
         swapchain_create_info.imageFormat = surface_format.format;
         swapchain_create_info.imageColorSpace = surface_format.colorSpace;
@@ -208,14 +224,20 @@ public:
     }
 
     Surface(const Window &window, const vk::raii::Instance &instance, const vk::raii::Device &device,
-            const QueueFamily &queue_family) : handle(
+            const QueueFamily &queue_family, const bool writes_with_compute) : handle(
             window.create_surface(instance)), queue_family{queue_family} {
-        create_swapchain(device, queue_family, handle, {});
+        create_swapchain(device, queue_family, handle, {}, writes_with_compute);
     }
 };
 
 auto main(const int, const char *const *const) -> int {
     const SDL sdl{SDL_InitFlags::SDL_INIT_VIDEO};
+
+    const auto cpu_topology{CpuTopology::detect()};
+    const auto thread_placement{ThreadPlacement::plan(cpu_topology, ThreadingConfig::from_environment())};
+    thread_placement.log();
+    SDL_Log("Culling and transform math: %s", to_string(get_simd_level()).data());
+    JobSystem job_system{thread_placement};
     const VulkanLibrary vulkan_library{};
 
     const vk::raii::Context context{vulkan_library.get_instance_proc_addr()};
@@ -299,28 +321,235 @@ auto main(const int, const char *const *const) -> int {
 
     if (!queue_family.has_value()) throw std::runtime_error("Couldn't find a suitable queue family");
     const auto &[physical_device, queue_family_index] = *queue_family;
+    const auto available_device_extensions{physical_device.enumerateDeviceExtensionProperties()};
+    const auto is_device_extension_available = [&](const std::string_view name) {
+        return std::ranges::any_of(available_device_extensions, [&](const vk::ExtensionProperties &properties) {
+            return std::string_view{properties.extensionName} == name;
+        });
+    };
+    std::vector<const char *> device_extensions{VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    const auto enable_device_extension = [&](const char *const name) {
+        if (!is_device_extension_available(name))
+            return false;
+        device_extensions.emplace_back(name);
+        return true;
+    };
+    DeviceFeatures device_features{};
+    device_features.global_priority = enable_device_extension(VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME) ||
+                                      enable_device_extension(VK_EXT_GLOBAL_PRIORITY_EXTENSION_NAME);
+    // Per draw bindings go through PackedDescriptorSet, which pushes them when this is available.
+    device_features.push_descriptor = enable_device_extension(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT extended_dynamic_state_3_features{};
+    if (enable_device_extension(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        const auto supported{physical_device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>().get<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>()};
+        const auto properties{physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+                vk::PhysicalDeviceExtendedDynamicState3PropertiesEXT>().get<vk::PhysicalDeviceExtendedDynamicState3PropertiesEXT>()};
+        extended_dynamic_state_3_features.extendedDynamicState3PolygonMode = supported.extendedDynamicState3PolygonMode;
+        extended_dynamic_state_3_features.extendedDynamicState3ColorBlendEnable =
+                supported.extendedDynamicState3ColorBlendEnable && supported.extendedDynamicState3ColorBlendEquation &&
+                supported.extendedDynamicState3ColorWriteMask;
+        extended_dynamic_state_3_features.extendedDynamicState3ColorBlendEquation =
+                extended_dynamic_state_3_features.extendedDynamicState3ColorBlendEnable;
+        extended_dynamic_state_3_features.extendedDynamicState3ColorWriteMask =
+                extended_dynamic_state_3_features.extendedDynamicState3ColorBlendEnable;
+        device_features.dynamic_polygon_mode = extended_dynamic_state_3_features.extendedDynamicState3PolygonMode;
+        device_features.dynamic_color_blend = extended_dynamic_state_3_features.extendedDynamicState3ColorBlendEnable;
+        device_features.dynamic_primitive_topology_unrestricted = properties.dynamicPrimitiveTopologyUnrestricted;
+    }
+    const auto pipeline_statistics_config{PipelineStatisticsConfig::from_environment()};
+    vk::PhysicalDevicePipelineExecutablePropertiesFeaturesKHR pipeline_executable_properties_features{};
+    if (pipeline_statistics_config.report_path &&
+        enable_device_extension(VK_KHR_PIPELINE_EXECUTABLE_PROPERTIES_EXTENSION_NAME)) {
+        pipeline_executable_properties_features.pipelineExecutableInfo = true;
+        device_features.capture_pipeline_statistics = true;
+        device_features.capture_pipeline_internal_representations =
+                pipeline_statistics_config.internal_representations;
+    }
+    device_features.memory_budget = enable_device_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    auto queue_plan{QueuePlan::create(physical_device, static_cast<uint32_t>(queue_family_index),
+                                      QueuePriorityConfig::from_environment(), device_features.global_priority)};
+
     vk::DeviceCreateInfo info{};
-    vk::DeviceQueueCreateInfo queue_create_infos{};
-    const auto queue_priorities = {0.0f};
-    queue_create_infos.setQueuePriorities(queue_priorities);
-    queue_create_infos.queueFamilyIndex = queue_family_index;
-    info.setQueueCreateInfos(queue_create_infos);
-    const auto device_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
     info.setPEnabledExtensionNames(device_extensions);
-
-    const vk::raii::Device device{physical_device, info};
-    const vk::raii::Queue queue{device, queue_family_index, 0};
+    vk::PhysicalDeviceFeatures enabled_features{};
+    // Streaming goes through the frame queue's family, so that's where sparse binding has to be.
+    if (VirtualTextureSystem::is_supported(physical_device, static_cast<uint32_t>(queue_family_index))) {
+        enabled_features.sparseBinding = true;
+        enabled_features.sparseResidencyImage2D = true;
+        enabled_features.shaderResourceMinLod = true;
+        device_features.sparse_residency = true;
+    }
+    // Post-processing stores into BGRA swapchain images, which have no GLSL format qualifier.
+    enabled_features.shaderStorageImageWriteWithoutFormat =
+            physical_device.getFeatures().shaderStorageImageWriteWithoutFormat;
+    info.setPEnabledFeatures(&enabled_features);
+
+    vk::PhysicalDeviceVulkan12Features vulkan_12_features{};
+    vulkan_12_features.timelineSemaphore = true;
+    vk::PhysicalDeviceVulkan13Features vulkan_13_features{};
+    vulkan_13_features.synchronization2 = true;
+    vk::StructureChain<vk::DeviceCreateInfo, vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features,
+            vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT, vk::PhysicalDevicePipelineExecutablePropertiesFeaturesKHR>
+            device_structure_chain{info, vulkan_12_features, vulkan_13_features, extended_dynamic_state_3_features,
+                                   pipeline_executable_properties_features};
+    if (!device_features.dynamic_polygon_mode && !device_features.dynamic_color_blend)
+        device_structure_chain.unlink<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+    if (!device_features.capture_pipeline_statistics)
+        device_structure_chain.unlink<vk::PhysicalDevicePipelineExecutablePropertiesFeaturesKHR>();
+
+    const auto device{[&]() {
+        auto queue_create_infos{queue_plan.get_create_infos()};
+        device_structure_chain.get<vk::DeviceCreateInfo>().setQueueCreateInfos(queue_create_infos);
+        try {
+            return vk::raii::Device{physical_device, device_structure_chain.get<vk::DeviceCreateInfo>()};
+        } catch (const vk::SystemError &error) {
+            if (error.code() != vk::Result::eErrorNotPermittedKHR || !queue_plan.uses_global_priority())
+                throw;
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Not permitted to raise the queue global priority, ignoring it");
+            queue_plan.drop_global_priority();
+            queue_create_infos = queue_plan.get_create_infos();
+            device_structure_chain.get<vk::DeviceCreateInfo>().setQueueCreateInfos(queue_create_infos);
+            return vk::raii::Device{physical_device, device_structure_chain.get<vk::DeviceCreateInfo>()};
+        }
+    }()};
+    // Decides whether CPU written buffers can live in VRAM or have to go through a staging copy.
+    const MemoryTypes memory_types{physical_device};
+    memory_types.log();
+    constexpr uint32_t frames_in_flight{2};
+    DeviceAllocator device_allocator{device, physical_device, memory_types, frames_in_flight};
+    // Subsystems register pressure callbacks on it to give memory back before allocations fail.
+    MemoryGovernor memory_governor{physical_device, device_allocator, device_features};
+    device_allocator.set_out_of_memory_callback([&](const uint32_t heap_index) {
+        memory_governor.report_out_of_memory(heap_index);
+    });
+    SubmissionThread submission_thread{queue_plan.get_queue(device, QueueRole::Frame), thread_placement};
+    // Streaming uploads get their own lower priority queue whenever the family has one to spare.
+    std::optional<SubmissionThread> streaming_submission_thread{};
+    if (queue_plan.has_dedicated_queue(QueueRole::Streaming))
+        streaming_submission_thread.emplace(queue_plan.get_queue(device, QueueRole::Streaming), thread_placement);
+    std::optional<SubmissionThread> async_compute_submission_thread{};
+    if (queue_plan.has_dedicated_queue(QueueRole::AsyncCompute))
+        async_compute_submission_thread.emplace(queue_plan.get_queue(device, QueueRole::AsyncCompute),
+                                                thread_placement);
+    AsyncComputeScheduler async_compute_scheduler{device, queue_plan};
+    // Every command buffer of a frame goes through here, whichever queue it runs on.
+    FrameSubmitAggregator frame_submitter{};
+
+    DescriptorSetLayoutCache descriptor_set_layout_cache{device};
+    PipelineLayoutCache pipeline_layout_cache{device, descriptor_set_layout_cache};
+    ShaderRegistry shader_registry{device};
+    VertexLayoutRegistry vertex_layout_registry{};
+    SpecializationRegistry specialization_registry{};
+    PipelineManifest pipeline_manifest{};
+    PipelineStateCache pipeline_state_cache{device, shader_registry, pipeline_layout_cache, vertex_layout_registry,
+                                            specialization_registry, device_features};
+    // Pipelines the last run used compile on the workers while loading goes on, in the order they were first needed.
+    const std::filesystem::path pipeline_manifest_path{
+            get_config("APP_PIPELINE_MANIFEST", std::string_view{"pipelines.manifest"})};
+    const auto pipeline_warm_up = pipeline_state_cache.warm_up(
+            pipeline_manifest.load(pipeline_manifest_path, shader_registry, vertex_layout_registry,
+                                   specialization_registry), job_system);
+    pipeline_state_cache.record_usage(&pipeline_manifest);
+
+    DeferredDeletionQueue deferred_deletion_queue{frames_in_flight};
+    TextureResidencyManager texture_residency{device, device_allocator, deferred_deletion_queue, memory_governor};
+    device_allocator.set_move_callback([&](const AllocationId id) {
+        texture_residency.handle_move(id);
+    });
+    // Terrain and map tiles far beyond VRAM, bound page by page on the streaming queue.
+    std::optional<VirtualTextureSystem> virtual_textures{};
+    if (device_features.sparse_residency)
+        virtual_textures.emplace(device, memory_types, device_allocator, deferred_deletion_queue,
+                                 streaming_submission_thread ? *streaming_submission_thread : submission_thread,
+                                 frames_in_flight);
+    std::optional<ShaderHotReloader> shader_hot_reloader{};
+    if (const auto hot_reload_config{ShaderHotReloadConfig::from_environment()}; hot_reload_config.enabled) {
+        try {
+            shader_hot_reloader.emplace(shader_registry, pipeline_state_cache, deferred_deletion_queue,
+                                        hot_reload_config);
+        } catch (const std::exception &error) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Shader hot reload is off: %s", error.what());
+        }
+    }
 
     std::optional<Surface> surface{};
+    // PostProcessor isn't part of the frame yet, nothing writes the swapchain images with compute.
+    constexpr bool post_processing_writes_swapchain{false};
     const auto create_surface = [&]() {
-        surface.emplace(window, instance, device, *queue_family);
+        surface.emplace(window, instance, device, *queue_family, post_processing_writes_swapchain);
     };
 #ifndef __ANDROID__
     create_surface();
 #endif
     window.show();
 
+    // The main thread records frames and, since SDL wants them pumped from there, handles events in between, so it
+    // takes the render placement. Only now, every helper thread above was spawned with the unrestricted affinity.
+    thread_placement.apply(ThreadRole::Render);
+    // Each pass of the loop is one frame that starts by waiting for the fence of the frame frames_in_flight before it,
+    // only then may the per frame bookkeeping below retire what that frame used. The frame's command buffer carries
+    // nothing but the defragmentation copies and texture streaming so far.
+    struct FrameResources {
+        vk::raii::CommandPool command_pool;
+        vk::raii::CommandBuffer command_buffer;
+        vk::raii::Fence fence;
+    };
+    std::vector<FrameResources> frames;
+    for (uint32_t index{}; index < frames_in_flight; ++index) {
+        vk::raii::CommandPool command_pool{device, vk::CommandPoolCreateInfo{
+                vk::CommandPoolCreateFlagBits::eTransient, queue_plan.get_location(QueueRole::Frame).family_index}};
+        vk::raii::CommandBuffers command_buffers{device, {*command_pool, vk::CommandBufferLevel::ePrimary, 1}};
+        frames.emplace_back(std::move(command_pool), std::move(command_buffers.front()),
+                            vk::raii::Fence{device, vk::FenceCreateInfo{vk::FenceCreateFlagBits::eSignaled}});
+    }
+    uint32_t frame_index{};
+    // Driver time spent in submits, sparse binds and presents and how many pipelines dynamic state saved, every few
+    // seconds.
+    constexpr std::chrono::seconds stats_interval{10};
+    auto next_stats{std::chrono::steady_clock::now() + stats_interval};
     for (auto should_close{false}; !should_close;) {
+        if (const auto now{std::chrono::steady_clock::now()}; now >= next_stats) {
+            submission_thread.log_stats("Frame");
+            if (streaming_submission_thread)
+                streaming_submission_thread->log_stats("Streaming");
+            if (async_compute_submission_thread)
+                async_compute_submission_thread->log_stats("Async compute");
+            pipeline_state_cache.log_stats();
+            next_stats = now + stats_interval;
+        }
+        auto &frame = frames[frame_index];
+        if (device.waitForFences({*frame.fence}, vk::True, std::numeric_limits<uint64_t>::max()) !=
+            vk::Result::eSuccess)
+            throw std::runtime_error{"Waiting for a frame to finish failed"};
+        device.resetFences({*frame.fence});
+        deferred_deletion_queue.begin_frame();
+        device_allocator.begin_frame();
+        memory_governor.update();
+        texture_residency.begin_frame();
+        if (virtual_textures)
+            virtual_textures->begin_frame(frame_index);
+
+        frame.command_pool.reset();
+        frame.command_buffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        device_allocator.record_defragmentation(frame.command_buffer);
+        texture_residency.record(frame.command_buffer);
+        // The page copies need the binds virtual_textures queued on the streaming queue.
+        std::vector<vk::SemaphoreSubmitInfo> waits;
+        if (virtual_textures) {
+            virtual_textures->record(frame.command_buffer, frame_index);
+            waits.emplace_back(virtual_textures->get_bind_wait());
+        }
+        frame.command_buffer.end();
+        frame_submitter.add(submission_thread,
+                            {std::move(waits), {vk::CommandBufferSubmitInfo{*frame.command_buffer}}, {}});
+        frame_submitter.set_fence(submission_thread, *frame.fence);
+        frame_submitter.flush();
+        frame_index = (frame_index + 1) % frames_in_flight;
+
+        if (shader_hot_reloader)
+            shader_hot_reloader->apply();
         for (SDL_Event event; SDL_PollEvent(&event);) {
             switch (event.type) {
                 case SDL_EventType::SDL_EVENT_QUIT:
@@ -336,5 +565,35 @@ auto main(const int, const char *const *const) -> int {
         }
     }
 
+    // Nothing may still run on the GPU once the frame resources and what the deferred deletion queue holds go away.
+    // Work still queued on any submission thread, sparse binds included, would reach the driver after the wait.
+    submission_thread.flush();
+    if (streaming_submission_thread)
+        streaming_submission_thread->flush();
+    if (async_compute_submission_thread)
+        async_compute_submission_thread->flush();
+    device.waitIdle();
+
+    // The workers must not compile into a cache that is going away.
+    for (const auto &ready: pipeline_warm_up)
+        ready.wait();
+    if (device_features.capture_pipeline_statistics) {
+        try {
+            write_pipeline_statistics_report(
+                    collect_pipeline_statistics(device, pipeline_state_cache, shader_registry,
+                                                device_features.capture_pipeline_internal_representations),
+                    *pipeline_statistics_config.report_path, pipeline_statistics_config.sort_by);
+        } catch (const std::exception &error) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "%s", error.what());
+        }
+    }
+    pipeline_state_cache.record_usage(nullptr);
+    try {
+        pipeline_manifest.save(pipeline_manifest_path, shader_registry, vertex_layout_registry,
+                               specialization_registry);
+    } catch (const std::exception &error) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "%s", error.what());
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <span>
+#include <utility>
+
+#include "config.hpp"
+
+namespace {
+    // Windows into VRAM up to this size are the fixed BAR of systems without Resizable BAR.
+    constexpr vk::DeviceSize small_bar_size{256ull << 20};
+    // At most this share of a small BAR window goes to one buffer, the driver and other buffers need it too.
+    constexpr vk::DeviceSize small_bar_share{8};
+}
+
+std::string_view to_string(const DirectWriteSupport support) {
+    switch (support) {
+        case DirectWriteSupport::None:
+            return "none";
+        case DirectWriteSupport::SmallBar:
+            return "small BAR";
+        case DirectWriteSupport::ResizableBar:
+            return "resizable BAR";
+        case DirectWriteSupport::Unified:
+            return "unified memory";
+    }
+    std::unreachable();
+}
+
+MemoryTypes::MemoryTypes(const vk::raii::PhysicalDevice &physical_device)
+        : properties{physical_device.getMemoryProperties()},
+          non_coherent_atom_size{physical_device.getProperties().limits.nonCoherentAtomSize} {
+    const auto types = std::span{properties.memoryTypes}.first(properties.memoryTypeCount);
+    const auto is_direct_write = [](const vk::MemoryType &type) {
+        return (type.propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal) &&
+               (type.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+    };
+    if (!get_config("APP_DIRECT_WRITE", true) || !std::ranges::any_of(types, is_direct_write))
+        return;
+
+    // Unified when no device local memory is hidden from the CPU. Integrated GPUs whose only device local type is
+    // also host visible would pass for resizable BAR by the heap size, but their VRAM is system memory all the same.
+    const auto device_type = physical_device.getProperties().deviceType;
+    const auto is_unified = device_type == vk::PhysicalDeviceType::eIntegratedGpu ||
+                            device_type == vk::PhysicalDeviceType::eCpu ||
+                            std::ranges::all_of(types, [&](const vk::MemoryType &type) {
+                                return !(type.propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal) ||
+                                       is_direct_write(type);
+                            });
+    vk::DeviceSize largest_window{};
+    for (const auto &type: types)
+        if (is_direct_write(type))
+            largest_window = std::max(largest_window, properties.memoryHeaps[type.heapIndex].size);
+    if (is_unified)
+        direct_write_support = DirectWriteSupport::Unified;
+    else if (largest_window > small_bar_size)
+        direct_write_support = DirectWriteSupport::ResizableBar;
+    else
+        direct_write_support = DirectWriteSupport::SmallBar;
+}
+
+std::optional<uint32_t> MemoryTypes::find(const uint32_t type_bits, const MemoryUsage usage) const {
+    using enum vk::MemoryPropertyFlagBits;
+    // Flags a type needs at least, and the ones that make it better, in order of preference.
+    vk::MemoryPropertyFlags required{};
+    vk::MemoryPropertyFlags preferred{};
+    vk::MemoryPropertyFlags avoided{};
+    switch (usage) {
+        case MemoryUsage::DeviceLocal:
+            preferred = eDeviceLocal;
+            // Leaves the mappable part of VRAM to the data that needs it.
+            if (direct_write_support != DirectWriteSupport::Unified)
+                avoided = eHostVisible;
+            break;
+        case MemoryUsage::Upload:
+            required = eHostVisible;
+            preferred = eHostCoherent;
+            // Staging memory in a small BAR window would take it from the data written in place.
+            if (direct_write_support != DirectWriteSupport::Unified)
+                avoided = eDeviceLocal;
+            break;
+        case MemoryUsage::DirectWrite:
+            if (direct_write_support == DirectWriteSupport::None)
+                return std::nullopt;
+            required = eDeviceLocal | eHostVisible;
+            preferred = eHostCoherent;
+            // Write combined memory is fastest for the sequential writes this is used with.
+            avoided = eHostCached;
+            break;
+        case MemoryUsage::Readback:
+            required = eHostVisible;
+            preferred = eHostCached;
+            break;
+        case MemoryUsage::Transient:
+            preferred = eDeviceLocal | eLazilyAllocated;
+            avoided = eHostVisible;
+            break;
+    }
+
+    std::optional<uint32_t> best{};
+    int best_score{};
+    for (uint32_t index{}; index < properties.memoryTypeCount; ++index) {
+        const auto flags = properties.memoryTypes[index].propertyFlags;
+        if (!(type_bits & (1u << index)) || (flags & required) != required || (flags & eProtected))
+            continue;
+        const auto score = std::popcount(static_cast<uint32_t>(flags & preferred)) * 2 -
+                           std::popcount(static_cast<uint32_t>(flags & avoided));
+        if (!best || score > best_score) {
+            best = index;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+bool MemoryTypes::has_lazily_allocated() const {
+    return std::ranges::any_of(std::span{properties.memoryTypes.data(), properties.memoryTypeCount},
+                               [](const vk::MemoryType &type) {
+                                   return static_cast<bool>(type.propertyFlags &
+                                                            vk::MemoryPropertyFlagBits::eLazilyAllocated);
+                               });
+}
+
+bool MemoryTypes::prefers_direct_write(const vk::DeviceSize size) const {
+    switch (direct_write_support) {
+        case DirectWriteSupport::None:
+            return false;
+        case DirectWriteSupport::SmallBar:
+            return size <= small_bar_size / small_bar_share;
+        case DirectWriteSupport::ResizableBar:
+        case DirectWriteSupport::Unified:
+            return true;
+    }
+    std::unreachable();
+}
+
+void MemoryTypes::log() const {
+    SDL_Log("Direct writes to device memory: %s", to_string(direct_write_support).data());
+    SDL_Log("Lazily allocated memory for transient attachments: %s", has_lazily_allocated() ? "yes" : "no");
+    for (uint32_t index{}; index < properties.memoryTypeCount; ++index) {
+        const auto &type = properties.memoryTypes[index];
+        SDL_Log("Memory type %u: heap %u (%llu MiB), %s", index, type.heapIndex,
+                static_cast<unsigned long long>(properties.memoryHeaps[type.heapIndex].size >> 20),
+                vk::to_string(type.propertyFlags).c_str());
+    }
+}
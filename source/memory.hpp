@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "platform.hpp"
+
+enum class MemoryUsage {
+    // Only the GPU touches it: render targets, static meshes and textures.
+    DeviceLocal,
+    // Written by the CPU once and read by the GPU through a copy, staging buffers.
+    Upload,
+    // Written by the CPU every frame and read by the GPU in place: uniforms, instance transforms. Only exists where
+    // device local memory is host visible too.
+    DirectWrite,
+    // Written by the GPU and read back by the CPU.
+    Readback,
+    // Attachments that live within one render pass. Tile based GPUs keep them in tile memory and never back them when
+    // the memory is lazily allocated, elsewhere they are plain device local memory.
+    Transient,
+};
+
+// How much of the device local memory the CPU can map.
+enum class DirectWriteSupport {
+    None,
+    // The classic 256 MiB window into VRAM, fine for small hot data.
+    SmallBar,
+    // Resizable BAR maps the whole of VRAM.
+    ResizableBar,
+    // Integrated GPUs and lavapipe, there is only one memory and staging copies are pure waste.
+    Unified,
+};
+
+[[nodiscard]] std::string_view to_string(DirectWriteSupport support);
+
+// Picks memory types by what the memory is used for instead of by property flags.
+class MemoryTypes {
+    vk::PhysicalDeviceMemoryProperties properties;
+    vk::DeviceSize non_coherent_atom_size;
+    DirectWriteSupport direct_write_support{DirectWriteSupport::None};
+
+public:
+    // Set APP_DIRECT_WRITE=0 to force the staging path everywhere, for comparing both.
+    explicit MemoryTypes(const vk::raii::PhysicalDevice &physical_device);
+
+    // Index of the best memory type among type_bits, empty when none fits. DirectWrite never falls back, callers
+    // take the staging path then.
+    [[nodiscard]] std::optional<uint32_t> find(uint32_t type_bits, MemoryUsage usage) const;
+
+    [[nodiscard]] DirectWriteSupport get_direct_write_support() const {
+        return direct_write_support;
+    }
+
+    // Whether a buffer of this size should be written in place, small BAR windows are shared by the whole process.
+    [[nodiscard]] bool prefers_direct_write(vk::DeviceSize size) const;
+
+    [[nodiscard]] bool is_coherent(uint32_t type_index) const {
+        return static_cast<bool>(properties.memoryTypes[type_index].propertyFlags &
+                                 vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    [[nodiscard]] vk::DeviceSize get_non_coherent_atom_size() const {
+        return non_coherent_atom_size;
+    }
+
+    [[nodiscard]] bool has_lazily_allocated() const;
+
+    [[nodiscard]] const vk::PhysicalDeviceMemoryProperties &get_properties() const {
+        return properties;
+    }
+
+    void log() const;
+};
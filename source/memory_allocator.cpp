@@ -0,0 +1,479 @@
+#include "memory_allocator.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "config.hpp"
+
+namespace {
+    constexpr vk::DeviceSize align_up(const vk::DeviceSize value, const vk::DeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    vk::ImageAspectFlags get_aspect(const vk::Format format) {
+        switch (format) {
+            case vk::Format::eD16Unorm:
+            case vk::Format::eX8D24UnormPack32:
+            case vk::Format::eD32Sfloat:
+                return vk::ImageAspectFlagBits::eDepth;
+            case vk::Format::eS8Uint:
+                return vk::ImageAspectFlagBits::eStencil;
+            case vk::Format::eD16UnormS8Uint:
+            case vk::Format::eD24UnormS8Uint:
+            case vk::Format::eD32SfloatS8Uint:
+                return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+            default:
+                return vk::ImageAspectFlagBits::eColor;
+        }
+    }
+
+    vk::ImageMemoryBarrier2 get_layout_barrier(const vk::Image image, const vk::ImageCreateInfo &create_info,
+                                               const vk::ImageLayout old_layout, const vk::ImageLayout new_layout) {
+        vk::ImageMemoryBarrier2 barrier{};
+        barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+        barrier.srcAccessMask = vk::AccessFlagBits2::eMemoryWrite;
+        barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+        barrier.dstAccessMask = vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite;
+        barrier.oldLayout = old_layout;
+        barrier.newLayout = new_layout;
+        barrier.image = image;
+        barrier.subresourceRange = {get_aspect(create_info.format), 0, vk::RemainingMipLevels, 0,
+                                    vk::RemainingArrayLayers};
+        return barrier;
+    }
+}
+
+DefragmentationConfig DefragmentationConfig::from_environment() {
+    DefragmentationConfig config{};
+    config.threshold = get_config("APP_DEFRAG_THRESHOLD", config.threshold);
+    config.bytes_per_frame = get_config("APP_DEFRAG_BYTES_PER_FRAME", config.bytes_per_frame);
+    config.block_size = get_config("APP_MEMORY_BLOCK_SIZE", config.block_size);
+    return config;
+}
+
+DeviceAllocator::DeviceAllocator(const vk::raii::Device &device, const vk::raii::PhysicalDevice &physical_device,
+                                 const MemoryTypes &memory_types, const uint32_t frames_in_flight,
+                                 const DefragmentationConfig config)
+        : device{device}, memory_types{memory_types}, frames_in_flight{frames_in_flight}, config{config},
+          buffer_image_granularity{physical_device.getProperties().limits.bufferImageGranularity} {}
+
+std::optional<DeviceAllocator::Range> DeviceAllocator::allocate_in(Block &block, const vk::DeviceSize size,
+                                                                   const vk::DeviceSize alignment) {
+    // Best fit keeps the large ranges large.
+    auto best = block.free_ranges.end();
+    auto best_waste = std::numeric_limits<vk::DeviceSize>::max();
+    for (auto range = block.free_ranges.begin(); range != block.free_ranges.end(); ++range) {
+        const auto &[offset, free_size] = *range;
+        if (align_up(offset, alignment) + size > offset + free_size)
+            continue;
+        if (const auto waste = free_size - size; waste < best_waste) {
+            best = range;
+            best_waste = waste;
+        }
+    }
+    if (best == block.free_ranges.end())
+        return std::nullopt;
+
+    const auto [offset, free_size] = *best;
+    const auto aligned_offset = align_up(offset, alignment);
+    block.free_ranges.erase(best);
+    if (aligned_offset > offset)
+        block.free_ranges.emplace(offset, aligned_offset - offset);
+    if (const auto end = aligned_offset + size; end < offset + free_size)
+        block.free_ranges.emplace(end, offset + free_size - end);
+    block.used += size;
+    return Range{&block, aligned_offset, size};
+}
+
+std::optional<DeviceAllocator::Range> DeviceAllocator::allocate_range(const uint32_t type_index,
+                                                                      const vk::DeviceSize size,
+                                                                      vk::DeviceSize alignment,
+                                                                      const Block *const excluded,
+                                                                      const bool may_create_block) {
+    // Linear and optimal resources sharing a block must not share a granularity page.
+    alignment = std::max(alignment, buffer_image_granularity);
+
+    // Fullest blocks first, which leaves the emptiest ones to drain.
+    std::vector<Block *> candidates;
+    for (const auto &block: blocks)
+        if (block->type_index == type_index && !block->dedicated && block.get() != excluded)
+            candidates.emplace_back(block.get());
+    std::ranges::sort(candidates, std::ranges::greater{}, &Block::used);
+    for (const auto block: candidates)
+        if (auto range = allocate_in(*block, size, alignment))
+            return range;
+    if (!may_create_block)
+        return std::nullopt;
+
+    const auto dedicated = size > config.block_size / 2;
+    const auto block_size = dedicated ? size : config.block_size;
+    auto &block = *blocks.emplace_back(std::make_unique<Block>(
+            vk::raii::DeviceMemory{device, vk::MemoryAllocateInfo{block_size, type_index}}, block_size, type_index,
+            dedicated, nullptr, std::map<vk::DeviceSize, vk::DeviceSize>{{0, block_size}}));
+    if (memory_types.get_properties().memoryTypes[type_index].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        block.mapped = static_cast<std::byte *>(block.memory.mapMemory(0, vk::WholeSize));
+    return allocate_in(block, size, alignment);
+}
+
+void DeviceAllocator::free_range(const Range &range) {
+    auto &ranges = range.block->free_ranges;
+    range.block->used -= range.size;
+    auto inserted = ranges.emplace(range.offset, range.size).first;
+    if (const auto next = std::next(inserted); next != ranges.end() && inserted->first + inserted->second == next->first) {
+        inserted->second += next->second;
+        ranges.erase(next);
+    }
+    if (inserted != ranges.begin()) {
+        if (const auto previous = std::prev(inserted); previous->first + previous->second == inserted->first) {
+            previous->second += inserted->second;
+            ranges.erase(inserted);
+        }
+    }
+}
+
+DeviceAllocator::Range DeviceAllocator::allocate(const vk::MemoryRequirements &requirements, const MemoryUsage usage) {
+    const auto type_index = memory_types.find(requirements.memoryTypeBits, usage);
+    if (!type_index)
+        throw std::runtime_error{"No memory type fits the allocation"};
+    const auto size = align_up(requirements.size, buffer_image_granularity);
+    try {
+        return *allocate_range(*type_index, size, requirements.alignment, nullptr, true);
+    } catch (const vk::OutOfDeviceMemoryError &) {
+        const auto &properties = memory_types.get_properties();
+        const auto heap_index = properties.memoryTypes[*type_index].heapIndex;
+        if (out_of_memory_callback)
+            out_of_memory_callback(heap_index);
+        if (usage != MemoryUsage::DeviceLocal)
+            throw;
+        for (uint32_t fallback{}; fallback < properties.memoryTypeCount; ++fallback) {
+            if (!(requirements.memoryTypeBits & (1u << fallback)) ||
+                properties.memoryTypes[fallback].heapIndex == heap_index ||
+                (properties.memoryTypes[fallback].propertyFlags & vk::MemoryPropertyFlagBits::eProtected))
+                continue;
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Out of device memory on heap %u, falling back to heap %u", heap_index,
+                        properties.memoryTypes[fallback].heapIndex);
+            return *allocate_range(fallback, size, requirements.alignment, nullptr, true);
+        }
+        throw;
+    }
+}
+
+AllocationId DeviceAllocator::insert(Allocation allocation) {
+    if (!free_ids.empty()) {
+        const auto id = free_ids.back();
+        free_ids.pop_back();
+        allocations[id - 1].emplace(std::move(allocation));
+        return id;
+    }
+    allocations.emplace_back(std::move(allocation));
+    return static_cast<AllocationId>(allocations.size());
+}
+
+DeviceAllocator::Allocation &DeviceAllocator::get(const AllocationId id) {
+    return const_cast<Allocation &>(std::as_const(*this).get(id));
+}
+
+const DeviceAllocator::Allocation &DeviceAllocator::get(const AllocationId id) const {
+    if (id == 0 || id > allocations.size() || !allocations[id - 1])
+        throw std::out_of_range{"Unknown allocation id " + std::to_string(id)};
+    return *allocations[id - 1];
+}
+
+float DeviceAllocator::get_fragmentation(const uint32_t type_index) const {
+    vk::DeviceSize free_size{};
+    vk::DeviceSize largest_free_size{};
+    for (const auto &block: blocks) {
+        if (block->type_index != type_index || block->dedicated)
+            continue;
+        for (const auto &[offset, size]: block->free_ranges) {
+            free_size += size;
+            largest_free_size = std::max(largest_free_size, size);
+        }
+    }
+    return free_size ? 1.0f - static_cast<float>(largest_free_size) / static_cast<float>(free_size) : 0.0f;
+}
+
+DeviceAllocator::Resource DeviceAllocator::recreate(const Resource &resource, const Range &range) const {
+    if (const auto *const buffer = std::get_if<BufferResource>(&resource)) {
+        vk::raii::Buffer new_buffer{device, buffer->create_info};
+        new_buffer.bindMemory(*range.block->memory, range.offset);
+        return BufferResource{std::move(new_buffer), buffer->create_info};
+    }
+    const auto &image = std::get<ImageResource>(resource);
+    vk::raii::Image new_image{device, image.create_info};
+    new_image.bindMemory(*range.block->memory, range.offset);
+    return ImageResource{std::move(new_image), image.create_info, image.layout};
+}
+
+AllocationId DeviceAllocator::create_buffer(vk::BufferCreateInfo create_info, const MemoryUsage usage) {
+    const auto is_movable = usage == MemoryUsage::DeviceLocal && !create_info.pNext &&
+                            create_info.sharingMode == vk::SharingMode::eExclusive;
+    if (is_movable)
+        create_info.usage |= vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+    vk::raii::Buffer buffer{device, create_info};
+    const auto requirements = buffer.getMemoryRequirements();
+
+    const std::scoped_lock lock{mutex};
+    const auto range = allocate(requirements, usage);
+    try {
+        buffer.bindMemory(*range.block->memory, range.offset);
+    } catch (...) {
+        free_range(range);
+        throw;
+    }
+    create_info.pNext = nullptr;
+    create_info.setQueueFamilyIndices({});
+    return insert({BufferResource{std::move(buffer), create_info}, range, requirements.alignment, usage, is_movable});
+}
+
+AllocationId DeviceAllocator::create_image(vk::ImageCreateInfo create_info, const MemoryUsage usage) {
+    const auto is_movable = usage == MemoryUsage::DeviceLocal && !create_info.pNext &&
+                            create_info.sharingMode == vk::SharingMode::eExclusive &&
+                            !(create_info.usage & vk::ImageUsageFlagBits::eTransientAttachment);
+    if (is_movable)
+        create_info.usage |= vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    vk::raii::Image image{device, create_info};
+    const auto requirements = image.getMemoryRequirements();
+
+    const std::scoped_lock lock{mutex};
+    const auto range = allocate(requirements, usage);
+    try {
+        image.bindMemory(*range.block->memory, range.offset);
+    } catch (...) {
+        free_range(range);
+        throw;
+    }
+    create_info.pNext = nullptr;
+    create_info.setQueueFamilyIndices({});
+    return insert({ImageResource{std::move(image), create_info}, range, requirements.alignment, usage, is_movable});
+}
+
+void DeviceAllocator::destroy(const AllocationId id) {
+    const std::scoped_lock lock{mutex};
+    auto &allocation = get(id);
+    ++allocation.range.block->pending_free_count;
+    pending_frees.push_back({frame, allocation.range, std::move(allocation.resource)});
+    allocations[id - 1].reset();
+    free_ids.emplace_back(id);
+}
+
+vk::Buffer DeviceAllocator::get_buffer(const AllocationId id) const {
+    const std::scoped_lock lock{mutex};
+    return *std::get<BufferResource>(get(id).resource).buffer;
+}
+
+vk::Image DeviceAllocator::get_image(const AllocationId id) const {
+    const std::scoped_lock lock{mutex};
+    return *std::get<ImageResource>(get(id).resource).image;
+}
+
+std::byte *DeviceAllocator::get_mapped(const AllocationId id) const {
+    const std::scoped_lock lock{mutex};
+    const auto &range = get(id).range;
+    return range.block->mapped ? range.block->mapped + range.offset : nullptr;
+}
+
+std::optional<vk::MappedMemoryRange> DeviceAllocator::get_mapped_range(const AllocationId id) const {
+    const std::scoped_lock lock{mutex};
+    const auto &range = get(id).range;
+    if (!range.block->mapped || memory_types.is_coherent(range.block->type_index))
+        return std::nullopt;
+    // Whole atoms, which the block size is a multiple of.
+    const auto atom_size = memory_types.get_non_coherent_atom_size();
+    const auto offset = range.offset / atom_size * atom_size;
+    const auto end = std::min(align_up(range.offset + range.size, atom_size), range.block->size);
+    return vk::MappedMemoryRange{*range.block->memory, offset, end - offset};
+}
+
+void DeviceAllocator::flush(const AllocationId id) const {
+    if (const auto range = get_mapped_range(id))
+        device.flushMappedMemoryRanges(*range);
+}
+
+void DeviceAllocator::invalidate(const AllocationId id) const {
+    if (const auto range = get_mapped_range(id))
+        device.invalidateMappedMemoryRanges(*range);
+}
+
+void DeviceAllocator::set_image_layout(const AllocationId id, const vk::ImageLayout layout) {
+    const std::scoped_lock lock{mutex};
+    std::get<ImageResource>(get(id).resource).layout = layout;
+}
+
+void DeviceAllocator::set_move_callback(std::function<void(AllocationId)> callback) {
+    const std::scoped_lock lock{mutex};
+    move_callback = std::move(callback);
+}
+
+void DeviceAllocator::set_out_of_memory_callback(std::function<void(uint32_t)> callback) {
+    const std::scoped_lock lock{mutex};
+    out_of_memory_callback = std::move(callback);
+}
+
+void DeviceAllocator::begin_frame() {
+    const std::scoped_lock lock{mutex};
+    ++frame;
+    std::erase_if(pending_frees, [&](const PendingFree &pending) {
+        if (pending.frame + frames_in_flight > frame)
+            return false;
+        free_range(pending.range);
+        --pending.range.block->pending_free_count;
+        return true;
+    });
+
+    // One empty block per type stays around, so usage hovering at a block boundary doesn't allocate every frame.
+    std::vector<uint32_t> kept_types;
+    const auto freed = std::erase_if(blocks, [&](const std::unique_ptr<Block> &block) {
+        if (block->used > 0 || block->pending_free_count > 0)
+            return false;
+        if (!block->dedicated && !std::ranges::contains(kept_types, block->type_index)) {
+            kept_types.emplace_back(block->type_index);
+            return false;
+        }
+        return true;
+    });
+    freed_blocks += freed;
+}
+
+size_t DeviceAllocator::record_defragmentation(const vk::raii::CommandBuffer &command_buffer) {
+    struct Move {
+        AllocationId id;
+        // Where the old resource waits for the copy to finish.
+        size_t pending_index;
+    };
+    std::vector<Move> moves;
+    std::function<void(AllocationId)> callback;
+    {
+        const std::scoped_lock lock{mutex};
+        auto budget = config.bytes_per_frame;
+        for (uint32_t type_index{}; type_index < memory_types.get_properties().memoryTypeCount && budget > 0;
+             ++type_index) {
+            if (get_fragmentation(type_index) <= config.threshold)
+                continue;
+            // Drain the emptiest block, once its live allocations are gone begin_frame frees it.
+            Block *source{};
+            size_t block_count{};
+            for (const auto &block: blocks) {
+                if (block->type_index != type_index || block->dedicated || block->mapped)
+                    continue;
+                ++block_count;
+                if (block->used > 0 && (!source || block->used < source->used))
+                    source = block.get();
+            }
+            if (!source || block_count < 2)
+                continue;
+
+            for (AllocationId id{1}; id <= allocations.size() && budget > 0; ++id) {
+                auto &allocation = allocations[id - 1];
+                if (!allocation || allocation->range.block != source || !allocation->is_movable)
+                    continue;
+                if (const auto *const image = std::get_if<ImageResource>(&allocation->resource);
+                        image && image->layout == vk::ImageLayout::eUndefined)
+                    continue;
+                const auto new_range = allocate_range(type_index, allocation->range.size, allocation->alignment,
+                                                      source, false);
+                if (!new_range)
+                    break;
+
+                auto new_resource = recreate(allocation->resource, *new_range);
+                // The old resource stays alive next to the range it occupies until the GPU copied out of it.
+                ++allocation->range.block->pending_free_count;
+                pending_frees.emplace_back(frame, allocation->range,
+                                           std::exchange(allocation->resource, std::move(new_resource)));
+                allocation->range = *new_range;
+                budget -= std::min(budget, new_range->size);
+                moved_bytes += new_range->size;
+                ++moved_allocations;
+                moves.push_back({id, pending_frees.size() - 1});
+            }
+        }
+        callback = move_callback;
+        if (moves.empty())
+            return 0;
+
+        // Everything before, including earlier frames on this queue, has to be done writing before the copies read.
+        const vk::MemoryBarrier2 before_copies{
+                vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite,
+                vk::PipelineStageFlagBits2::eCopy,
+                vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eTransferWrite};
+        std::vector<vk::ImageMemoryBarrier2> image_barriers;
+        for (const auto &[id, pending_index]: moves) {
+            const auto *const old_image = std::get_if<ImageResource>(&*pending_frees[pending_index].resource);
+            if (!old_image)
+                continue;
+            const auto &new_image = std::get<ImageResource>(get(id).resource);
+            image_barriers.emplace_back(get_layout_barrier(*old_image->image, old_image->create_info,
+                                                           old_image->layout, vk::ImageLayout::eTransferSrcOptimal));
+            image_barriers.emplace_back(get_layout_barrier(*new_image.image, new_image.create_info,
+                                                           vk::ImageLayout::eUndefined,
+                                                           vk::ImageLayout::eTransferDstOptimal));
+        }
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, before_copies, {}, image_barriers});
+
+        image_barriers.clear();
+        for (const auto &[id, pending_index]: moves) {
+            const auto &old_resource = *pending_frees[pending_index].resource;
+            if (const auto *const old_buffer = std::get_if<BufferResource>(&old_resource)) {
+                const auto &new_buffer = std::get<BufferResource>(get(id).resource);
+                command_buffer.copyBuffer(*old_buffer->buffer, *new_buffer.buffer,
+                                          vk::BufferCopy{0, 0, new_buffer.create_info.size});
+                continue;
+            }
+            const auto &old_image = std::get<ImageResource>(old_resource);
+            const auto &new_image = std::get<ImageResource>(get(id).resource);
+            const auto &create_info = new_image.create_info;
+            std::vector<vk::ImageCopy> regions;
+            for (uint32_t mip{}; mip < create_info.mipLevels; ++mip) {
+                const vk::ImageSubresourceLayers layers{get_aspect(create_info.format), mip, 0,
+                                                        create_info.arrayLayers};
+                regions.emplace_back(layers, vk::Offset3D{}, layers, vk::Offset3D{},
+                                     vk::Extent3D{std::max(create_info.extent.width >> mip, 1u),
+                                                  std::max(create_info.extent.height >> mip, 1u),
+                                                  std::max(create_info.extent.depth >> mip, 1u)});
+            }
+            command_buffer.copyImage(*old_image.image, vk::ImageLayout::eTransferSrcOptimal, *new_image.image,
+                                     vk::ImageLayout::eTransferDstOptimal, regions);
+            image_barriers.emplace_back(get_layout_barrier(*new_image.image, create_info,
+                                                           vk::ImageLayout::eTransferDstOptimal, new_image.layout));
+        }
+        const vk::MemoryBarrier2 after_copies{
+                vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eAllCommands,
+                vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite};
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, after_copies, {}, image_barriers});
+    }
+
+    // Outside the lock, the callback will want the new handles.
+    if (callback)
+        for (const auto &move: moves)
+            callback(move.id);
+    return moves.size();
+}
+
+AllocatorStats DeviceAllocator::get_stats() const {
+    const std::scoped_lock lock{mutex};
+    AllocatorStats stats{};
+    stats.block_count = blocks.size();
+    for (const auto &block: blocks) {
+        stats.allocated_bytes += block->size;
+        stats.used_bytes += block->used;
+    }
+    for (uint32_t type_index{}; type_index < memory_types.get_properties().memoryTypeCount; ++type_index)
+        stats.fragmentation = std::max(stats.fragmentation, get_fragmentation(type_index));
+    stats.moved_allocations = moved_allocations;
+    stats.moved_bytes = moved_bytes;
+    stats.freed_blocks = freed_blocks;
+    return stats;
+}
+
+vk::DeviceSize DeviceAllocator::get_allocated_bytes(const uint32_t heap_index) const {
+    const std::scoped_lock lock{mutex};
+    vk::DeviceSize bytes{};
+    for (const auto &block: blocks)
+        if (memory_types.get_properties().memoryTypes[block->type_index].heapIndex == heap_index)
+            bytes += block->size;
+    return bytes;
+}
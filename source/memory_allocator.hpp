@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <variant>
+#include <vector>
+
+#include "memory.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+
+// Zero stands for no allocation. Ids stay the same when defragmentation moves the resource, the handles don't.
+using AllocationId = uint32_t;
+
+struct DefragmentationConfig {
+    // Share of the free memory of a type that isn't part of its largest free range, above it compaction starts.
+    float threshold{0.5f};
+    // GPU copies spread over frames, so no single frame stalls on them.
+    vk::DeviceSize bytes_per_frame{16ull << 20};
+    vk::DeviceSize block_size{64ull << 20};
+
+    [[nodiscard]] static DefragmentationConfig from_environment();
+};
+
+struct AllocatorStats {
+    size_t block_count{};
+    vk::DeviceSize allocated_bytes{};
+    vk::DeviceSize used_bytes{};
+    // Highest fragmentation over all memory types, see DefragmentationConfig::threshold.
+    float fragmentation{};
+    uint64_t moved_allocations{};
+    vk::DeviceSize moved_bytes{};
+    uint64_t freed_blocks{};
+};
+
+// Sub-allocates buffers and images from large device memory blocks and owns them. When a memory type fragments past
+// the threshold, record_defragmentation moves live resources out of the emptiest block with GPU copies, a few per
+// frame, until it can be freed. Moved resources get new handles, so handles are looked up by id every frame rather
+// than kept, and anything persistent built from them, like image views or long lived descriptor sets, is rebuilt from
+// the move callback. Mapped memory never moves. Thread safe.
+class DeviceAllocator : Noncopyable {
+    struct Block {
+        vk::raii::DeviceMemory memory;
+        vk::DeviceSize size;
+        uint32_t type_index;
+        // Sized for a single large resource and freed with it.
+        bool dedicated;
+        std::byte *mapped;
+        // Offset to size, neighbors are always merged.
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+        vk::DeviceSize used{};
+        // Ranges waiting for the GPU to finish with them.
+        uint32_t pending_free_count{};
+    };
+
+    struct Range {
+        Block *block;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+    };
+
+    // Recreating a resource at its new place needs the whole create info, chained structures and queue family lists
+    // aren't kept, so resources using them never move.
+    struct BufferResource {
+        vk::raii::Buffer buffer;
+        vk::BufferCreateInfo create_info;
+    };
+
+    struct ImageResource {
+        vk::raii::Image image;
+        vk::ImageCreateInfo create_info;
+        // The layout the image rests in between frames, defragmentation restores it after the copy.
+        vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+    };
+
+    using Resource = std::variant<BufferResource, ImageResource>;
+
+    struct Allocation {
+        Resource resource;
+        Range range;
+        vk::DeviceSize alignment;
+        MemoryUsage usage;
+        bool is_movable;
+    };
+
+    struct PendingFree {
+        uint64_t frame;
+        Range range;
+        // The resource the range held, kept until the GPU is done with it.
+        std::optional<Resource> resource;
+    };
+
+    const vk::raii::Device &device;
+    const MemoryTypes &memory_types;
+    const uint32_t frames_in_flight;
+    const DefragmentationConfig config;
+    const vk::DeviceSize buffer_image_granularity;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<std::optional<Allocation>> allocations;
+    std::vector<AllocationId> free_ids;
+    std::vector<PendingFree> pending_frees;
+    std::function<void(AllocationId)> move_callback;
+    std::function<void(uint32_t)> out_of_memory_callback;
+    uint64_t frame{};
+    uint64_t moved_allocations{};
+    vk::DeviceSize moved_bytes{};
+    uint64_t freed_blocks{};
+
+    [[nodiscard]] std::optional<Range> allocate_in(Block &block, vk::DeviceSize size, vk::DeviceSize alignment);
+
+    // Looks through the existing blocks of the type first and creates a new one only when allowed.
+    [[nodiscard]] std::optional<Range> allocate_range(uint32_t type_index, vk::DeviceSize size,
+                                                      vk::DeviceSize alignment, const Block *excluded,
+                                                      bool may_create_block);
+
+    void free_range(const Range &range);
+
+    [[nodiscard]] Range allocate(const vk::MemoryRequirements &requirements, MemoryUsage usage);
+
+    [[nodiscard]] AllocationId insert(Allocation allocation);
+
+    [[nodiscard]] Allocation &get(AllocationId id);
+
+    [[nodiscard]] const Allocation &get(AllocationId id) const;
+
+    [[nodiscard]] float get_fragmentation(uint32_t type_index) const;
+
+    // Empty for coherent memory.
+    [[nodiscard]] std::optional<vk::MappedMemoryRange> get_mapped_range(AllocationId id) const;
+
+    // Creates the resource again at another place in memory.
+    [[nodiscard]] Resource recreate(const Resource &resource, const Range &range) const;
+
+public:
+    DeviceAllocator(const vk::raii::Device &device, const vk::raii::PhysicalDevice &physical_device,
+                    const MemoryTypes &memory_types, uint32_t frames_in_flight,
+                    DefragmentationConfig config = DefragmentationConfig::from_environment());
+
+    // Transfer usage is added to movable resources so defragmentation can copy them.
+    [[nodiscard]] AllocationId create_buffer(vk::BufferCreateInfo create_info, MemoryUsage usage);
+
+    // Images with transient attachment usage can't be copied and stay where they are.
+    [[nodiscard]] AllocationId create_image(vk::ImageCreateInfo create_info, MemoryUsage usage);
+
+    // The memory is reused once the frames in flight are done with it.
+    void destroy(AllocationId id);
+
+    [[nodiscard]] vk::Buffer get_buffer(AllocationId id) const;
+
+    [[nodiscard]] vk::Image get_image(AllocationId id) const;
+
+    // Null unless the memory is host visible.
+    [[nodiscard]] std::byte *get_mapped(AllocationId id) const;
+
+    // Make CPU writes visible to the GPU and GPU writes visible to the CPU, no-ops for coherent memory.
+    void flush(AllocationId id) const;
+
+    void invalidate(AllocationId id) const;
+
+    // Images only move once their resting layout is known, their content can't be copied otherwise.
+    void set_image_layout(AllocationId id, vk::ImageLayout layout);
+
+    // Called from record_defragmentation for every resource that got a new handle.
+    void set_move_callback(std::function<void(AllocationId)> callback);
+
+    // Called with the heap index when a block allocation fails. Device local allocations then fall back to another heap
+    // the resource supports, slower but alive. Runs with the allocator locked, so it must not call back into it.
+    void set_out_of_memory_callback(std::function<void(uint32_t)> callback);
+
+    // Call once the frame about to be recorded waited for its fence.
+    void begin_frame();
+
+    // Records this frame's share of moves, has to come first in the frame's first command buffer so nothing recorded
+    // before it uses an old handle. Returns the number of moved resources.
+    size_t record_defragmentation(const vk::raii::CommandBuffer &command_buffer);
+
+    [[nodiscard]] AllocatorStats get_stats() const;
+
+    // Bytes of all blocks on the heap, the usage estimate when the driver can't report it.
+    [[nodiscard]] vk::DeviceSize get_allocated_bytes(uint32_t heap_index) const;
+};
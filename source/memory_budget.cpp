@@ -0,0 +1,134 @@
+#include "memory_budget.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <utility>
+
+#include "config.hpp"
+
+namespace {
+    // Without the extension only this share of a heap is assumed to be ours, the rest belongs to the system.
+    constexpr float estimated_budget_share{0.8f};
+
+    const char *to_string(const MemoryPressure pressure) {
+        switch (pressure) {
+            case MemoryPressure::None:
+                return "none";
+            case MemoryPressure::Soft:
+                return "soft";
+            case MemoryPressure::Hard:
+                return "hard";
+        }
+        std::unreachable();
+    }
+}
+
+MemoryGovernorConfig MemoryGovernorConfig::from_environment() {
+    MemoryGovernorConfig config{};
+    config.soft_threshold = get_config("APP_MEMORY_SOFT_PRESSURE", config.soft_threshold);
+    config.hard_threshold = get_config("APP_MEMORY_HARD_PRESSURE", config.hard_threshold);
+    config.hysteresis = get_config("APP_MEMORY_PRESSURE_HYSTERESIS", config.hysteresis);
+    return config;
+}
+
+MemoryGovernor::MemoryGovernor(const vk::raii::PhysicalDevice &physical_device, const DeviceAllocator &allocator,
+                               const DeviceFeatures &features, const MemoryGovernorConfig config)
+        : physical_device{physical_device}, allocator{allocator}, has_budget_extension{features.memory_budget},
+          config{config} {
+    poll();
+}
+
+uint32_t MemoryGovernor::add_pressure_callback(Callback callback) {
+    const std::scoped_lock lock{callback_mutex};
+    const auto id = next_callback_id++;
+    callbacks.emplace_back(id, std::move(callback));
+    return id;
+}
+
+void MemoryGovernor::remove_pressure_callback(const uint32_t id) {
+    const std::scoped_lock lock{callback_mutex};
+    std::erase_if(callbacks, [&](const auto &callback) {
+        return callback.first == id;
+    });
+}
+
+void MemoryGovernor::poll() {
+    // The budget structure may only be chained when the extension is there.
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    vk::PhysicalDeviceMemoryProperties properties{};
+    if (has_budget_extension) {
+        const auto chain{physical_device.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+                vk::PhysicalDeviceMemoryBudgetPropertiesEXT>()};
+        properties = chain.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+        budget = chain.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    } else {
+        properties = physical_device.getMemoryProperties();
+    }
+    heaps.resize(properties.memoryHeapCount);
+    for (uint32_t index{}; index < properties.memoryHeapCount; ++index) {
+        auto &heap = heaps[index];
+        heap.size = properties.memoryHeaps[index].size;
+        heap.is_device_local = static_cast<bool>(properties.memoryHeaps[index].flags &
+                                                 vk::MemoryHeapFlagBits::eDeviceLocal);
+        if (has_budget_extension) {
+            heap.budget = budget.heapBudget[index];
+            heap.usage = budget.heapUsage[index];
+        } else {
+            heap.budget = static_cast<vk::DeviceSize>(static_cast<double>(heap.size) * estimated_budget_share);
+            heap.usage = allocator.get_allocated_bytes(index);
+        }
+    }
+}
+
+void MemoryGovernor::update() {
+    poll();
+    const auto out_of_memory = out_of_memory_heaps.exchange(0, std::memory_order_relaxed);
+
+    std::vector<MemoryPressureEvent> events;
+    for (auto &&[index, heap]: std::views::enumerate(heaps)) {
+        const auto share = heap.budget ? static_cast<float>(static_cast<double>(heap.usage) /
+                                                            static_cast<double>(heap.budget)) : 1.0f;
+        // Rising is immediate, falling back needs the hysteresis margin below the threshold.
+        auto pressure = MemoryPressure::None;
+        if (share >= config.hard_threshold ||
+            (heap.pressure == MemoryPressure::Hard && share >= config.hard_threshold - config.hysteresis) ||
+            (out_of_memory & (1u << index)))
+            pressure = MemoryPressure::Hard;
+        else if (share >= config.soft_threshold ||
+                 (heap.pressure != MemoryPressure::None && share >= config.soft_threshold - config.hysteresis))
+            pressure = MemoryPressure::Soft;
+
+        const auto changed = pressure != heap.pressure;
+        if (changed)
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Memory heap %td pressure %s, %llu of %llu MiB budget used", index,
+                        to_string(pressure), static_cast<unsigned long long>(heap.usage >> 20),
+                        static_cast<unsigned long long>(heap.budget >> 20));
+        heap.pressure = pressure;
+        if (pressure == MemoryPressure::None)
+            continue;
+        const auto target = static_cast<vk::DeviceSize>(static_cast<double>(heap.budget) *
+                                                        (config.soft_threshold - config.hysteresis));
+        events.push_back({static_cast<uint32_t>(index), pressure, changed,
+                          heap.usage > target ? heap.usage - target : 0, heap});
+    }
+    if (events.empty())
+        return;
+
+    // Called without the lock, so callbacks may add or remove callbacks or free memory through code that does.
+    std::vector<std::pair<uint32_t, Callback>> current_callbacks;
+    {
+        const std::scoped_lock lock{callback_mutex};
+        current_callbacks = callbacks;
+    }
+    for (const auto &event: events)
+        for (const auto &[id, callback]: current_callbacks)
+            callback(event);
+}
+
+MemoryPressure MemoryGovernor::get_pressure() const {
+    auto pressure = MemoryPressure::None;
+    for (const auto &heap: heaps)
+        if (heap.is_device_local)
+            pressure = std::max(pressure, heap.pressure);
+    return pressure;
+}
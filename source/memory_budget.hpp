@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "device_features.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+
+enum class MemoryPressure {
+    None,
+    // Time to give memory back that is cheap to get again: streaming mips, caches.
+    Soft,
+    // Allocations are about to fail: drop quality, render scale, anything that frees memory now.
+    Hard,
+};
+
+struct MemoryGovernorConfig {
+    // Shares of the heap budget where the pressure levels start.
+    float soft_threshold{0.85f};
+    float hard_threshold{0.95f};
+    // A level only ends this far below its threshold, so usage hovering at it doesn't flip every frame.
+    float hysteresis{0.05f};
+
+    [[nodiscard]] static MemoryGovernorConfig from_environment();
+};
+
+struct HeapBudget {
+    vk::DeviceSize size{};
+    // What the process may use of the heap right now, other processes and the driver take the rest.
+    vk::DeviceSize budget{};
+    vk::DeviceSize usage{};
+    bool is_device_local{};
+    MemoryPressure pressure{MemoryPressure::None};
+};
+
+struct MemoryPressureEvent {
+    uint32_t heap_index;
+    MemoryPressure pressure;
+    // Whether the level changed with this update, callbacks also run every frame the pressure lasts.
+    bool changed;
+    // How much to free to fall back under the soft threshold.
+    vk::DeviceSize excess;
+    const HeapBudget &heap;
+};
+
+// Polls the per heap budget once per frame and tells subsystems when to give memory back. Without VK_EXT_memory_budget
+// the budget is estimated from the heap size and the usage from what the allocator holds.
+class MemoryGovernor : Noncopyable {
+    using Callback = std::function<void(const MemoryPressureEvent &)>;
+
+    const vk::raii::PhysicalDevice &physical_device;
+    const DeviceAllocator &allocator;
+    const bool has_budget_extension;
+    const MemoryGovernorConfig config;
+
+    std::vector<HeapBudget> heaps;
+    std::mutex callback_mutex;
+    std::vector<std::pair<uint32_t, Callback>> callbacks;
+    uint32_t next_callback_id{1};
+    // Set from allocation failures on any thread, forces hard pressure on the next update.
+    std::atomic<uint32_t> out_of_memory_heaps{0};
+
+    void poll();
+
+public:
+    MemoryGovernor(const vk::raii::PhysicalDevice &physical_device, const DeviceAllocator &allocator,
+                   const DeviceFeatures &features, MemoryGovernorConfig config = MemoryGovernorConfig::from_environment());
+
+    // Returns an id for remove_pressure_callback. Callbacks run on the thread calling update.
+    uint32_t add_pressure_callback(Callback callback);
+
+    void remove_pressure_callback(uint32_t id);
+
+    // Call once per frame.
+    void update();
+
+    // Thread safe, for allocators that just failed or had to fall back to another heap.
+    void report_out_of_memory(uint32_t heap_index) {
+        out_of_memory_heaps.fetch_or(1u << heap_index, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::span<const HeapBudget> get_heaps() const {
+        return heaps;
+    }
+
+    // Highest pressure over the device local heaps.
+    [[nodiscard]] MemoryPressure get_pressure() const;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+class Noncopyable {
+public:
+    Noncopyable() = default;
+
+    Noncopyable(const Noncopyable &) = delete;
+
+    const Noncopyable &operator=(const Noncopyable &) = delete;
+};
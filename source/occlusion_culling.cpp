@@ -0,0 +1,206 @@
+#include "occlusion_culling.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <stdexcept>
+
+#include "gpu_helpers.hpp"
+
+namespace {
+    constexpr vk::Format pyramid_format{vk::Format::eR32Sfloat};
+
+    struct Parameters {
+        OcclusionCullingView view;
+        uint32_t instance_count;
+        std::array<float, 2> pyramid_scale;
+    };
+
+    static_assert(sizeof(Parameters) == 88);
+
+    // Between culling, drawing and the next frame's clears.
+    void record_memory_barrier(const vk::raii::CommandBuffer &command_buffer) {
+        const auto barrier = get_memory_barrier();
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, barrier, {}, {}});
+    }
+
+    constexpr std::array descriptor_fields{
+            DescriptorField{0, vk::DescriptorType::eStorageBuffer, 1, 0, sizeof(vk::DescriptorBufferInfo)},
+            DescriptorField{1, vk::DescriptorType::eStorageBuffer, 1, sizeof(vk::DescriptorBufferInfo),
+                            sizeof(vk::DescriptorBufferInfo)},
+            DescriptorField{2, vk::DescriptorType::eStorageBuffer, 1, 2 * sizeof(vk::DescriptorBufferInfo),
+                            sizeof(vk::DescriptorBufferInfo)},
+            DescriptorField{3, vk::DescriptorType::eStorageBuffer, 1, 3 * sizeof(vk::DescriptorBufferInfo),
+                            sizeof(vk::DescriptorBufferInfo)},
+            DescriptorField{4, vk::DescriptorType::eStorageBuffer, 1, 4 * sizeof(vk::DescriptorBufferInfo),
+                            sizeof(vk::DescriptorBufferInfo)},
+            DescriptorField{5, vk::DescriptorType::eCombinedImageSampler, 1, 5 * sizeof(vk::DescriptorBufferInfo),
+                            sizeof(vk::DescriptorImageInfo)},
+    };
+
+    AllocationId create_buffer(DeviceAllocator &allocator, const vk::DeviceSize size,
+                               const vk::BufferUsageFlags usage) {
+        return allocator.create_buffer(
+                vk::BufferCreateInfo{{}, size, vk::BufferUsageFlagBits::eStorageBuffer | usage},
+                MemoryUsage::DeviceLocal);
+    }
+}
+
+OcclusionCuller::OcclusionCuller(const vk::raii::Device &device, const ShaderRegistry &shader_registry,
+                                 PipelineStateCache &pipelines, PipelineLayoutCache &layouts,
+                                 SpecializationRegistry &specializations, DeviceAllocator &allocator,
+                                 DeferredDeletionQueue &deferred_deletion_queue, SinglePassDownsampler &downsampler,
+                                 const ShaderId shader, const WorkgroupConfig &workgroup, const uint32_t max_instances)
+        : device{device}, pipelines{pipelines}, allocator{allocator},
+          deferred_deletion_queue{deferred_deletion_queue}, downsampler{downsampler}, max_instances{max_instances},
+          group_size{workgroup.size_x},
+          sampler{device, vk::SamplerCreateInfo{{}, vk::Filter::eNearest, vk::Filter::eNearest,
+                                                vk::SamplerMipmapMode::eNearest, vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge}},
+          pipeline_layout{get_reflected_layout(shader_registry, layouts, shader).pipeline_layout},
+          descriptor_set{device, descriptor_fields,
+                         get_reflected_layout(shader_registry, layouts, shader).set_layouts.at(0), pipeline_layout,
+                         vk::PipelineBindPoint::eCompute, 0, false},
+          visibility{create_buffer(allocator, max_instances * sizeof(uint32_t),
+                                   vk::BufferUsageFlagBits::eTransferDst)},
+          draws{create_buffer(allocator, max_instances * sizeof(vk::DrawIndexedIndirectCommand),
+                              vk::BufferUsageFlagBits::eIndirectBuffer),
+                create_buffer(allocator, max_instances * sizeof(vk::DrawIndexedIndirectCommand),
+                              vk::BufferUsageFlagBits::eIndirectBuffer)},
+          draw_counts{create_buffer(allocator, sizeof(uint32_t),
+                                    vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst),
+                      create_buffer(allocator, sizeof(uint32_t),
+                                    vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst)} {
+    static_assert(offsetof(Bindings, pyramid) == 5 * sizeof(vk::DescriptorBufferInfo));
+    for (const auto is_late: {false, true}) {
+        keys[is_late].compute_shader = shader;
+        keys[is_late].specialization = specializations.get_id(OcclusionCullingPhase{is_late},
+                                                              WorkgroupConfig{workgroup.size_x, 1, 1, false});
+    }
+}
+
+OcclusionCuller::~OcclusionCuller() {
+    release_pyramid();
+    allocator.destroy(visibility);
+    for (const auto id: draws)
+        allocator.destroy(id);
+    for (const auto id: draw_counts)
+        allocator.destroy(id);
+}
+
+void OcclusionCuller::create_pyramid(const vk::Extent2D depth_extent) {
+    const vk::Extent2D extent{std::max(std::bit_ceil(depth_extent.width) / 2, 1u),
+                              std::max(std::bit_ceil(depth_extent.height) / 2, 1u)};
+    const auto mip_levels = static_cast<uint32_t>(std::bit_width(std::max(extent.width, extent.height)));
+    const auto image = allocator.create_image(
+            vk::ImageCreateInfo{{}, vk::ImageType::e2D, pyramid_format, vk::Extent3D{extent, 1}, mip_levels, 1,
+                                vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+                                vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled},
+            MemoryUsage::DeviceLocal);
+    const auto handle = allocator.get_image(image);
+    std::vector<vk::raii::ImageView> levels;
+    for (uint32_t mip{}; mip < mip_levels; ++mip)
+        levels.emplace_back(device, vk::ImageViewCreateInfo{{}, handle, vk::ImageViewType::e2D, pyramid_format, {},
+                                                            {vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1}});
+    pyramid.emplace(image, vk::raii::ImageView{device, vk::ImageViewCreateInfo{
+            {}, handle, vk::ImageViewType::e2D, pyramid_format, {},
+            {vk::ImageAspectFlagBits::eColor, 0, mip_levels, 0, 1}}}, std::move(levels), extent, depth_extent);
+}
+
+void OcclusionCuller::release_pyramid() {
+    if (!pyramid)
+        return;
+    deferred_deletion_queue.retire(std::move(pyramid->view));
+    for (auto &level: pyramid->levels)
+        deferred_deletion_queue.retire(std::move(level));
+    allocator.destroy(pyramid->image);
+    pyramid.reset();
+}
+
+void OcclusionCuller::handle_move(const AllocationId id) {
+    // Built again at the next record_pyramid, the early phase draws without it until then.
+    if (pyramid && pyramid->image == id)
+        release_pyramid();
+}
+
+vk::Buffer OcclusionCuller::get_draws(const bool is_late) const {
+    return allocator.get_buffer(draws[is_late]);
+}
+
+vk::Buffer OcclusionCuller::get_draw_count(const bool is_late) const {
+    return allocator.get_buffer(draw_counts[is_late]);
+}
+
+void OcclusionCuller::record_early(const vk::raii::CommandBuffer &command_buffer,
+                                   TransientDescriptorAllocator &descriptor_allocator,
+                                   const OcclusionCullingInput &input) {
+    if (!is_visibility_cleared || !pyramid) {
+        // Without last frame's results everything counts as new, so the late phase tests all of it.
+        record_memory_barrier(command_buffer);
+        command_buffer.fillBuffer(allocator.get_buffer(visibility), 0, vk::WholeSize, 0);
+        is_visibility_cleared = true;
+    }
+    if (!pyramid) {
+        record_memory_barrier(command_buffer);
+        command_buffer.fillBuffer(get_draw_count(false), 0, vk::WholeSize, 0);
+        record_memory_barrier(command_buffer);
+        return;
+    }
+    record_phase(command_buffer, descriptor_allocator, input, false);
+}
+
+void OcclusionCuller::record_pyramid(const vk::raii::CommandBuffer &command_buffer,
+                                     TransientDescriptorAllocator &descriptor_allocator, const vk::ImageView depth,
+                                     const vk::Extent2D depth_extent) {
+    if (pyramid && pyramid->depth_extent != depth_extent)
+        release_pyramid();
+    if (!pyramid)
+        create_pyramid(depth_extent);
+
+    std::vector<vk::ImageView> levels;
+    for (const auto &level: pyramid->levels)
+        levels.emplace_back(*level);
+    // The pyramid's level 0 halves the power of two area around the depth.
+    downsampler.record(command_buffer, descriptor_allocator, depth,
+                       vk::Extent2D{pyramid->extent.width * 2, pyramid->extent.height * 2},
+                       allocator.get_image(pyramid->image), 0, levels, DownsampleReduction::Min);
+}
+
+void OcclusionCuller::record_late(const vk::raii::CommandBuffer &command_buffer,
+                                  TransientDescriptorAllocator &descriptor_allocator,
+                                  const OcclusionCullingInput &input) {
+    if (!pyramid)
+        throw std::logic_error{"The late occlusion culling phase needs a depth pyramid"};
+    record_phase(command_buffer, descriptor_allocator, input, true);
+}
+
+void OcclusionCuller::record_phase(const vk::raii::CommandBuffer &command_buffer,
+                                   TransientDescriptorAllocator &descriptor_allocator,
+                                   const OcclusionCullingInput &input, const bool is_late) {
+    if (input.instance_count > max_instances)
+        throw std::invalid_argument{"More instances than the occlusion culler was created for"};
+
+    const auto draw_count = get_draw_count(is_late);
+    record_memory_barrier(command_buffer);
+    command_buffer.fillBuffer(draw_count, 0, vk::WholeSize, 0);
+    record_memory_barrier(command_buffer);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines.get(keys[is_late]));
+    descriptor_set.bind(command_buffer, Bindings{{input.bounds, 0, vk::WholeSize},
+                                                 {input.commands, 0, vk::WholeSize},
+                                                 {allocator.get_buffer(visibility), 0, vk::WholeSize},
+                                                 {get_draws(is_late), 0, vk::WholeSize},
+                                                 {draw_count, 0, vk::WholeSize},
+                                                 {*sampler, *pyramid->view, vk::ImageLayout::eShaderReadOnlyOptimal}},
+                        descriptor_allocator);
+    const Parameters parameters{input.view, input.instance_count,
+                                {static_cast<float>(pyramid->depth_extent.width) /
+                                 static_cast<float>(pyramid->extent.width * 2),
+                                 static_cast<float>(pyramid->depth_extent.height) /
+                                 static_cast<float>(pyramid->extent.height * 2)}};
+    command_buffer.pushConstants<Parameters>(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, parameters);
+    command_buffer.dispatch((input.instance_count + group_size - 1) / group_size, 1, 1);
+    // The draws read the results as indirect arguments.
+    record_memory_barrier(command_buffer);
+}
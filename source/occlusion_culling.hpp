@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "descriptors.hpp"
+#include "downsampler.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+#include "specialization.hpp"
+#include "workgroup_tuner.hpp"
+
+struct OcclusionCullingPhase {
+    bool is_late{};
+
+    bool operator==(const OcclusionCullingPhase &) const = default;
+};
+
+template<>
+struct SpecializationTraits<OcclusionCullingPhase> {
+    using Map = SpecializationMap<SpecializationMember<0, &OcclusionCullingPhase::is_late>>;
+};
+
+// The camera of a frame, laid out like the push constants of shaders/occlusion_cull.comp. View space looks down +z with
+// y down, the projection is a reversed infinite perspective with these scales.
+struct OcclusionCullingView {
+    std::array<float, 16> view{};
+    float projection_x{};
+    float projection_y{};
+    float near{};
+};
+
+// The instances to cull, instance_count of them at most max_instances.
+struct OcclusionCullingInput {
+    // World space center and radius of every instance, as 4 floats.
+    vk::Buffer bounds;
+    // A vk::DrawIndexedIndirectCommand per instance.
+    vk::Buffer commands;
+    uint32_t instance_count;
+    OcclusionCullingView view;
+};
+
+// Two phase occlusion culling against a Hi-Z pyramid. A frame records
+//
+//     record_early, then draws get_draws(false) with vkCmdDrawIndexedIndirectCount,
+//     record_pyramid with the depth of those draws,
+//     record_late, then draws get_draws(true) on top of the same depth.
+//
+// The early phase draws what the late phase found visible the frame before, the late phase only what's new, so nothing
+// is drawn twice and the pyramid is built from a nearly complete depth buffer without a depth prepass.
+class OcclusionCuller : Noncopyable {
+    struct Bindings {
+        vk::DescriptorBufferInfo bounds;
+        vk::DescriptorBufferInfo commands;
+        vk::DescriptorBufferInfo visibility;
+        vk::DescriptorBufferInfo draws;
+        vk::DescriptorBufferInfo draw_count;
+        vk::DescriptorImageInfo pyramid;
+    };
+
+    struct Pyramid {
+        AllocationId image{};
+        vk::raii::ImageView view;
+        std::vector<vk::raii::ImageView> levels;
+        vk::Extent2D extent;
+        // Of the depth buffer it's built from.
+        vk::Extent2D depth_extent;
+    };
+
+    const vk::raii::Device &device;
+    PipelineStateCache &pipelines;
+    DeviceAllocator &allocator;
+    DeferredDeletionQueue &deferred_deletion_queue;
+    SinglePassDownsampler &downsampler;
+    const uint32_t max_instances;
+    const uint32_t group_size;
+    const vk::raii::Sampler sampler;
+    const vk::PipelineLayout pipeline_layout;
+    const PackedDescriptorSet<Bindings> descriptor_set;
+    std::array<PipelineStateKey, 2> keys;
+    // Whether every instance was visible at the end of the last frame.
+    const AllocationId visibility;
+    // Compacted draws and their count, of the early and the late phase.
+    const std::array<AllocationId, 2> draws;
+    const std::array<AllocationId, 2> draw_counts;
+    bool is_visibility_cleared{};
+    std::optional<Pyramid> pyramid;
+
+    // Power of two levels at least half the depth extent, so every level halves the previous one exactly.
+    void create_pyramid(vk::Extent2D depth_extent);
+
+    void release_pyramid();
+
+    void record_phase(const vk::raii::CommandBuffer &command_buffer,
+                      TransientDescriptorAllocator &descriptor_allocator, const OcclusionCullingInput &input,
+                      bool is_late);
+
+public:
+    // Culls with the workgroup WorkgroupTuner picks for the shader over max_instances, only its x size counts.
+    OcclusionCuller(const vk::raii::Device &device, const ShaderRegistry &shader_registry,
+                    PipelineStateCache &pipelines, PipelineLayoutCache &layouts,
+                    SpecializationRegistry &specializations, DeviceAllocator &allocator,
+                    DeferredDeletionQueue &deferred_deletion_queue, SinglePassDownsampler &downsampler,
+                    ShaderId shader, const WorkgroupConfig &workgroup, uint32_t max_instances);
+
+    ~OcclusionCuller();
+
+    void record_early(const vk::raii::CommandBuffer &command_buffer,
+                      TransientDescriptorAllocator &descriptor_allocator, const OcclusionCullingInput &input);
+
+    // The depth is sampled in shader read only layout, at most 4096x4096.
+    void record_pyramid(const vk::raii::CommandBuffer &command_buffer,
+                        TransientDescriptorAllocator &descriptor_allocator, vk::ImageView depth,
+                        vk::Extent2D depth_extent);
+
+    void record_late(const vk::raii::CommandBuffer &command_buffer,
+                     TransientDescriptorAllocator &descriptor_allocator, const OcclusionCullingInput &input);
+
+    // For the allocator's move callback, defragmentation gives the pyramid a new handle.
+    void handle_move(AllocationId id);
+
+    // vk::DrawIndexedIndirectCommand entries and their count as a uint32_t, up to max_instances of them.
+    [[nodiscard]] vk::Buffer get_draws(bool is_late) const;
+
+    [[nodiscard]] vk::Buffer get_draw_count(bool is_late) const;
+};
@@ -0,0 +1,93 @@
+#include "pipeline_layouts.hpp"
+
+#include <algorithm>
+#include <map>
+#include <ranges>
+#include <stdexcept>
+
+#include "hashing.hpp"
+
+size_t std::hash<PipelineLayoutKey>::operator()(const PipelineLayoutKey &key) const noexcept {
+    auto seed = hash_values(key.set_layouts.size(), key.push_constant_ranges.size());
+    for (const auto set_layout: key.set_layouts)
+        hash_combine(seed, static_cast<VkDescriptorSetLayout>(set_layout));
+    for (const auto &range: key.push_constant_ranges)
+        hash_combine(seed, hash_values(static_cast<VkFlags>(range.stageFlags), range.offset, range.size));
+    return seed;
+}
+
+vk::PipelineLayout PipelineLayoutCache::get(const std::span<const vk::DescriptorSetLayout> set_layouts,
+                                            const std::span<const vk::PushConstantRange> push_constant_ranges) {
+    PipelineLayoutKey key{{set_layouts.begin(), set_layouts.end()},
+                          {push_constant_ranges.begin(), push_constant_ranges.end()}};
+    const std::scoped_lock lock{mutex};
+    if (const auto layout = layouts.find(key); layout != layouts.end())
+        return *layout->second;
+
+    vk::PipelineLayoutCreateInfo create_info{};
+    create_info.setSetLayouts(key.set_layouts);
+    create_info.setPushConstantRanges(key.push_constant_ranges);
+    vk::raii::PipelineLayout layout{device, create_info};
+    const auto handle = *layout;
+    layouts.emplace(std::move(key), std::move(layout));
+    return handle;
+}
+
+ReflectedPipelineLayout PipelineLayoutCache::get(const std::span<const ShaderReflection> stages) {
+    std::map<uint32_t, std::map<uint32_t, vk::DescriptorSetLayoutBinding>> sets;
+    vk::PushConstantRange push_constant_range{};
+    for (const auto &stage: stages) {
+        const auto stage_flag = static_cast<vk::ShaderStageFlagBits>(stage.stage);
+        for (const auto &[set, binding, type, count]: stage.bindings) {
+            if (count == 0)
+                throw std::invalid_argument{"Runtime sized descriptor arrays need a hand written layout"};
+            const vk::DescriptorSetLayoutBinding reflected{binding, static_cast<vk::DescriptorType>(type), count,
+                                                           stage_flag};
+            const auto [existing, inserted] = sets[set].try_emplace(binding, reflected);
+            if (inserted)
+                continue;
+            if (existing->second.descriptorType != reflected.descriptorType ||
+                existing->second.descriptorCount != reflected.descriptorCount)
+                throw std::invalid_argument{"Shader stages disagree about set " + std::to_string(set) + " binding " +
+                                            std::to_string(binding)};
+            existing->second.stageFlags |= stage_flag;
+        }
+        // A single range shared by every stage, the simplest layout vkCmdPushConstants accepts.
+        if (stage.push_constant_size) {
+            push_constant_range.stageFlags |= stage_flag;
+            push_constant_range.size = std::max(push_constant_range.size, stage.push_constant_size);
+        }
+    }
+
+    ReflectedPipelineLayout result{};
+    const auto set_count = sets.empty() ? 0 : sets.rbegin()->first + 1;
+    for (uint32_t set{}; set < set_count; ++set) {
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        if (const auto found = sets.find(set); found != sets.end())
+            for (const auto &binding: found->second | std::views::values)
+                bindings.emplace_back(binding);
+        result.set_layouts.emplace_back(set_layout_cache.get(bindings));
+    }
+    if (push_constant_range.size)
+        result.push_constant_ranges.emplace_back(push_constant_range);
+    result.pipeline_layout = get(result.set_layouts, result.push_constant_ranges);
+    return result;
+}
+
+size_t PipelineLayoutCache::get_size() {
+    const std::scoped_lock lock{mutex};
+    return layouts.size();
+}
+
+std::vector<vk::VertexInputAttributeDescription> get_vertex_attributes(const ShaderReflection &vertex_stage,
+                                                                       const uint32_t binding, uint32_t &stride) {
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+    stride = 0;
+    for (const auto &[location, format]: vertex_stage.vertex_inputs) {
+        if (format == VK_FORMAT_UNDEFINED)
+            throw std::invalid_argument{"Vertex input " + std::to_string(location) + " has no 32 bit format"};
+        attributes.emplace_back(location, binding, static_cast<vk::Format>(format), stride);
+        stride += static_cast<uint32_t>(vk::blockSize(static_cast<vk::Format>(format)));
+    }
+    return attributes;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "descriptors.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+#include "shader_reflection.hpp"
+
+struct PipelineLayoutKey {
+    std::vector<vk::DescriptorSetLayout> set_layouts;
+    std::vector<vk::PushConstantRange> push_constant_ranges;
+
+    bool operator==(const PipelineLayoutKey &) const = default;
+};
+
+template<>
+struct std::hash<PipelineLayoutKey> {
+    size_t operator()(const PipelineLayoutKey &key) const noexcept;
+};
+
+struct ReflectedPipelineLayout {
+    vk::PipelineLayout pipeline_layout;
+    std::vector<vk::DescriptorSetLayout> set_layouts;
+    std::vector<vk::PushConstantRange> push_constant_ranges;
+};
+
+// Builds pipeline layouts from the reflection stored next to the shaders instead of hand maintained descriptions, and
+// shares one layout object between every pipeline with the same set layouts and push constants.
+class PipelineLayoutCache : Noncopyable {
+    const vk::raii::Device &device;
+    DescriptorSetLayoutCache &set_layout_cache;
+    std::mutex mutex;
+    std::unordered_map<PipelineLayoutKey, vk::raii::PipelineLayout> layouts;
+
+public:
+    PipelineLayoutCache(const vk::raii::Device &device, DescriptorSetLayoutCache &set_layout_cache)
+            : device{device}, set_layout_cache{set_layout_cache} {}
+
+    // Thread safe, the returned handle lives as long as the cache.
+    [[nodiscard]] vk::PipelineLayout get(std::span<const vk::DescriptorSetLayout> set_layouts,
+                                         std::span<const vk::PushConstantRange> push_constant_ranges);
+
+    // Merges the bindings of every stage, throws std::invalid_argument when stages disagree about a binding.
+    [[nodiscard]] ReflectedPipelineLayout get(std::span<const ShaderReflection> stages);
+
+    [[nodiscard]] size_t get_size();
+};
+
+// Tightly packed attributes for a single interleaved vertex buffer, in location order.
+[[nodiscard]] std::vector<vk::VertexInputAttributeDescription> get_vertex_attributes(
+        const ShaderReflection &vertex_stage, uint32_t binding, uint32_t &stride);
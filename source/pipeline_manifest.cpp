@@ -0,0 +1,136 @@
+#include "pipeline_manifest.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "binary_io.hpp"
+
+namespace {
+    constexpr uint32_t manifest_magic{0x4e414d50}; // "PMAN"
+    constexpr uint32_t manifest_version{1};
+
+    void write_shader(std::vector<std::byte> &data, const ShaderRegistry &shaders, const ShaderId id) {
+        write_string(data, id ? shaders.get_path(id).generic_string() : std::string{});
+    }
+
+}
+
+void PipelineManifest::record(const PipelineStateKey &state) {
+    const std::scoped_lock lock{mutex};
+    if (recorded.insert(state).second)
+        states.emplace_back(state);
+}
+
+std::vector<PipelineStateKey> PipelineManifest::load(const std::filesystem::path &path, ShaderRegistry &shaders,
+                                                     VertexLayoutRegistry &vertex_layouts,
+                                                     SpecializationRegistry &specializations) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file)
+        return {};
+    const std::vector<char> content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    Reader reader{std::as_bytes(std::span{content}), "pipeline manifest"};
+
+    std::vector<PipelineStateKey> loaded;
+    size_t skipped{};
+    try {
+        if (reader.read<uint32_t>() != manifest_magic || reader.read<uint32_t>() != manifest_version ||
+            reader.read<uint32_t>() != sizeof(PipelineStateKey)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Ignoring pipeline manifest %s from another version",
+                        path.string().c_str());
+            return {};
+        }
+        const auto count = reader.read<uint32_t>();
+        loaded.reserve(count);
+        for (uint32_t index{}; index < count; ++index) {
+            const auto vertex_shader = reader.read_string();
+            const auto fragment_shader = reader.read_string();
+            const auto compute_shader = reader.read_string();
+
+            VertexLayout vertex_layout{};
+            vertex_layout.bindings.resize(reader.read<uint32_t>());
+            for (auto &binding: vertex_layout.bindings)
+                binding = reader.read<vk::VertexInputBindingDescription>();
+            vertex_layout.attributes.resize(reader.read<uint32_t>());
+            for (auto &attribute: vertex_layout.attributes)
+                attribute = reader.read<vk::VertexInputAttributeDescription>();
+
+            std::vector<vk::SpecializationMapEntry> specialization_entries(reader.read<uint32_t>());
+            for (auto &entry: specialization_entries)
+                entry = reader.read<vk::SpecializationMapEntry>();
+            const auto specialization_data = reader.read_span(reader.read<uint32_t>());
+
+            auto key = reader.read<PipelineStateKey>();
+            try {
+                const auto load_shader = [&](const std::string &shader_path) {
+                    return shader_path.empty() ? ShaderId{} : shaders.load(shader_path);
+                };
+                key.vertex_shader = load_shader(vertex_shader);
+                key.fragment_shader = load_shader(fragment_shader);
+                key.compute_shader = load_shader(compute_shader);
+            } catch (const std::exception &) {
+                ++skipped;
+                continue;
+            }
+            key.vertex_layout = vertex_layouts.get_id(std::move(vertex_layout));
+            key.specialization = specializations.get_id(specialization_entries, specialization_data);
+            loaded.emplace_back(key);
+        }
+    } catch (const std::exception &error) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Ignoring pipeline manifest %s: %s", path.string().c_str(), error.what());
+        return {};
+    }
+    if (skipped)
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Skipped %zu pipelines of the manifest whose shaders are gone", skipped);
+
+    const std::scoped_lock lock{mutex};
+    previous_states = loaded;
+    return loaded;
+}
+
+void PipelineManifest::save(const std::filesystem::path &path, const ShaderRegistry &shaders,
+                            const VertexLayoutRegistry &vertex_layouts,
+                            const SpecializationRegistry &specializations) const {
+    std::vector<PipelineStateKey> ordered;
+    {
+        const std::scoped_lock lock{mutex};
+        ordered = states;
+        for (const auto &state: previous_states)
+            if (!recorded.contains(state))
+                ordered.emplace_back(state);
+    }
+
+    std::vector<std::byte> data;
+    write(data, manifest_magic);
+    write(data, manifest_version);
+    write(data, static_cast<uint32_t>(sizeof(PipelineStateKey)));
+    write(data, static_cast<uint32_t>(ordered.size()));
+    for (auto key: ordered) {
+        write_shader(data, shaders, key.vertex_shader);
+        write_shader(data, shaders, key.fragment_shader);
+        write_shader(data, shaders, key.compute_shader);
+
+        const auto vertex_layout = vertex_layouts.get(key.vertex_layout);
+        write(data, static_cast<uint32_t>(vertex_layout.bindings.size()));
+        for (const auto &binding: vertex_layout.bindings)
+            write(data, binding);
+        write(data, static_cast<uint32_t>(vertex_layout.attributes.size()));
+        for (const auto &attribute: vertex_layout.attributes)
+            write(data, attribute);
+
+        const auto [specialization_entries, specialization_data] = specializations.get(key.specialization);
+        write(data, static_cast<uint32_t>(specialization_entries.size()));
+        for (const auto &entry: specialization_entries)
+            write(data, entry);
+        write(data, static_cast<uint32_t>(specialization_data.size()));
+        data.insert(data.end(), specialization_data.begin(), specialization_data.end());
+
+        // The ids are session local and were written out above.
+        key.vertex_shader = key.fragment_shader = key.compute_shader = {};
+        key.vertex_layout = key.specialization = 0;
+        write(data, key);
+    }
+
+    write_file(path, data, "pipeline manifest");
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "shaders.hpp"
+
+// The pipeline states a session used in the order they were first needed, so the next launch can compile them on
+// the workers before they are asked for. Ids in the keys only live for one session, the file stores shader paths,
+// vertex layouts and specialization values instead and load maps them to the ids of the current session.
+class PipelineManifest : Noncopyable {
+    mutable std::mutex mutex;
+    std::vector<PipelineStateKey> states;
+    std::unordered_set<PipelineStateKey> recorded;
+    // Loaded from the last session, kept behind this session's states so content not visited this time isn't lost.
+    std::vector<PipelineStateKey> previous_states;
+
+public:
+    // Thread safe, only the first use of a state counts.
+    void record(const PipelineStateKey &state);
+
+    // A missing or outdated file loads as empty, states whose shaders are gone are skipped. Returns the states in
+    // priority order, the first frame's pipelines first.
+    std::vector<PipelineStateKey> load(const std::filesystem::path &path, ShaderRegistry &shaders,
+                                       VertexLayoutRegistry &vertex_layouts, SpecializationRegistry &specializations);
+
+    void save(const std::filesystem::path &path, const ShaderRegistry &shaders,
+              const VertexLayoutRegistry &vertex_layouts, const SpecializationRegistry &specializations) const;
+};
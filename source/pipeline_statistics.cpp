@@ -0,0 +1,219 @@
+#include "pipeline_statistics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <ranges>
+#include <stdexcept>
+
+#include "config.hpp"
+
+namespace {
+    struct SummaryColumn {
+        const char *name;
+        std::optional<double> PipelineExecutableStatistics::*value;
+        // Lower case substrings of the driver's statistic names, the first statistic matching any of them counts.
+        std::array<const char *, 3> keywords;
+    };
+
+    const std::array summary_columns{
+            SummaryColumn{"instructions", &PipelineExecutableStatistics::instructions,
+                          {"instruction", nullptr, nullptr}},
+            SummaryColumn{"registers", &PipelineExecutableStatistics::registers, {"vgpr", "register", nullptr}},
+            SummaryColumn{"spills", &PipelineExecutableStatistics::spills, {"spill", nullptr, nullptr}},
+            SummaryColumn{"shared_memory", &PipelineExecutableStatistics::shared_memory,
+                          {"lds", "shared", nullptr}},
+    };
+
+    std::string to_lower(std::string_view text) {
+        std::string result{text};
+        std::ranges::transform(result, result.begin(), [](const unsigned char character) {
+            return static_cast<char>(std::tolower(character));
+        });
+        return result;
+    }
+
+    double get_value(const vk::PipelineExecutableStatisticKHR &statistic) {
+        switch (statistic.format) {
+            case vk::PipelineExecutableStatisticFormatKHR::eBool32:
+                return statistic.value.b32;
+            case vk::PipelineExecutableStatisticFormatKHR::eInt64:
+                return static_cast<double>(statistic.value.i64);
+            case vk::PipelineExecutableStatisticFormatKHR::eUint64:
+                return static_cast<double>(statistic.value.u64);
+            case vk::PipelineExecutableStatisticFormatKHR::eFloat64:
+                return statistic.value.f64;
+        }
+        return 0.0;
+    }
+
+    std::string get_pipeline_name(const PipelineStateKey &key, const ShaderRegistry &shaders) {
+        std::string name;
+        for (const auto shader: {key.vertex_shader, key.fragment_shader, key.compute_shader}) {
+            if (!shader)
+                continue;
+            if (!name.empty())
+                name += '+';
+            name += shaders.get_path(shader).filename().string();
+        }
+        // Pipelines of the same shaders differ in the rest of their state.
+        return std::format("{} #{:08x}", name, static_cast<uint32_t>(std::hash<PipelineStateKey>{}(key)));
+    }
+
+    std::vector<std::pair<std::string, std::string>> get_internal_representations(
+            const vk::raii::Device &device, const vk::PipelineExecutableInfoKHR &info) {
+        // The raii wrapper doesn't fetch the text itself, that takes a third call once the sizes are known.
+        const auto &executable_info = static_cast<const VkPipelineExecutableInfoKHR &>(info);
+        const auto get = [&](uint32_t &count, VkPipelineExecutableInternalRepresentationKHR *const representations) {
+            const auto result = static_cast<vk::Result>(
+                    device.getDispatcher()->vkGetPipelineExecutableInternalRepresentationsKHR(
+                            *device, &executable_info, &count, representations));
+            if (result != vk::Result::eSuccess && result != vk::Result::eIncomplete)
+                throw vk::SystemError{vk::make_error_code(result), "vkGetPipelineExecutableInternalRepresentationsKHR"};
+        };
+        uint32_t count{};
+        get(count, nullptr);
+        std::vector<VkPipelineExecutableInternalRepresentationKHR> representations(
+                count, {VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_INTERNAL_REPRESENTATION_KHR});
+        get(count, representations.data());
+        std::vector<std::string> texts;
+        // The pointers handed to the driver must stay put.
+        texts.reserve(representations.size());
+        for (auto &representation: representations) {
+            auto &text = texts.emplace_back(representation.dataSize, '\0');
+            representation.pData = text.data();
+        }
+        get(count, representations.data());
+
+        std::vector<std::pair<std::string, std::string>> result;
+        for (auto &&[representation, text]: std::views::zip(representations, texts)) {
+            // Text representations are null terminated, binary ones are kept as they are.
+            if (representation.isText && !text.empty() && text.back() == '\0')
+                text.pop_back();
+            result.emplace_back(representation.name, std::move(text));
+        }
+        return result;
+    }
+
+    std::string escape_csv(const std::string_view field) {
+        if (field.find_first_of(",\"\n") == std::string_view::npos)
+            return std::string{field};
+        std::string escaped{'"'};
+        for (const auto character: field) {
+            if (character == '"')
+                escaped += '"';
+            escaped += character;
+        }
+        return escaped + '"';
+    }
+
+    std::string get_file_name(std::string_view text) {
+        std::string name{text};
+        std::ranges::replace_if(name, [](const unsigned char character) {
+            return !std::isalnum(character) && character != '.' && character != '-';
+        }, '_');
+        return name;
+    }
+}
+
+PipelineStatisticsConfig PipelineStatisticsConfig::from_environment() {
+    PipelineStatisticsConfig config{};
+    if (const auto path = get_config<std::string_view>("APP_PIPELINE_STATISTICS"))
+        config.report_path = *path;
+    config.internal_representations = get_config("APP_PIPELINE_STATISTICS_IR", config.internal_representations);
+    if (const auto column = get_config<std::string_view>("APP_PIPELINE_STATISTICS_SORT"))
+        config.sort_by = *column;
+    return config;
+}
+
+std::vector<PipelineExecutableStatistics> collect_pipeline_statistics(
+        const vk::raii::Device &device, PipelineStateCache &pipelines, const ShaderRegistry &shaders,
+        const bool internal_representations) {
+    std::vector<PipelineExecutableStatistics> statistics;
+    for (const auto &[key, pipeline]: pipelines.get_pipelines()) {
+        const auto pipeline_name = get_pipeline_name(key, shaders);
+        const auto executables = device.getPipelineExecutablePropertiesKHR(vk::PipelineInfoKHR{pipeline});
+        for (const auto &[index, executable]: std::views::enumerate(executables)) {
+            const vk::PipelineExecutableInfoKHR info{pipeline, static_cast<uint32_t>(index)};
+            auto &entry = statistics.emplace_back();
+            entry.pipeline = pipeline_name;
+            entry.executable = executable.name.data();
+            entry.stages = executable.stages;
+            entry.subgroup_size = executable.subgroupSize;
+            for (const auto &statistic: device.getPipelineExecutableStatisticsKHR(info)) {
+                const auto value = get_value(statistic);
+                entry.values.emplace_back(statistic.name.data(), value);
+                const auto name = to_lower(statistic.name.data());
+                for (const auto &column: summary_columns) {
+                    auto &summary = entry.*column.value;
+                    if (!summary && std::ranges::any_of(column.keywords, [&](const char *const keyword) {
+                        return keyword && name.contains(keyword);
+                    }))
+                        summary = value;
+                }
+            }
+            if (internal_representations)
+                entry.internal_representations = get_internal_representations(device, info);
+        }
+    }
+    return statistics;
+}
+
+void write_pipeline_statistics_report(std::vector<PipelineExecutableStatistics> statistics,
+                                      const std::filesystem::path &path, const std::string &sort_by) {
+    // Statistics keep the order the first driver executable reported them in.
+    std::vector<std::string> columns;
+    for (const auto &entry: statistics)
+        for (const auto &[name, value]: entry.values)
+            if (!std::ranges::contains(columns, name))
+                columns.emplace_back(name);
+
+    const auto get_column = [&](const PipelineExecutableStatistics &entry, const std::string_view column) {
+        for (const auto &summary: summary_columns)
+            if (column == summary.name)
+                return entry.*summary.value;
+        const auto found = std::ranges::find(entry.values, column, &std::pair<std::string, double>::first);
+        return found != entry.values.end() ? std::optional{found->second} : std::nullopt;
+    };
+    std::ranges::stable_sort(statistics, std::ranges::greater{}, [&](const PipelineExecutableStatistics &entry) {
+        return get_column(entry, sort_by).value_or(-1.0);
+    });
+
+    std::ofstream file{path, std::ios::trunc};
+    if (!file)
+        throw std::runtime_error{"Couldn't write pipeline statistics " + path.string()};
+    file << "pipeline,executable,stages,subgroup_size";
+    for (const auto &summary: summary_columns)
+        file << ',' << summary.name;
+    for (const auto &column: columns)
+        file << ',' << escape_csv(column);
+    file << '\n';
+    const auto write_value = [&](const std::optional<double> value) {
+        file << ',';
+        if (value)
+            file << *value;
+    };
+    for (const auto &entry: statistics) {
+        file << escape_csv(entry.pipeline) << ',' << escape_csv(entry.executable) << ','
+             << escape_csv(vk::to_string(entry.stages)) << ',' << entry.subgroup_size;
+        for (const auto &summary: summary_columns)
+            write_value(entry.*summary.value);
+        for (const auto &column: columns)
+            write_value(get_column(entry, column));
+        file << '\n';
+    }
+
+    auto representation_directory{path};
+    representation_directory += ".ir";
+    for (const auto &entry: statistics) {
+        for (const auto &[name, text]: entry.internal_representations) {
+            std::filesystem::create_directories(representation_directory);
+            std::ofstream{representation_directory / get_file_name(entry.pipeline + '_' + entry.executable + '_' +
+                                                                   name + ".txt"), std::ios::binary} << text;
+        }
+    }
+    SDL_Log("Wrote statistics of %zu pipeline executables to %s", statistics.size(), path.string().c_str());
+}
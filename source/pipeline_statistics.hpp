@@ -0,0 +1,48 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+
+struct PipelineStatisticsConfig {
+    // No report without a path.
+    std::optional<std::filesystem::path> report_path;
+    bool internal_representations{};
+    // Statistic or summary column the report is sorted by, largest first.
+    std::string sort_by{"instructions"};
+
+    [[nodiscard]] static PipelineStatisticsConfig from_environment();
+};
+
+// Compiler statistics of one executable, which is usually one shader stage of a pipeline.
+struct PipelineExecutableStatistics {
+    std::string pipeline;
+    std::string executable;
+    vk::ShaderStageFlags stages;
+    uint32_t subgroup_size{};
+    // Whatever the driver reports, names differ between vendors.
+    std::vector<std::pair<std::string, double>> values;
+    // Drivers name the common ones differently, these are matched by keyword and empty when nothing matched.
+    std::optional<double> instructions;
+    std::optional<double> registers;
+    std::optional<double> spills;
+    std::optional<double> shared_memory;
+    // Name and text of each internal representation when they were captured.
+    std::vector<std::pair<std::string, std::string>> internal_representations;
+};
+
+// Queries VK_KHR_pipeline_executable_properties for every pipeline in the cache, which needs the pipelines created
+// with capture_pipeline_statistics.
+[[nodiscard]] std::vector<PipelineExecutableStatistics> collect_pipeline_statistics(
+        const vk::raii::Device &device, PipelineStateCache &pipelines, const ShaderRegistry &shaders,
+        bool internal_representations);
+
+// One CSV row per executable with a column per statistic, sorted by the given column. Internal representations
+// go to text files in a directory next to the report.
+void write_pipeline_statistics_report(std::vector<PipelineExecutableStatistics> statistics,
+                                      const std::filesystem::path &path, const std::string &sort_by);
@@ -0,0 +1,432 @@
+#include "pipelines.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+#include "pipeline_manifest.hpp"
+
+namespace {
+    vk::PipelineColorBlendAttachmentState get_blend_state(const BlendMode mode) {
+        vk::PipelineColorBlendAttachmentState state{};
+        state.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+                               vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+        if (mode == BlendMode::Opaque)
+            return state;
+        state.blendEnable = true;
+        state.colorBlendOp = vk::BlendOp::eAdd;
+        state.alphaBlendOp = vk::BlendOp::eAdd;
+        switch (mode) {
+            case BlendMode::AlphaBlend:
+                state.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+                state.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+                state.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+                state.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+                break;
+            case BlendMode::Additive:
+                state.srcColorBlendFactor = vk::BlendFactor::eOne;
+                state.dstColorBlendFactor = vk::BlendFactor::eOne;
+                state.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+                state.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+                break;
+            case BlendMode::Premultiplied:
+                state.srcColorBlendFactor = vk::BlendFactor::eOne;
+                state.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+                state.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+                state.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+                break;
+            default:
+                std::unreachable();
+        }
+        return state;
+    }
+}
+
+PipelineStateKey get_pipeline_key(const PipelineStateKey &state, const DeviceFeatures &features) {
+    if (state.compute_shader)
+        return state;
+    auto key{state};
+    // Vulkan 1.3 made these dynamic unconditionally.
+    key.cull_mode = 0;
+    key.front_face = 0;
+    key.depth_test = 0;
+    key.depth_write = 0;
+    key.depth_compare = vk::CompareOp::eNever;
+    key.stencil_test = 0;
+    key.stencil_fail = vk::StencilOp::eKeep;
+    key.stencil_pass = vk::StencilOp::eKeep;
+    key.stencil_depth_fail = vk::StencilOp::eKeep;
+    key.stencil_compare = vk::CompareOp::eNever;
+    // Dynamic since Vulkan 1.0.
+    key.stencil_compare_mask = 0;
+    key.stencil_write_mask = 0;
+    key.stencil_reference = 0;
+    // Without the unrestricted property the topology can only change within its class.
+    if (features.dynamic_primitive_topology_unrestricted) {
+        key.topology = vk::PrimitiveTopology::eTriangleList;
+    } else {
+        switch (state.topology) {
+            case vk::PrimitiveTopology::ePointList:
+                break;
+            case vk::PrimitiveTopology::eLineList:
+            case vk::PrimitiveTopology::eLineStrip:
+            case vk::PrimitiveTopology::eLineListWithAdjacency:
+            case vk::PrimitiveTopology::eLineStripWithAdjacency:
+                key.topology = vk::PrimitiveTopology::eLineList;
+                break;
+            case vk::PrimitiveTopology::ePatchList:
+                break;
+            default:
+                key.topology = vk::PrimitiveTopology::eTriangleList;
+                break;
+        }
+    }
+    if (features.dynamic_polygon_mode)
+        key.polygon_mode = vk::PolygonMode::eFill;
+    if (features.dynamic_color_blend)
+        key.blend_modes.fill(BlendMode::Opaque);
+    return key;
+}
+
+void apply_dynamic_state(const vk::raii::CommandBuffer &command_buffer, const PipelineStateKey &state,
+                         const DeviceFeatures &features) {
+    command_buffer.setCullMode(static_cast<vk::CullModeFlagBits>(state.cull_mode));
+    command_buffer.setFrontFace(static_cast<vk::FrontFace>(state.front_face));
+    command_buffer.setPrimitiveTopology(state.topology);
+    command_buffer.setDepthTestEnable(state.depth_test);
+    command_buffer.setDepthWriteEnable(state.depth_write);
+    command_buffer.setDepthCompareOp(state.depth_compare);
+    command_buffer.setStencilTestEnable(state.stencil_test);
+    command_buffer.setStencilOp(vk::StencilFaceFlagBits::eFrontAndBack, state.stencil_fail, state.stencil_pass,
+                                state.stencil_depth_fail, state.stencil_compare);
+    command_buffer.setStencilCompareMask(vk::StencilFaceFlagBits::eFrontAndBack, state.stencil_compare_mask);
+    command_buffer.setStencilWriteMask(vk::StencilFaceFlagBits::eFrontAndBack, state.stencil_write_mask);
+    command_buffer.setStencilReference(vk::StencilFaceFlagBits::eFrontAndBack, state.stencil_reference);
+    if (features.dynamic_polygon_mode)
+        command_buffer.setPolygonModeEXT(state.polygon_mode);
+    if (features.dynamic_color_blend && state.color_attachment_count) {
+        std::vector<vk::Bool32> enables;
+        std::vector<vk::ColorBlendEquationEXT> equations;
+        std::vector<vk::ColorComponentFlags> write_masks;
+        for (const auto mode: state.blend_modes | std::views::take(state.color_attachment_count)) {
+            const auto blend_state = get_blend_state(mode);
+            enables.emplace_back(blend_state.blendEnable);
+            equations.emplace_back(blend_state.srcColorBlendFactor, blend_state.dstColorBlendFactor,
+                                   blend_state.colorBlendOp, blend_state.srcAlphaBlendFactor,
+                                   blend_state.dstAlphaBlendFactor, blend_state.alphaBlendOp);
+            write_masks.emplace_back(blend_state.colorWriteMask);
+        }
+        command_buffer.setColorBlendEnableEXT(0, enables);
+        command_buffer.setColorBlendEquationEXT(0, equations);
+        command_buffer.setColorWriteMaskEXT(0, write_masks);
+    }
+}
+
+uint32_t VertexLayoutRegistry::get_id(VertexLayout layout) {
+    if (layout.bindings.empty() && layout.attributes.empty())
+        return 0;
+    const std::scoped_lock lock{mutex};
+    if (const auto existing = std::ranges::find(layouts, layout); existing != layouts.end())
+        return static_cast<uint32_t>(existing - layouts.begin()) + 1;
+    layouts.emplace_back(std::move(layout));
+    return static_cast<uint32_t>(layouts.size());
+}
+
+VertexLayout VertexLayoutRegistry::get(const uint32_t id) const {
+    if (id == 0)
+        return {};
+    const std::scoped_lock lock{mutex};
+    return layouts.at(id - 1);
+}
+
+uint32_t SpecializationRegistry::get_id(const std::span<const vk::SpecializationMapEntry> entries,
+                                        const std::span<const std::byte> data) {
+    if (entries.empty())
+        return 0;
+    Values candidate{{entries.begin(), entries.end()}, {data.begin(), data.end()}};
+    const std::scoped_lock lock{mutex};
+    if (const auto existing = std::ranges::find(values, candidate); existing != values.end())
+        return static_cast<uint32_t>(existing - values.begin()) + 1;
+    values.emplace_back(std::move(candidate));
+    return static_cast<uint32_t>(values.size());
+}
+
+std::pair<std::vector<vk::SpecializationMapEntry>, std::vector<std::byte>> SpecializationRegistry::get(
+        const uint32_t id) const {
+    if (id == 0)
+        return {};
+    const std::scoped_lock lock{mutex};
+    const auto &[entries, data] = values.at(id - 1);
+    return {entries, data};
+}
+
+PipelineStateCache::PipelineStateCache(const vk::raii::Device &device, const ShaderRegistry &shaders,
+                                       PipelineLayoutCache &layouts, const VertexLayoutRegistry &vertex_layouts,
+                                       const SpecializationRegistry &specializations, const DeviceFeatures &features)
+        : device{device}, shaders{shaders}, layouts{layouts}, vertex_layouts{vertex_layouts},
+          specializations{specializations}, features{features},
+          driver_cache{device, vk::PipelineCacheCreateInfo{}} {}
+
+PipelineStateCache::Lookup PipelineStateCache::find_or_insert(const PipelineStateKey &state, const bool is_request) {
+    if (is_request)
+        request_count.fetch_add(1, std::memory_order_relaxed);
+    const auto key = get_pipeline_key(state, features);
+    auto &shard = get_shard(key);
+    const std::scoped_lock lock{shard.mutex};
+    if (is_request && shard.requested_states.insert(state).second)
+        if (const auto target = manifest.load())
+            target->record(state);
+    if (const auto found = shard.entries.find(key); found != shard.entries.end()) {
+        if (is_request)
+            (is_ready(*found->second) ? hit_count : coalesced_count).fetch_add(1, std::memory_order_relaxed);
+        return {found->second, false};
+    }
+    auto entry = std::make_shared<Entry>();
+    shard.entries.emplace(key, entry);
+    return {std::move(entry), true};
+}
+
+void PipelineStateCache::compile(const PipelineStateKey &key, Entry &entry) {
+    if (entry.claimed.test_and_set())
+        return;
+    try {
+        entry.pipeline.emplace(create(key));
+        creation_count.fetch_add(1, std::memory_order_relaxed);
+        entry.promise.set_value(**entry.pipeline);
+    } catch (...) {
+        // Forget the failed entry so a later request, for example after fixing a shader, tries again.
+        {
+            auto &shard = get_shard(key);
+            const std::scoped_lock lock{shard.mutex};
+            shard.entries.erase(key);
+        }
+        entry.promise.set_exception(std::current_exception());
+    }
+}
+
+void PipelineStateCache::compile_async(const PipelineStateKey &state, const Lookup &lookup, JobSystem &jobs) {
+    if (lookup.inserted)
+        jobs.submit([this, key = get_pipeline_key(state, features), entry = lookup.entry]() {
+            compile(key, *entry);
+        });
+}
+
+std::shared_future<vk::Pipeline> PipelineStateCache::request(const PipelineStateKey &state) {
+    const auto lookup = find_or_insert(state, true);
+    // Also takes over compiles still waiting in the job queue instead of waiting behind them.
+    compile(get_pipeline_key(state, features), *lookup.entry);
+    return lookup.entry->ready;
+}
+
+std::shared_future<vk::Pipeline> PipelineStateCache::request_async(const PipelineStateKey &state, JobSystem &jobs) {
+    const auto lookup = find_or_insert(state, true);
+    compile_async(state, lookup, jobs);
+    return lookup.entry->ready;
+}
+
+std::vector<std::shared_future<vk::Pipeline>> PipelineStateCache::warm_up(const std::span<const PipelineStateKey> states,
+                                                                          JobSystem &jobs) {
+    std::vector<std::shared_future<vk::Pipeline>> ready;
+    ready.reserve(states.size());
+    for (const auto &state: states) {
+        const auto lookup = find_or_insert(state, false);
+        compile_async(state, lookup, jobs);
+        ready.emplace_back(lookup.entry->ready);
+    }
+    return ready;
+}
+
+vk::raii::Pipeline PipelineStateCache::create_detached(const PipelineStateKey &state) const {
+    return create(get_pipeline_key(state, features));
+}
+
+std::vector<std::pair<PipelineStateKey, vk::Pipeline>> PipelineStateCache::get_pipelines() {
+    std::vector<std::pair<PipelineStateKey, vk::Pipeline>> pipelines;
+    for (auto &shard: shards) {
+        const std::scoped_lock lock{shard.mutex};
+        for (const auto &[key, entry]: shard.entries)
+            if (is_ready(*entry))
+                pipelines.emplace_back(key, **entry->pipeline);
+    }
+    return pipelines;
+}
+
+std::vector<PipelineStateKey> PipelineStateCache::get_keys_using(const ShaderId shader) {
+    std::vector<PipelineStateKey> keys;
+    for (auto &shard: shards) {
+        const std::scoped_lock lock{shard.mutex};
+        for (const auto &[key, entry]: shard.entries)
+            if (is_ready(*entry) && (key.vertex_shader == shader || key.fragment_shader == shader ||
+                                    key.compute_shader == shader))
+                keys.emplace_back(key);
+    }
+    return keys;
+}
+
+std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> PipelineStateCache::rebuild(const ShaderId shader) {
+    std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> rebuilt;
+    for (const auto &key: get_keys_using(shader))
+        rebuilt.emplace_back(key, create(key, ShaderVersion::Staged));
+    return rebuilt;
+}
+
+std::vector<vk::raii::Pipeline> PipelineStateCache::replace(
+        std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> rebuilt) {
+    std::vector<vk::raii::Pipeline> retired;
+    for (auto &[key, pipeline]: rebuilt) {
+        auto entry = std::make_shared<Entry>();
+        entry->claimed.test_and_set();
+        entry->pipeline.emplace(std::move(pipeline));
+        entry->promise.set_value(**entry->pipeline);
+
+        auto &shard = get_shard(key);
+        const std::scoped_lock lock{shard.mutex};
+        auto &slot = shard.entries[key];
+        // Whoever still holds the old entry keeps a valid handle until the caller destroys the retired pipeline.
+        if (slot && slot->pipeline)
+            retired.emplace_back(std::move(*slot->pipeline));
+        slot = std::move(entry);
+    }
+    return retired;
+}
+
+vk::PipelineLayout PipelineStateCache::get_layout(const PipelineStateKey &key, const ShaderVersion version) const {
+    std::vector<ShaderReflection> stages;
+    for (const auto shader: {key.vertex_shader, key.fragment_shader, key.compute_shader})
+        if (shader)
+            stages.emplace_back(shaders.get_reflection(shader, version));
+    return layouts.get(stages).pipeline_layout;
+}
+
+vk::raii::Pipeline PipelineStateCache::create(const PipelineStateKey &key, const ShaderVersion version) const {
+    const auto layout = get_layout(key, version);
+    const auto [specialization_entries, specialization_data] = specializations.get(key.specialization);
+    vk::SpecializationInfo specialization{};
+    specialization.setMapEntries(specialization_entries);
+    specialization.dataSize = specialization_data.size();
+    specialization.pData = specialization_data.data();
+    const auto *const specialization_info = key.specialization ? &specialization : nullptr;
+    vk::PipelineCreateFlags flags{};
+    if (features.capture_pipeline_statistics)
+        flags |= vk::PipelineCreateFlagBits::eCaptureStatisticsKHR;
+    if (features.capture_pipeline_internal_representations)
+        flags |= vk::PipelineCreateFlagBits::eCaptureInternalRepresentationsKHR;
+
+    if (key.compute_shader) {
+        vk::ComputePipelineCreateInfo create_info{};
+        create_info.stage = vk::PipelineShaderStageCreateInfo{{}, vk::ShaderStageFlagBits::eCompute,
+                                                              shaders.get_module(key.compute_shader, version),
+                                                              shaders.get_reflection(key.compute_shader, version).entry_point.data(),
+                                                              specialization_info};
+        create_info.flags = flags;
+        create_info.layout = layout;
+        return vk::raii::Pipeline{device, driver_cache, create_info};
+    }
+
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    stages.emplace_back(vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eVertex,
+                        shaders.get_module(key.vertex_shader, version),
+                        shaders.get_reflection(key.vertex_shader, version).entry_point.data(), specialization_info);
+    if (key.fragment_shader)
+        stages.emplace_back(vk::PipelineShaderStageCreateFlags{}, vk::ShaderStageFlagBits::eFragment,
+                            shaders.get_module(key.fragment_shader, version),
+                            shaders.get_reflection(key.fragment_shader, version).entry_point.data(),
+                            specialization_info);
+
+    const auto vertex_layout = vertex_layouts.get(key.vertex_layout);
+    vk::PipelineVertexInputStateCreateInfo vertex_input{};
+    vertex_input.setVertexBindingDescriptions(vertex_layout.bindings);
+    vertex_input.setVertexAttributeDescriptions(vertex_layout.attributes);
+
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly{};
+    input_assembly.topology = key.topology;
+
+    vk::PipelineViewportStateCreateInfo viewport{};
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization{};
+    rasterization.polygonMode = key.polygon_mode;
+    rasterization.cullMode = static_cast<vk::CullModeFlagBits>(key.cull_mode);
+    rasterization.frontFace = static_cast<vk::FrontFace>(key.front_face);
+    rasterization.lineWidth = 1.0f;
+
+    vk::PipelineMultisampleStateCreateInfo multisample{};
+    multisample.rasterizationSamples = static_cast<vk::SampleCountFlagBits>(key.sample_count);
+
+    vk::PipelineDepthStencilStateCreateInfo depth_stencil{};
+    depth_stencil.depthTestEnable = key.depth_test;
+    depth_stencil.depthWriteEnable = key.depth_write;
+    depth_stencil.depthCompareOp = key.depth_compare;
+    depth_stencil.stencilTestEnable = key.stencil_test;
+
+    std::vector<vk::PipelineColorBlendAttachmentState> blend_attachments;
+    for (const auto mode: key.blend_modes | std::views::take(key.color_attachment_count))
+        blend_attachments.emplace_back(get_blend_state(mode));
+    vk::PipelineColorBlendStateCreateInfo color_blend{};
+    color_blend.setAttachments(blend_attachments);
+
+    std::vector dynamic_states{
+            vk::DynamicState::eViewport, vk::DynamicState::eScissor, vk::DynamicState::eCullMode,
+            vk::DynamicState::eFrontFace, vk::DynamicState::ePrimitiveTopology, vk::DynamicState::eDepthTestEnable,
+            vk::DynamicState::eDepthWriteEnable, vk::DynamicState::eDepthCompareOp,
+            vk::DynamicState::eStencilTestEnable, vk::DynamicState::eStencilOp,
+            vk::DynamicState::eStencilCompareMask, vk::DynamicState::eStencilWriteMask,
+            vk::DynamicState::eStencilReference,
+    };
+    if (features.dynamic_polygon_mode)
+        dynamic_states.emplace_back(vk::DynamicState::ePolygonModeEXT);
+    if (features.dynamic_color_blend)
+        dynamic_states.insert(dynamic_states.end(), {vk::DynamicState::eColorBlendEnableEXT,
+                                                     vk::DynamicState::eColorBlendEquationEXT,
+                                                     vk::DynamicState::eColorWriteMaskEXT});
+    vk::PipelineDynamicStateCreateInfo dynamic_state{};
+    dynamic_state.setDynamicStates(dynamic_states);
+
+    vk::PipelineRenderingCreateInfo rendering{};
+    rendering.colorAttachmentCount = std::min<uint32_t>(key.color_attachment_count, key.color_formats.size());
+    rendering.pColorAttachmentFormats = key.color_formats.data();
+    rendering.depthAttachmentFormat = key.depth_format;
+    rendering.stencilAttachmentFormat = key.stencil_format;
+
+    vk::GraphicsPipelineCreateInfo create_info{};
+    create_info.pNext = &rendering;
+    create_info.flags = flags;
+    create_info.setStages(stages);
+    create_info.pVertexInputState = &vertex_input;
+    create_info.pInputAssemblyState = &input_assembly;
+    create_info.pViewportState = &viewport;
+    create_info.pRasterizationState = &rasterization;
+    create_info.pMultisampleState = &multisample;
+    create_info.pDepthStencilState = &depth_stencil;
+    create_info.pColorBlendState = &color_blend;
+    create_info.pDynamicState = &dynamic_state;
+    create_info.layout = layout;
+    return vk::raii::Pipeline{device, driver_cache, create_info};
+}
+
+PipelineCacheStats PipelineStateCache::get_stats() {
+    size_t state_count{};
+    size_t pipeline_count{};
+    for (auto &shard: shards) {
+        const std::scoped_lock lock{shard.mutex};
+        state_count += shard.requested_states.size();
+        pipeline_count += shard.entries.size();
+    }
+    return {
+            .requests = request_count.load(std::memory_order_relaxed),
+            .hits = hit_count.load(std::memory_order_relaxed),
+            .coalesced = coalesced_count.load(std::memory_order_relaxed),
+            .creations = creation_count.load(std::memory_order_relaxed),
+            .state_count = state_count,
+            .pipeline_count = pipeline_count,
+    };
+}
+
+void PipelineStateCache::log_stats() {
+    const auto stats = get_stats();
+    SDL_Log("Pipelines: %llu requests, %llu hits, %llu coalesced, %llu created",
+            static_cast<unsigned long long>(stats.requests), static_cast<unsigned long long>(stats.hits),
+            static_cast<unsigned long long>(stats.coalesced), static_cast<unsigned long long>(stats.creations));
+    SDL_Log("Pipelines: %zu distinct states share %zu pipelines", stats.state_count, stats.pipeline_count);
+}
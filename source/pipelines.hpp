@@ -0,0 +1,270 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "device_features.hpp"
+#include "noncopyable.hpp"
+#include "pipeline_layouts.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+#include "specialization.hpp"
+#include "threading.hpp"
+
+enum class BlendMode : uint8_t {
+    Opaque,
+    AlphaBlend,
+    Additive,
+    Premultiplied,
+};
+
+// Everything a graphics pipeline is made of, packed without padding so hashing and comparing work on raw bytes.
+// Zeroed fields mean the default, a compute pipeline only sets the compute shader.
+struct PipelineStateKey {
+    static constexpr size_t max_color_attachments{4};
+
+    ShaderId vertex_shader{};
+    ShaderId fragment_shader{};
+    ShaderId compute_shader{};
+    uint32_t vertex_layout{};
+    // Id from the SpecializationRegistry, applied to every stage since stages ignore constant ids they don't declare.
+    uint32_t specialization{};
+    std::array<vk::Format, max_color_attachments> color_formats{};
+    vk::Format depth_format{};
+    vk::Format stencil_format{};
+    vk::PrimitiveTopology topology{vk::PrimitiveTopology::eTriangleList};
+    vk::PolygonMode polygon_mode{vk::PolygonMode::eFill};
+    vk::CompareOp depth_compare{vk::CompareOp::eGreaterOrEqual};
+    // Front and back faces share the stencil state.
+    vk::StencilOp stencil_fail{vk::StencilOp::eKeep};
+    vk::StencilOp stencil_pass{vk::StencilOp::eKeep};
+    vk::StencilOp stencil_depth_fail{vk::StencilOp::eKeep};
+    vk::CompareOp stencil_compare{vk::CompareOp::eAlways};
+    std::array<BlendMode, max_color_attachments> blend_modes{};
+    uint8_t color_attachment_count{};
+    uint8_t sample_count{1};
+    uint8_t cull_mode{static_cast<uint8_t>(VK_CULL_MODE_BACK_BIT)};
+    uint8_t front_face{static_cast<uint8_t>(VK_FRONT_FACE_COUNTER_CLOCKWISE)};
+    uint8_t depth_test{};
+    uint8_t depth_write{};
+    uint8_t stencil_test{};
+    uint8_t stencil_compare_mask{0xff};
+    uint8_t stencil_write_mask{0xff};
+    uint8_t stencil_reference{};
+    std::array<uint8_t, 2> padding{};
+
+    [[nodiscard]] std::string_view get_bytes() const {
+        return {reinterpret_cast<const char *>(this), sizeof(*this)};
+    }
+
+    bool operator==(const PipelineStateKey &other) const {
+        return get_bytes() == other.get_bytes();
+    }
+};
+
+static_assert(std::has_unique_object_representations_v<PipelineStateKey>, "PipelineStateKey must not have padding");
+
+template<>
+struct std::hash<PipelineStateKey> {
+    size_t operator()(const PipelineStateKey &key) const noexcept {
+        return std::hash<std::string_view>{}(key.get_bytes());
+    }
+};
+
+// Resets whatever the device can set dynamically to a canonical value, so states that only differ there share one
+// pipeline. apply_dynamic_state has to set the original values when drawing with it.
+[[nodiscard]] PipelineStateKey get_pipeline_key(const PipelineStateKey &state, const DeviceFeatures &features);
+
+void apply_dynamic_state(const vk::raii::CommandBuffer &command_buffer, const PipelineStateKey &state,
+                         const DeviceFeatures &features);
+
+struct VertexLayout {
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+
+    bool operator==(const VertexLayout &) const = default;
+};
+
+// Gives every distinct vertex layout a small id, zero means no vertex buffers.
+class VertexLayoutRegistry : Noncopyable {
+    mutable std::mutex mutex;
+    std::vector<VertexLayout> layouts;
+
+public:
+    [[nodiscard]] uint32_t get_id(VertexLayout layout);
+
+    [[nodiscard]] VertexLayout get(uint32_t id) const;
+};
+
+// Gives every distinct set of specialization constant values a small id, zero means no specialization.
+class SpecializationRegistry : Noncopyable {
+    struct Values {
+        std::vector<vk::SpecializationMapEntry> entries;
+        std::vector<std::byte> data;
+
+        bool operator==(const Values &) const = default;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Values> values;
+
+public:
+    [[nodiscard]] uint32_t get_id(std::span<const vk::SpecializationMapEntry> entries, std::span<const std::byte> data);
+
+    // Several configs make up one set of constants, like a kernel's variant and its tuned WorkgroupConfig. Their
+    // constant ids must not overlap.
+    template<SpecializedConfig... Configs>
+    [[nodiscard]] uint32_t get_id(const Configs &...configs) {
+        std::vector<vk::SpecializationMapEntry> entries;
+        std::vector<std::byte> data;
+        const auto append = [&]<typename Config>(const Config &config) {
+            const Specialization<Config> specialization{config};
+            for (auto entry: specialization.get_entries()) {
+                entry.offset += static_cast<uint32_t>(data.size());
+                entries.emplace_back(entry);
+            }
+            data.insert(data.end(), specialization.get_data().begin(), specialization.get_data().end());
+        };
+        (append(configs), ...);
+        return get_id(std::span<const vk::SpecializationMapEntry>{entries}, std::span<const std::byte>{data});
+    }
+
+    // Copies the values out so pipeline creation can point at them without holding the lock.
+    [[nodiscard]] std::pair<std::vector<vk::SpecializationMapEntry>, std::vector<std::byte>> get(uint32_t id) const;
+};
+
+struct PipelineCacheStats {
+    uint64_t requests{};
+    uint64_t hits{};
+    // Requests that found the pipeline still compiling on another thread and waited for it instead.
+    uint64_t coalesced{};
+    uint64_t creations{};
+    // Distinct states asked for against pipelines actually existing, the gap is what dynamic state saved.
+    size_t state_count{};
+    size_t pipeline_count{};
+};
+
+class PipelineManifest;
+
+// Looks pipelines up by their state key in O(1) from any thread. Identical requests racing each other compile once,
+// latecomers wait for the compile already in flight.
+class PipelineStateCache : Noncopyable {
+    struct Entry {
+        std::promise<vk::Pipeline> promise;
+        std::shared_future<vk::Pipeline> ready{promise.get_future().share()};
+        // Whoever sets this compiles, a blocking request can take over a compile still queued on the workers.
+        std::atomic_flag claimed;
+        std::optional<vk::raii::Pipeline> pipeline;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<PipelineStateKey, std::shared_ptr<Entry>> entries;
+        std::unordered_set<PipelineStateKey> requested_states;
+    };
+
+    static constexpr size_t shard_count{32};
+
+    const vk::raii::Device &device;
+    const ShaderRegistry &shaders;
+    PipelineLayoutCache &layouts;
+    const VertexLayoutRegistry &vertex_layouts;
+    const SpecializationRegistry &specializations;
+    const DeviceFeatures &features;
+    const vk::raii::PipelineCache driver_cache;
+    std::array<Shard, shard_count> shards;
+    std::atomic<PipelineManifest *> manifest{nullptr};
+
+    std::atomic<uint64_t> request_count{0};
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> coalesced_count{0};
+    std::atomic<uint64_t> creation_count{0};
+
+    struct Lookup {
+        std::shared_ptr<Entry> entry;
+        bool inserted;
+    };
+
+    // Failed compiles leave the map before their future becomes ready, so a ready entry always has its pipeline.
+    [[nodiscard]] static bool is_ready(const Entry &entry) {
+        return entry.ready.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+    }
+
+    [[nodiscard]] Shard &get_shard(const PipelineStateKey &key) {
+        return shards[std::hash<PipelineStateKey>{}(key) % shard_count];
+    }
+
+    // Warm-up lookups aren't requests, they neither count in the stats nor end up in the manifest.
+    [[nodiscard]] Lookup find_or_insert(const PipelineStateKey &state, bool is_request);
+
+    // Does nothing when somebody else already claimed the entry.
+    void compile(const PipelineStateKey &key, Entry &entry);
+
+    void compile_async(const PipelineStateKey &state, const Lookup &lookup, JobSystem &jobs);
+
+    [[nodiscard]] vk::raii::Pipeline create(const PipelineStateKey &key,
+                                            ShaderVersion version = ShaderVersion::Live) const;
+
+public:
+    PipelineStateCache(const vk::raii::Device &device, const ShaderRegistry &shaders, PipelineLayoutCache &layouts,
+                       const VertexLayoutRegistry &vertex_layouts, const SpecializationRegistry &specializations,
+                       const DeviceFeatures &features);
+
+    // Compiles on the calling thread when nobody else does, the future is ready once the pipeline exists. Takes the
+    // full state, the dynamic parts are stripped from the key here.
+    [[nodiscard]] std::shared_future<vk::Pipeline> request(const PipelineStateKey &state);
+
+    [[nodiscard]] vk::Pipeline get(const PipelineStateKey &state) {
+        return request(state).get();
+    }
+
+    // Same as request but compiles on a job worker, the calling thread never blocks.
+    [[nodiscard]] std::shared_future<vk::Pipeline> request_async(const PipelineStateKey &state, JobSystem &jobs);
+
+    // Queues the states on the workers in the given order, so the most important ones should come first.
+    std::vector<std::shared_future<vk::Pipeline>> warm_up(std::span<const PipelineStateKey> states, JobSystem &jobs);
+
+    // Compiles the state without keeping it, for throwaway pipelines such as benchmark candidates. The driver cache
+    // still sees it, so requesting the same state later is cheap.
+    [[nodiscard]] vk::raii::Pipeline create_detached(const PipelineStateKey &state) const;
+
+    // Every state requested for the first time from now on is recorded in the manifest, which has to outlive the
+    // cache or be detached with nullptr.
+    void record_usage(PipelineManifest *target) {
+        manifest.store(target);
+    }
+
+    [[nodiscard]] vk::PipelineLayout get_layout(const PipelineStateKey &key,
+                                                ShaderVersion version = ShaderVersion::Live) const;
+
+    // Every finished pipeline with its key.
+    [[nodiscard]] std::vector<std::pair<PipelineStateKey, vk::Pipeline>> get_pipelines();
+
+    // Keys of the finished pipelines using the shader.
+    [[nodiscard]] std::vector<PipelineStateKey> get_keys_using(ShaderId shader);
+
+    // Compiles every finished pipeline using the shader again from the staged shaders, without touching the cache.
+    // Throws when one of them fails, the live pipelines stay as they are then.
+    [[nodiscard]] std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> rebuild(ShaderId shader);
+
+    // Swaps rebuilt pipelines in, the old ones come back for deferred deletion.
+    [[nodiscard]] std::vector<vk::raii::Pipeline> replace(
+            std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> rebuilt);
+
+    [[nodiscard]] PipelineCacheStats get_stats();
+
+    void log_stats();
+};
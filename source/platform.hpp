@@ -0,0 +1,19 @@
+#pragma once
+
+#include <SDL.h>
+#include <SDL_vulkan.h>
+#include <SDL_syswm.h>
+
+#ifdef SDL_ENABLE_SYSWM_WINDOWS
+#define VK_USE_PLATFORM_WIN32_KHR
+#endif
+#ifdef SDL_ENABLE_SYSWM_WAYLAND
+#define VK_USE_PLATFORM_WAYLAND_KHR
+#endif
+#ifdef SDL_ENABLE_SYSWM_X11
+#define VK_USE_PLATFORM_XLIB_KHR
+#endif
+#define VULKAN_HPP_ENABLE_DYNAMIC_LOADER_TOOL 0
+#define VULKAN_HPP_NO_DEFAULT_DISPATCHER
+
+#include <vulkan/vulkan_raii.hpp>
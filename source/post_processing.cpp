@@ -0,0 +1,197 @@
+#include "post_processing.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <ranges>
+#include <stdexcept>
+
+#include "gpu_helpers.hpp"
+
+namespace {
+    // Canonical order of the fused effects, shaders/post_effects.glsl applies them from the lowest bit up.
+    constexpr uint32_t tonemap_bit{1};
+    constexpr uint32_t color_grade_bit{2};
+    constexpr uint32_t vignette_bit{4};
+    constexpr uint32_t dither_bit{8};
+
+    constexpr vk::ImageSubresourceRange color_range{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+    // Enough range for HDR input ahead of the tonemap, and storable everywhere. The shaders declare it as rgba16f.
+    constexpr vk::Format intermediate_format{vk::Format::eR16G16B16A16Sfloat};
+
+    std::optional<uint32_t> get_effect_bit(const PostEffect effect) {
+        switch (effect) {
+            case PostEffect::Tonemap:
+                return tonemap_bit;
+            case PostEffect::ColorGrade:
+                return color_grade_bit;
+            case PostEffect::Vignette:
+                return vignette_bit;
+            case PostEffect::Dither:
+                return dither_bit;
+            case PostEffect::Blur:
+            case PostEffect::BloomDownsample:
+                return std::nullopt;
+        }
+        std::unreachable();
+    }
+
+    constexpr std::array descriptor_fields{
+            DescriptorField{0, vk::DescriptorType::eCombinedImageSampler, 1, 0, sizeof(vk::DescriptorImageInfo)},
+            DescriptorField{1, vk::DescriptorType::eStorageImage, 1, sizeof(vk::DescriptorImageInfo),
+                            sizeof(vk::DescriptorImageInfo)},
+    };
+}
+
+std::vector<PostPass> plan_post_passes(const std::span<const PostEffect> effects) {
+    std::vector<PostPass> passes;
+    for (const auto effect: effects) {
+        if (const auto bit = get_effect_bit(effect)) {
+            // Joins the previous pass unless that one already applies an effect meant to come after it.
+            if (!passes.empty() && passes.back().effects < *bit)
+                passes.back().effects |= *bit;
+            else
+                passes.push_back({PostPassKind::Fused, *bit});
+            continue;
+        }
+        passes.push_back({effect == PostEffect::Blur ? PostPassKind::Blur : PostPassKind::Downsample, 0});
+    }
+    const auto downsamples = std::ranges::count(passes, PostPassKind::Downsample, &PostPass::kind);
+    if (passes.empty() || (downsamples && passes.back().kind != PostPassKind::Fused))
+        passes.push_back({PostPassKind::Fused, 0});
+    return passes;
+}
+
+PostProcessor::PostProcessor(const vk::raii::PhysicalDevice &physical_device, const vk::raii::Device &device,
+                             const ShaderRegistry &shader_registry, PipelineStateCache &pipelines,
+                             PipelineLayoutCache &layouts, SpecializationRegistry &specializations,
+                             DeviceAllocator &allocator,
+                             DeferredDeletionQueue &deferred_deletion_queue, const PostProcessShaders &shaders,
+                             const WorkgroupConfig &fused_workgroup, const std::span<const PostEffect> effects)
+        : device{device}, pipelines{pipelines}, allocator{allocator},
+          deferred_deletion_queue{deferred_deletion_queue}, shaders{shaders}, fused_workgroup{fused_workgroup},
+          passes{plan_post_passes(effects)},
+          sampler{device, vk::SamplerCreateInfo{{}, vk::Filter::eLinear, vk::Filter::eLinear,
+                                                vk::SamplerMipmapMode::eNearest, vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge,
+                                                vk::SamplerAddressMode::eClampToEdge}},
+          pipeline_layout{get_reflected_layout(shader_registry, layouts, shaders.fused).pipeline_layout},
+          descriptor_set{device, descriptor_fields,
+                         get_reflected_layout(shader_registry, layouts, shaders.fused).set_layouts.at(0),
+                         pipeline_layout, vk::PipelineBindPoint::eCompute, 0, false} {
+    static_assert(offsetof(Bindings, destination) == sizeof(vk::DescriptorImageInfo));
+    if (!physical_device.getFeatures().shaderStorageImageWriteWithoutFormat)
+        throw std::runtime_error{"Post-processing needs shaderStorageImageWriteWithoutFormat"};
+    for (const auto &[index, pass]: std::views::enumerate(passes)) {
+        const auto is_last = static_cast<size_t>(index) == passes.size() - 1;
+        auto &pass_keys = keys.emplace_back();
+        for (const auto encode_srgb: {false, true}) {
+            auto &key = pass_keys[encode_srgb];
+            key.compute_shader = get_shader(pass.kind, is_last);
+            const PostProcessVariant variant{pass.effects, encode_srgb};
+            key.specialization = pass.kind == PostPassKind::Fused ? specializations.get_id(variant, fused_workgroup)
+                                                                  : specializations.get_id(variant);
+        }
+    }
+}
+
+PostProcessor::~PostProcessor() {
+    release_intermediates();
+}
+
+ShaderId PostProcessor::get_shader(const PostPassKind kind, const bool is_last) const {
+    switch (kind) {
+        case PostPassKind::Fused:
+            return is_last ? shaders.fused_output : shaders.fused;
+        case PostPassKind::Blur:
+            return is_last ? shaders.blur_output : shaders.blur;
+        case PostPassKind::Downsample:
+            return shaders.downsample;
+    }
+    std::unreachable();
+}
+
+vk::Extent2D PostProcessor::get_group_size(const PostPassKind kind) const {
+    switch (kind) {
+        case PostPassKind::Fused:
+            return {fused_workgroup.size_x, fused_workgroup.size_y};
+        case PostPassKind::Blur:
+            return {16, 16};
+        case PostPassKind::Downsample:
+            return {8, 8};
+    }
+    std::unreachable();
+}
+
+void PostProcessor::create_intermediates(vk::Extent2D extent) {
+    for (const auto &pass: passes | std::views::take(passes.size() - 1)) {
+        if (pass.kind == PostPassKind::Downsample)
+            extent = vk::Extent2D{std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+        const auto image = allocator.create_image(
+                vk::ImageCreateInfo{{}, vk::ImageType::e2D, intermediate_format, vk::Extent3D{extent, 1}, 1, 1,
+                                    vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+                                    vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled},
+                MemoryUsage::DeviceLocal);
+        intermediates.push_back({image, vk::raii::ImageView{device, vk::ImageViewCreateInfo{
+                {}, allocator.get_image(image), vk::ImageViewType::e2D, intermediate_format, {}, color_range}},
+                                 extent});
+    }
+}
+
+void PostProcessor::release_intermediates() {
+    for (auto &intermediate: intermediates) {
+        deferred_deletion_queue.retire(std::move(intermediate.view));
+        allocator.destroy(intermediate.image);
+    }
+    intermediates.clear();
+}
+
+void PostProcessor::handle_move(const AllocationId id) {
+    // Created again at the next record.
+    if (std::ranges::contains(intermediates, id, &Intermediate::image))
+        release_intermediates();
+}
+
+void PostProcessor::record(const vk::raii::CommandBuffer &command_buffer,
+                           TransientDescriptorAllocator &descriptor_allocator, const vk::ImageView input,
+                           const vk::Image output, const vk::ImageView output_view, const vk::Extent2D extent,
+                           const bool encode_srgb, const vk::ImageLayout final_layout,
+                           const PostProcessParameters &parameters) {
+    // Intermediates follow the output size, the first one has it unless the chain starts by downsampling.
+    const auto first_extent = passes.front().kind == PostPassKind::Downsample
+                              ? vk::Extent2D{std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)}
+                              : extent;
+    if (intermediates.size() != passes.size() - 1 ||
+        (!intermediates.empty() && intermediates.front().extent != first_extent)) {
+        release_intermediates();
+        create_intermediates(extent);
+    }
+
+    for (const auto &[index, pass]: std::views::enumerate(passes)) {
+        const auto is_last = static_cast<size_t>(index) == passes.size() - 1;
+        const auto source = index == 0 ? input : *intermediates[index - 1].view;
+        const auto destination = is_last ? output_view : *intermediates[index].view;
+        const auto destination_extent = is_last ? extent : intermediates[index].extent;
+
+        std::vector barriers{get_image_barrier(is_last ? output : allocator.get_image(intermediates[index].image),
+                                               vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, color_range)};
+        if (index > 0)
+            barriers.emplace_back(get_image_barrier(allocator.get_image(intermediates[index - 1].image),
+                                                    vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                    color_range));
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barriers});
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    pipelines.get(keys[index][is_last && encode_srgb]));
+        descriptor_set.bind(command_buffer, Bindings{{*sampler, source, vk::ImageLayout::eShaderReadOnlyOptimal},
+                                                     {{}, destination, vk::ImageLayout::eGeneral}},
+                            descriptor_allocator);
+        command_buffer.pushConstants<PostProcessParameters>(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                                            parameters);
+        const auto group_size = get_group_size(pass.kind);
+        command_buffer.dispatch((destination_extent.width + group_size.width - 1) / group_size.width,
+                                (destination_extent.height + group_size.height - 1) / group_size.height, 1);
+    }
+
+    const auto final_barrier = get_image_barrier(output, vk::ImageLayout::eGeneral, final_layout, color_range);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, final_barrier});
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "descriptors.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+#include "specialization.hpp"
+#include "workgroup_tuner.hpp"
+
+enum class PostEffect {
+    // Per pixel, fused into the pass before them.
+    Tonemap,
+    ColorGrade,
+    Vignette,
+    Dither,
+    // Neighbourhood effects, each a pass of its own reading shared memory tiles.
+    Blur,
+    BloomDownsample,
+};
+
+struct PostProcessVariant {
+    // Bits of the per pixel effects in shaders/post_effects.glsl.
+    uint32_t effects{};
+    bool encode_srgb{};
+
+    bool operator==(const PostProcessVariant &) const = default;
+};
+
+template<>
+struct SpecializationTraits<PostProcessVariant> {
+    using Map = SpecializationMap<SpecializationMember<0, &PostProcessVariant::effects>,
+                                  SpecializationMember<1, &PostProcessVariant::encode_srgb>>;
+};
+
+// Push constants of every post-processing shader, laid out like the block in shaders/post_effects.glsl.
+struct PostProcessParameters {
+    std::array<float, 3> lift{};
+    float exposure{1.0f};
+    std::array<float, 3> gamma{1.0f, 1.0f, 1.0f};
+    float vignette{0.25f};
+    std::array<float, 3> gain{1.0f, 1.0f, 1.0f};
+    uint32_t frame{};
+};
+
+static_assert(sizeof(PostProcessParameters) == 48);
+
+// The output variants write the last pass into the output image, the others into the rgba16f intermediates.
+// Downsampling never comes last.
+struct PostProcessShaders {
+    ShaderId fused{};
+    ShaderId fused_output{};
+    ShaderId blur{};
+    ShaderId blur_output{};
+    ShaderId downsample{};
+};
+
+enum class PostPassKind {
+    Fused,
+    Blur,
+    Downsample,
+};
+
+struct PostPass {
+    PostPassKind kind;
+    // Per pixel effects the pass applies after its own work, as PostProcessVariant::effects.
+    uint32_t effects;
+};
+
+// Groups the effects into as few passes as possible: per pixel effects ride along with the pass before them as long as
+// the fused order matches theirs, so each of them no longer costs a full read and write of the frame. A chain that
+// downsamples ends with a fused pass, which scales back to the output size.
+[[nodiscard]] std::vector<PostPass> plan_post_passes(std::span<const PostEffect> effects);
+
+// Runs a post-processing chain with compute and writes the result straight into the output image, usually the
+// swapchain image through a storage view. Intermediate images only exist between neighbourhood passes.
+class PostProcessor : Noncopyable {
+    struct Bindings {
+        vk::DescriptorImageInfo source;
+        vk::DescriptorImageInfo destination;
+    };
+
+    struct Intermediate {
+        AllocationId image{};
+        vk::raii::ImageView view;
+        vk::Extent2D extent;
+    };
+
+    const vk::raii::Device &device;
+    PipelineStateCache &pipelines;
+    DeviceAllocator &allocator;
+    DeferredDeletionQueue &deferred_deletion_queue;
+    const PostProcessShaders shaders;
+    const WorkgroupConfig fused_workgroup;
+    const std::vector<PostPass> passes;
+    const vk::raii::Sampler sampler;
+    const vk::PipelineLayout pipeline_layout;
+    const PackedDescriptorSet<Bindings> descriptor_set;
+    // Pipeline keys per pass, with and without the sRGB encode the last pass needs for UNORM views of sRGB images.
+    std::vector<std::array<PipelineStateKey, 2>> keys;
+    std::vector<Intermediate> intermediates;
+
+    [[nodiscard]] ShaderId get_shader(PostPassKind kind, bool is_last) const;
+
+    [[nodiscard]] vk::Extent2D get_group_size(PostPassKind kind) const;
+
+    // The output extent of every pass but the last, which writes the output image.
+    void create_intermediates(vk::Extent2D extent);
+
+    void release_intermediates();
+
+public:
+    // The fused passes run with fused_workgroup, which WorkgroupTuner picks for the fused shader over a frame sized
+    // problem. The neighbourhood passes keep the fixed sizes their shared memory tiles are laid out for. Throws where
+    // the device can't store to images without a format, as the output variants do.
+    PostProcessor(const vk::raii::PhysicalDevice &physical_device, const vk::raii::Device &device,
+                  const ShaderRegistry &shader_registry, PipelineStateCache &pipelines, PipelineLayoutCache &layouts,
+                  SpecializationRegistry &specializations, DeviceAllocator &allocator,
+                  DeferredDeletionQueue &deferred_deletion_queue, const PostProcessShaders &shaders,
+                  const WorkgroupConfig &fused_workgroup, std::span<const PostEffect> effects);
+
+    ~PostProcessor();
+
+    // The input is sampled in shader read only layout at the extent of the output. The output starts undefined and
+    // ends in final_layout, its view has to allow storage, encode_srgb when it's a UNORM view of sRGB content.
+    void record(const vk::raii::CommandBuffer &command_buffer, TransientDescriptorAllocator &descriptor_allocator,
+                vk::ImageView input, vk::Image output, vk::ImageView output_view, vk::Extent2D extent,
+                bool encode_srgb, vk::ImageLayout final_layout, const PostProcessParameters &parameters);
+
+    // For the allocator's move callback, defragmentation gives intermediate images new handles.
+    void handle_move(AllocationId id);
+
+    [[nodiscard]] std::span<const PostPass> get_passes() const {
+        return passes;
+    }
+};
@@ -0,0 +1,98 @@
+#include "queues.hpp"
+
+#include <algorithm>
+
+#include "config.hpp"
+
+namespace {
+    std::optional<std::optional<vk::QueueGlobalPriorityKHR>> parse_global_priority(
+            const std::optional<std::string_view> name) {
+        if (name == "off")
+            return std::optional<vk::QueueGlobalPriorityKHR>{};
+        if (name == "low")
+            return vk::QueueGlobalPriorityKHR::eLow;
+        if (name == "medium")
+            return vk::QueueGlobalPriorityKHR::eMedium;
+        if (name == "high")
+            return vk::QueueGlobalPriorityKHR::eHigh;
+        if (name == "realtime")
+            return vk::QueueGlobalPriorityKHR::eRealtime;
+        return std::nullopt;
+    }
+}
+
+QueuePriorityConfig QueuePriorityConfig::from_environment() {
+    QueuePriorityConfig config{};
+    config.frame_priority = std::clamp(get_config("APP_FRAME_QUEUE_PRIORITY", config.frame_priority), 0.0f, 1.0f);
+    config.async_compute_priority = std::clamp(
+            get_config("APP_ASYNC_COMPUTE_QUEUE_PRIORITY", config.async_compute_priority), 0.0f, 1.0f);
+    config.streaming_priority = std::clamp(get_config("APP_STREAMING_QUEUE_PRIORITY", config.streaming_priority),
+                                           0.0f, 1.0f);
+    config.frame_global_priority = parse_global_priority(
+            get_config<std::string_view>("APP_FRAME_QUEUE_GLOBAL_PRIORITY")).value_or(config.frame_global_priority);
+    return config;
+}
+
+QueuePlan QueuePlan::create(const vk::raii::PhysicalDevice &physical_device, const uint32_t graphics_family_index,
+                            const QueuePriorityConfig &config, const bool supports_global_priority) {
+    const auto family_properties = physical_device.getQueueFamilyProperties();
+    const auto queue_count = family_properties[graphics_family_index].queueCount;
+
+    QueuePlan plan{};
+    auto &family = plan.families.emplace_back(graphics_family_index);
+    const auto add_queue = [&](const QueueRole role, const float priority) {
+        // Once the family runs out of queues the role shares the last one, which keeps the higher priority.
+        if (family.priorities.size() < queue_count)
+            family.priorities.emplace_back(priority);
+        plan.locations[static_cast<size_t>(role)] = {graphics_family_index,
+                                                     static_cast<uint32_t>(family.priorities.size() - 1)};
+    };
+    add_queue(QueueRole::Frame, config.frame_priority);
+    // Compute only families usually map to separate hardware queues, the best place for async compute to overlap.
+    const auto compute_family = std::ranges::find_if(family_properties, [](const vk::QueueFamilyProperties &properties) {
+        return (properties.queueFlags & vk::QueueFlagBits::eCompute) &&
+               !(properties.queueFlags & vk::QueueFlagBits::eGraphics);
+    });
+    // With only two queues async compute rides along the frame queue, streaming is what must get out of the way.
+    if (compute_family == family_properties.end() && queue_count > 2)
+        add_queue(QueueRole::AsyncCompute, config.async_compute_priority);
+    else if (compute_family == family_properties.end())
+        plan.locations[static_cast<size_t>(QueueRole::AsyncCompute)] = plan.get_location(QueueRole::Frame);
+    add_queue(QueueRole::Streaming, config.streaming_priority);
+
+    if (supports_global_priority && config.frame_global_priority)
+        family.global_priority = vk::DeviceQueueGlobalPriorityCreateInfoKHR{*config.frame_global_priority};
+
+    if (compute_family != family_properties.end()) {
+        const auto compute_family_index = static_cast<uint32_t>(compute_family - family_properties.begin());
+        plan.families.emplace_back(compute_family_index, std::vector{config.async_compute_priority});
+        plan.locations[static_cast<size_t>(QueueRole::AsyncCompute)] = {compute_family_index, 0};
+    }
+    return plan;
+}
+
+std::vector<vk::DeviceQueueCreateInfo> QueuePlan::get_create_infos() const {
+    std::vector<vk::DeviceQueueCreateInfo> create_infos;
+    for (const auto &family: families) {
+        auto &create_info = create_infos.emplace_back();
+        create_info.queueFamilyIndex = family.index;
+        create_info.setQueuePriorities(family.priorities);
+        if (family.global_priority)
+            create_info.pNext = &*family.global_priority;
+    }
+    return create_infos;
+}
+
+bool QueuePlan::has_dedicated_queue(const QueueRole role) const {
+    const auto location = get_location(role);
+    return std::ranges::count(locations, location) == 1;
+}
+
+bool QueuePlan::uses_global_priority() const {
+    return std::ranges::any_of(families, [](const Family &family) { return family.global_priority.has_value(); });
+}
+
+void QueuePlan::drop_global_priority() {
+    for (auto &family: families)
+        family.global_priority.reset();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "platform.hpp"
+
+enum class QueueRole {
+    Frame,
+    AsyncCompute,
+    Streaming,
+};
+
+struct QueuePriorityConfig {
+    float frame_priority{1.0f};
+    float async_compute_priority{0.5f};
+    float streaming_priority{0.0f};
+    // Applies to the whole family the frame queue lives in, since Vulkan sets it per queue create info.
+    std::optional<vk::QueueGlobalPriorityKHR> frame_global_priority{vk::QueueGlobalPriorityKHR::eHigh};
+
+    // APP_{FRAME,ASYNC_COMPUTE,STREAMING}_QUEUE_PRIORITY in [0, 1] and
+    // APP_FRAME_QUEUE_GLOBAL_PRIORITY (off|low|medium|high|realtime).
+    [[nodiscard]] static QueuePriorityConfig from_environment();
+};
+
+struct QueueLocation {
+    uint32_t family_index;
+    uint32_t queue_index;
+
+    bool operator==(const QueueLocation &) const = default;
+};
+
+// Decides how many queues to create per family and which role uses which of them, so background streaming no longer
+// competes with frame rendering on a single equally prioritized queue.
+class QueuePlan {
+    struct Family {
+        uint32_t index;
+        std::vector<float> priorities;
+        std::optional<vk::DeviceQueueGlobalPriorityCreateInfoKHR> global_priority;
+    };
+
+    std::vector<Family> families;
+    std::array<QueueLocation, 3> locations{};
+
+public:
+    [[nodiscard]] static QueuePlan create(const vk::raii::PhysicalDevice &physical_device,
+                                          uint32_t graphics_family_index, const QueuePriorityConfig &config,
+                                          bool supports_global_priority);
+
+    // The create infos point into the plan, which has to outlive device creation.
+    [[nodiscard]] std::vector<vk::DeviceQueueCreateInfo> get_create_infos() const;
+
+    [[nodiscard]] QueueLocation get_location(QueueRole role) const {
+        return locations[static_cast<size_t>(role)];
+    }
+
+    [[nodiscard]] bool has_dedicated_queue(QueueRole role) const;
+
+    [[nodiscard]] vk::raii::Queue get_queue(const vk::raii::Device &device, QueueRole role) const {
+        const auto [family_index, queue_index] = get_location(role);
+        return vk::raii::Queue{device, family_index, queue_index};
+    }
+
+    [[nodiscard]] bool uses_global_priority() const;
+
+    // Raising the global priority needs privileges on most platforms, device creation retries without it.
+    void drop_global_priority();
+};
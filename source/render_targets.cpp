@@ -0,0 +1,271 @@
+#include "render_targets.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <stdexcept>
+
+namespace {
+    vk::ImageAspectFlags get_aspect(const vk::Format format) {
+        switch (format) {
+            case vk::Format::eD16Unorm:
+            case vk::Format::eX8D24UnormPack32:
+            case vk::Format::eD32Sfloat:
+                return vk::ImageAspectFlagBits::eDepth;
+            case vk::Format::eS8Uint:
+                return vk::ImageAspectFlagBits::eStencil;
+            case vk::Format::eD16UnormS8Uint:
+            case vk::Format::eD24UnormS8Uint:
+            case vk::Format::eD32SfloatS8Uint:
+                return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+            default:
+                return vk::ImageAspectFlagBits::eColor;
+        }
+    }
+
+    bool is_depth_stencil(const vk::Format format) {
+        return !(get_aspect(format) & vk::ImageAspectFlagBits::eColor);
+    }
+
+    vk::ImageLayout get_attachment_layout(const vk::Format format) {
+        return is_depth_stencil(format) ? vk::ImageLayout::eDepthStencilAttachmentOptimal
+                                        : vk::ImageLayout::eColorAttachmentOptimal;
+    }
+
+    const char *to_string(const AttachmentUse use) {
+        if (use.load_op == vk::AttachmentLoadOp::eLoad)
+            return use.store_op == vk::AttachmentStoreOp::eStore ? "load, store" : "load, don't store";
+        if (use.load_op == vk::AttachmentLoadOp::eClear)
+            return use.store_op == vk::AttachmentStoreOp::eStore ? "clear, store" : "clear, don't store";
+        return use.store_op == vk::AttachmentStoreOp::eStore ? "don't load, store" : "don't load, don't store";
+    }
+}
+
+RenderTargetPlan::RenderTargetPlan(std::vector<AttachmentDescription> attachments,
+                                   std::vector<RenderPassDescription> passes)
+        : attachments{std::move(attachments)}, passes{std::move(passes)} {
+    const auto attachment_count = this->attachments.size();
+    // Passes using each attachment in any way, in order.
+    std::vector<std::vector<size_t>> users(attachment_count);
+    std::vector<bool> is_sampled(attachment_count);
+    std::vector<bool> is_resolve_target(attachment_count);
+    image_usage.resize(attachment_count);
+    const auto use = [&](const AttachmentId id, const size_t pass) {
+        if (id >= attachment_count)
+            throw std::invalid_argument{"Render pass " + this->passes[pass].name + " uses an unknown attachment"};
+        if (users[id].empty() || users[id].back() != pass)
+            users[id].emplace_back(pass);
+        image_usage[id] |= is_depth_stencil(this->attachments[id].format)
+                           ? vk::ImageUsageFlagBits::eDepthStencilAttachment
+                           : vk::ImageUsageFlagBits::eColorAttachment;
+    };
+    for (const auto &[pass_index, pass]: std::views::enumerate(this->passes)) {
+        const auto index = static_cast<size_t>(pass_index);
+        if (pass.color_resolve.size() > pass.color.size())
+            throw std::invalid_argument{"Render pass " + pass.name + " resolves more attachments than it has"};
+        for (const auto id: pass.color)
+            use(id, index);
+        if (pass.depth)
+            use(*pass.depth, index);
+        for (const auto &resolve: pass.color_resolve) {
+            if (resolve) {
+                use(*resolve, index);
+                is_resolve_target[*resolve] = true;
+            }
+        }
+        if (pass.depth_resolve) {
+            use(*pass.depth_resolve, index);
+            is_resolve_target[*pass.depth_resolve] = true;
+        }
+        for (const auto id: pass.sampled) {
+            if (id >= attachment_count)
+                throw std::invalid_argument{"Render pass " + pass.name + " samples an unknown attachment"};
+            // Sampling what the pass renders to is a feedback loop.
+            if (!users[id].empty() && users[id].back() == index)
+                throw std::invalid_argument{"Render pass " + pass.name + " samples its own attachment"};
+            users[id].emplace_back(index);
+            is_sampled[id] = true;
+            image_usage[id] |= vk::ImageUsageFlagBits::eSampled;
+        }
+    }
+
+    const auto get_use = [&](const AttachmentId id, const size_t pass) {
+        const auto &attachment = this->attachments[id];
+        AttachmentUse use{vk::AttachmentLoadOp::eLoad, vk::AttachmentStoreOp::eDontCare};
+        if (users[id].front() == pass && !attachment.is_persistent)
+            use.load_op = attachment.clear ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eDontCare;
+        else if (users[id].front() == pass && attachment.clear)
+            use.load_op = vk::AttachmentLoadOp::eClear;
+        if (attachment.is_persistent || attachment.is_external || users[id].back() != pass)
+            use.store_op = vk::AttachmentStoreOp::eStore;
+        return use;
+    };
+    for (const auto &[pass_index, pass]: std::views::enumerate(this->passes)) {
+        auto &pass_uses = uses.emplace_back();
+        for (const auto id: pass.color)
+            pass_uses.emplace_back(get_use(id, static_cast<size_t>(pass_index)));
+        pass_uses.emplace_back(pass.depth ? get_use(*pass.depth, static_cast<size_t>(pass_index))
+                                          : AttachmentUse{vk::AttachmentLoadOp::eDontCare,
+                                                          vk::AttachmentStoreOp::eDontCare});
+    }
+
+    transient.resize(attachment_count);
+    for (AttachmentId id{}; id < attachment_count; ++id) {
+        if (users[id].empty())
+            throw std::invalid_argument{"Attachment " + this->attachments[id].name + " isn't used by any pass"};
+        const auto &attachment = this->attachments[id];
+        transient[id] = !attachment.is_persistent && !attachment.is_external && users[id].size() == 1 &&
+                        !is_sampled[id] && !is_resolve_target[id];
+        if (transient[id])
+            image_usage[id] |= vk::ImageUsageFlagBits::eTransientAttachment;
+    }
+}
+
+void RenderTargetPlan::log() const {
+    for (const auto &[id, attachment]: std::views::enumerate(attachments))
+        SDL_Log("Attachment %s: %s, %ux%s", attachment.name.c_str(), vk::to_string(attachment.format).c_str(),
+                static_cast<uint32_t>(attachment.samples), transient[id] ? ", transient" : "");
+    for (const auto &[pass_index, pass]: std::views::enumerate(passes)) {
+        for (const auto &[index, id]: std::views::enumerate(pass.color))
+            SDL_Log("Pass %s, color %s: %s", pass.name.c_str(), attachments[id].name.c_str(),
+                    to_string(uses[pass_index][index]));
+        if (pass.depth)
+            SDL_Log("Pass %s, depth %s: %s", pass.name.c_str(), attachments[*pass.depth].name.c_str(),
+                    to_string(uses[pass_index].back()));
+    }
+}
+
+RenderTargets::RenderTargets(const vk::raii::Device &device, DeviceAllocator &allocator,
+                             DeferredDeletionQueue &deferred_deletion_queue, const RenderTargetPlan &plan,
+                             const vk::Extent2D extent)
+        : device{device}, allocator{allocator}, deferred_deletion_queue{deferred_deletion_queue}, plan{plan},
+          extent{extent} {
+    targets.resize(plan.get_attachments().size());
+    for (const auto &[id, attachment]: std::views::enumerate(plan.get_attachments())) {
+        if (attachment.is_external)
+            continue;
+        auto &target = targets[id];
+        target.allocation = allocator.create_image(
+                vk::ImageCreateInfo{{}, vk::ImageType::e2D, attachment.format, vk::Extent3D{extent, 1}, 1, 1,
+                                    attachment.samples, vk::ImageTiling::eOptimal,
+                                    plan.get_image_usage(static_cast<AttachmentId>(id))},
+                plan.is_transient(static_cast<AttachmentId>(id)) ? MemoryUsage::Transient : MemoryUsage::DeviceLocal);
+        create_view(static_cast<AttachmentId>(id));
+    }
+}
+
+RenderTargets::~RenderTargets() {
+    for (auto &target: targets) {
+        if (target.owned_view)
+            deferred_deletion_queue.retire(std::move(*target.owned_view));
+        if (target.allocation)
+            allocator.destroy(target.allocation);
+    }
+}
+
+void RenderTargets::create_view(const AttachmentId id) {
+    auto &target = targets[id];
+    if (target.owned_view)
+        deferred_deletion_queue.retire(std::move(*target.owned_view));
+    const auto format = plan.get_attachments()[id].format;
+    target.image = allocator.get_image(target.allocation);
+    target.owned_view.emplace(device, vk::ImageViewCreateInfo{
+            {}, target.image, vk::ImageViewType::e2D, format, {},
+            vk::ImageSubresourceRange{get_aspect(format), 0, 1, 0, 1}});
+    target.view = **target.owned_view;
+}
+
+void RenderTargets::set_external(const AttachmentId id, const vk::Image image, const vk::ImageView view,
+                                 const vk::ImageLayout layout) {
+    targets[id].image = image;
+    targets[id].view = view;
+    targets[id].layout = layout;
+}
+
+void RenderTargets::transition(std::vector<vk::ImageMemoryBarrier2> &barriers, const AttachmentId id,
+                               const vk::ImageLayout layout) {
+    auto &target = targets[id];
+    // Attachments written by an earlier pass need the barrier even without a layout change.
+    vk::ImageMemoryBarrier2 barrier{};
+    barrier.srcStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+    barrier.srcAccessMask = vk::AccessFlagBits2::eMemoryWrite;
+    barrier.dstStageMask = vk::PipelineStageFlagBits2::eAllCommands;
+    barrier.dstAccessMask = vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite;
+    barrier.oldLayout = target.layout;
+    barrier.newLayout = layout;
+    barrier.image = target.image;
+    barrier.subresourceRange = vk::ImageSubresourceRange{get_aspect(plan.get_attachments()[id].format), 0, 1, 0, 1};
+    barriers.emplace_back(barrier);
+    target.layout = layout;
+}
+
+void RenderTargets::begin_pass(const vk::raii::CommandBuffer &command_buffer, const size_t pass_index) {
+    const auto &pass = plan.get_passes()[pass_index];
+    const auto &attachments = plan.get_attachments();
+
+    std::vector<vk::ImageMemoryBarrier2> barriers;
+    const auto prepare = [&](const AttachmentId id, const AttachmentUse use) {
+        // Contents that aren't loaded may be discarded by the transition.
+        if (use.load_op != vk::AttachmentLoadOp::eLoad)
+            targets[id].layout = vk::ImageLayout::eUndefined;
+        transition(barriers, id, get_attachment_layout(attachments[id].format));
+    };
+    for (const auto &[index, id]: std::views::enumerate(pass.color))
+        prepare(id, plan.get_color_use(pass_index, index));
+    if (pass.depth)
+        prepare(*pass.depth, plan.get_depth_use(pass_index));
+    // Resolves overwrite the whole target.
+    for (const auto &resolve: pass.color_resolve)
+        if (resolve)
+            prepare(*resolve, {vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eStore});
+    if (pass.depth_resolve)
+        prepare(*pass.depth_resolve, {vk::AttachmentLoadOp::eDontCare, vk::AttachmentStoreOp::eStore});
+    for (const auto id: pass.sampled)
+        transition(barriers, id, vk::ImageLayout::eShaderReadOnlyOptimal);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barriers});
+
+    const auto get_info = [&](const AttachmentId id, const AttachmentUse use, const std::optional<AttachmentId> resolve,
+                              const vk::ResolveModeFlagBits resolve_mode) {
+        const auto layout = get_attachment_layout(attachments[id].format);
+        vk::RenderingAttachmentInfo info{targets[id].view, layout};
+        info.loadOp = use.load_op;
+        info.storeOp = use.store_op;
+        if (attachments[id].clear)
+            info.clearValue = *attachments[id].clear;
+        if (resolve) {
+            info.resolveMode = resolve_mode;
+            info.resolveImageView = targets[*resolve].view;
+            info.resolveImageLayout = layout;
+        }
+        return info;
+    };
+    std::vector<vk::RenderingAttachmentInfo> color_infos;
+    for (const auto &[index, id]: std::views::enumerate(pass.color))
+        color_infos.emplace_back(get_info(
+                id, plan.get_color_use(pass_index, index),
+                static_cast<size_t>(index) < pass.color_resolve.size() ? pass.color_resolve[index] : std::nullopt,
+                vk::ResolveModeFlagBits::eAverage));
+    vk::RenderingInfo rendering_info{{}, vk::Rect2D{{}, extent}, 1, 0, color_infos};
+    // Sample zero is the one depth resolve mode every device supports.
+    std::optional<vk::RenderingAttachmentInfo> depth_info;
+    if (pass.depth) {
+        depth_info = get_info(*pass.depth, plan.get_depth_use(pass_index), pass.depth_resolve,
+                              vk::ResolveModeFlagBits::eSampleZero);
+        if (get_aspect(attachments[*pass.depth].format) & vk::ImageAspectFlagBits::eDepth)
+            rendering_info.pDepthAttachment = &*depth_info;
+        if (get_aspect(attachments[*pass.depth].format) & vk::ImageAspectFlagBits::eStencil)
+            rendering_info.pStencilAttachment = &*depth_info;
+    }
+    command_buffer.beginRendering(rendering_info);
+}
+
+void RenderTargets::begin_frame() {
+    for (const auto &[id, attachment]: std::views::enumerate(plan.get_attachments()))
+        if (!attachment.is_persistent && !attachment.is_external)
+            targets[id].layout = vk::ImageLayout::eUndefined;
+}
+
+void RenderTargets::handle_move(const AllocationId id) {
+    for (const auto &[index, target]: std::views::enumerate(targets))
+        if (target.allocation && target.allocation == id)
+            create_view(static_cast<AttachmentId>(index));
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+
+// Index into the attachments of a RenderTargetPlan.
+using AttachmentId = uint32_t;
+
+struct AttachmentDescription {
+    std::string name;
+    vk::Format format;
+    vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
+    // Cleared on the first use of the frame, its content starts out undefined otherwise.
+    std::optional<vk::ClearValue> clear;
+    // Outlives the frame, like the swapchain image or history buffers, so its content is always stored.
+    bool is_persistent{};
+    // Provided every frame through RenderTargets::set_external instead of being created, the swapchain image. Always
+    // stored.
+    bool is_external{};
+};
+
+struct RenderPassDescription {
+    std::string name;
+    std::vector<AttachmentId> color;
+    std::optional<AttachmentId> depth;
+    // Single sample attachments the multisampled color and depth attachments resolve into at the end of the pass,
+    // matched by position with color and last for depth. The resolve happens on tile, so the multisampled data never
+    // has to reach memory.
+    std::vector<std::optional<AttachmentId>> color_resolve;
+    std::optional<AttachmentId> depth_resolve;
+    // Attachments of earlier passes sampled by this one.
+    std::vector<AttachmentId> sampled;
+};
+
+struct AttachmentUse {
+    vk::AttachmentLoadOp load_op;
+    vk::AttachmentStoreOp store_op;
+};
+
+// Infers load and store operations from the order attachments are used in: the first use of a frame clears or
+// doesn't care, only contents a later pass or the next frame reads are stored. Attachments used by a single pass
+// never reach memory and become transient, which tile based GPUs back with lazily allocated memory, if at all.
+class RenderTargetPlan {
+    std::vector<AttachmentDescription> attachments;
+    std::vector<RenderPassDescription> passes;
+    // Per pass, the uses of its color attachments followed by the depth attachment.
+    std::vector<std::vector<AttachmentUse>> uses;
+    std::vector<bool> transient;
+    std::vector<vk::ImageUsageFlags> image_usage;
+
+public:
+    RenderTargetPlan(std::vector<AttachmentDescription> attachments, std::vector<RenderPassDescription> passes);
+
+    [[nodiscard]] std::span<const AttachmentDescription> get_attachments() const {
+        return attachments;
+    }
+
+    [[nodiscard]] std::span<const RenderPassDescription> get_passes() const {
+        return passes;
+    }
+
+    [[nodiscard]] AttachmentUse get_color_use(size_t pass, size_t index) const {
+        return uses[pass][index];
+    }
+
+    [[nodiscard]] AttachmentUse get_depth_use(size_t pass) const {
+        return uses[pass].back();
+    }
+
+    [[nodiscard]] bool is_transient(AttachmentId id) const {
+        return transient[id];
+    }
+
+    [[nodiscard]] vk::ImageUsageFlags get_image_usage(AttachmentId id) const {
+        return image_usage[id];
+    }
+
+    void log() const;
+};
+
+// The images of a plan at one extent, recreated with the swapchain. Records the layout transitions and dynamic
+// rendering of each pass.
+class RenderTargets : Noncopyable {
+    struct Target {
+        AllocationId allocation{};
+        vk::Image image{};
+        vk::ImageView view{};
+        std::optional<vk::raii::ImageView> owned_view;
+        vk::ImageLayout layout{vk::ImageLayout::eUndefined};
+    };
+
+    const vk::raii::Device &device;
+    DeviceAllocator &allocator;
+    DeferredDeletionQueue &deferred_deletion_queue;
+    const RenderTargetPlan &plan;
+    const vk::Extent2D extent;
+    std::vector<Target> targets;
+
+    void create_view(AttachmentId id);
+
+    void transition(std::vector<vk::ImageMemoryBarrier2> &barriers, AttachmentId id, vk::ImageLayout layout);
+
+public:
+    RenderTargets(const vk::raii::Device &device, DeviceAllocator &allocator,
+                  DeferredDeletionQueue &deferred_deletion_queue, const RenderTargetPlan &plan, vk::Extent2D extent);
+
+    ~RenderTargets();
+
+    // For attachments described as external, the image has to be in the given layout at that point of the frame.
+    void set_external(AttachmentId id, vk::Image image, vk::ImageView view, vk::ImageLayout layout);
+
+    // Transitions the pass's attachments and sampled inputs and begins rendering. The caller binds its pipeline and
+    // draws, then calls end_pass.
+    void begin_pass(const vk::raii::CommandBuffer &command_buffer, size_t pass);
+
+    static void end_pass(const vk::raii::CommandBuffer &command_buffer) {
+        command_buffer.endRendering();
+    }
+
+    // Layouts of frame local attachments start undefined again.
+    void begin_frame();
+
+    // For the allocator's move callback, defragmentation gives images new handles.
+    void handle_move(AllocationId id);
+
+    [[nodiscard]] vk::ImageView get_view(AttachmentId id) const {
+        return targets[id].view;
+    }
+
+    [[nodiscard]] vk::Image get_image(AttachmentId id) const {
+        return targets[id].image;
+    }
+
+    [[nodiscard]] vk::Extent2D get_extent() const {
+        return extent;
+    }
+};
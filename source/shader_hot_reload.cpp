@@ -0,0 +1,201 @@
+#include "shader_hot_reload.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <ranges>
+#include <stdexcept>
+#include <system_error>
+
+#include "config.hpp"
+
+namespace {
+    // Editors often write a file several times in a row, changes are collected until it stays quiet this long.
+    constexpr std::chrono::milliseconds settle_time{50};
+    constexpr std::chrono::milliseconds poll_interval{250};
+
+    std::string quote(const std::filesystem::path &path) {
+        return '"' + path.string() + '"';
+    }
+
+    std::vector<uint32_t> read_words(const std::filesystem::path &path) {
+        std::ifstream file{path, std::ios::binary};
+        if (!file)
+            throw std::runtime_error{"Couldn't open " + path.string()};
+        std::vector<uint32_t> words(std::filesystem::file_size(path) / sizeof(uint32_t));
+        file.read(reinterpret_cast<char *>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint32_t)));
+        return words;
+    }
+
+    // Make syntax as glslc -MD writes it, "module.spv: source include...", with spaces in paths escaped. The module
+    // and the source come first.
+    std::vector<std::filesystem::path> read_depfile(const std::filesystem::path &path) {
+        std::ifstream file{path};
+        std::vector<std::filesystem::path> paths;
+        std::string current;
+        const auto finish = [&]() {
+            if (!current.empty())
+                paths.emplace_back(std::move(current));
+            current.clear();
+        };
+        for (char character; file.get(character);) {
+            if (character == '\\') {
+                if (char escaped; file.get(escaped) && escaped != '\n' && escaped != '\r')
+                    current += escaped;
+            } else if (character == ' ' || character == '\t' || character == '\n' || character == '\r')
+                finish();
+            else
+                current += character;
+        }
+        finish();
+        // The target ends with the colon, either on its own token or on the module path.
+        if (!paths.empty() && paths.front().string().ends_with(':'))
+            paths.erase(paths.begin());
+        else if (paths.size() > 1 && paths[1] == ":")
+            paths.erase(paths.begin(), paths.begin() + 2);
+        return paths;
+    }
+
+    bool is_same_file(const std::filesystem::path &left, const std::filesystem::path &right) {
+        std::error_code error;
+        return std::filesystem::equivalent(left, right, error);
+    }
+}
+
+ShaderHotReloadConfig ShaderHotReloadConfig::from_environment() {
+    ShaderHotReloadConfig config{};
+    config.enabled = get_config("APP_SHADER_HOT_RELOAD", config.enabled);
+    // Several directories are separated like PATH entries.
+    if (const auto directories = get_config<std::string_view>("APP_SHADER_SOURCE_DIRS")) {
+#ifdef _WIN32
+        constexpr char separator{';'};
+#else
+        constexpr char separator{':'};
+#endif
+        for (const auto directory: std::views::split(*directories, separator))
+            if (!directory.empty())
+                config.source_directories.emplace_back(std::string_view{directory});
+    }
+    if (const auto compiler = get_config<std::string_view>("APP_GLSLC"))
+        config.compiler = *compiler;
+    return config;
+}
+
+ShaderHotReloader::ShaderHotReloader(ShaderRegistry &shaders, PipelineStateCache &pipelines,
+                                     DeferredDeletionQueue &deletion_queue, const ShaderHotReloadConfig &config)
+        : shaders{shaders}, pipelines{pipelines}, deletion_queue{deletion_queue}, compiler{config.compiler},
+          watcher{config.source_directories},
+          thread{[this](const std::stop_token &stop_token) { run(stop_token); }} {}
+
+void ShaderHotReloader::run(const std::stop_token &stop_token) {
+    while (!stop_token.stop_requested()) {
+        auto changed = watcher.wait(poll_interval);
+        if (changed.empty())
+            continue;
+        for (auto more = watcher.wait(settle_time); !more.empty(); more = watcher.wait(settle_time))
+            for (auto &path: more)
+                if (!std::ranges::contains(changed, path))
+                    changed.emplace_back(std::move(path));
+        for (const auto &[shader, source]: get_affected(changed))
+            reload(shader, source);
+    }
+}
+
+std::vector<std::pair<ShaderId, ShaderHotReloader::ShaderSource>> ShaderHotReloader::get_affected(
+        const std::span<const std::filesystem::path> changed) const {
+    std::vector<std::pair<ShaderId, ShaderSource>> affected;
+    for (const auto shader: shaders.get_ids()) {
+        auto spirv_path{shaders.get_path(shader)};
+        ShaderSource source{};
+        // add_shaders writes the source and the defines of every module into module.spv.source, one per line.
+        if (std::ifstream file{spirv_path.string() + ".source"}) {
+            std::string line;
+            std::getline(file, line);
+            source.path = line;
+            while (std::getline(file, line))
+                if (!line.empty())
+                    source.defines.emplace_back(std::move(line));
+            const auto dependencies = read_depfile(spirv_path.string() + ".d");
+            // The depfile repeats the source before the includes.
+            for (const auto &dependency: dependencies)
+                if (!is_same_file(dependency, source.path))
+                    source.includes.emplace_back(dependency);
+        } else {
+            const auto found = std::ranges::find_if(changed, [&](const std::filesystem::path &path) {
+                return path.filename().string() + ".spv" == spirv_path.filename().string();
+            });
+            if (found == changed.end())
+                continue;
+            source.path = *found;
+        }
+
+        const auto is_affected = std::ranges::any_of(changed, [&](const std::filesystem::path &path) {
+            return is_same_file(path, source.path) ||
+                   std::ranges::any_of(source.includes, [&](const std::filesystem::path &include) {
+                       return is_same_file(path, include);
+                   });
+        });
+        if (is_affected)
+            affected.emplace_back(shader, std::move(source));
+    }
+    return affected;
+}
+
+void ShaderHotReloader::reload(const ShaderId shader, const ShaderSource &source) {
+    // Compiles next to the live module, a failed compile leaves it untouched. The depfile follows the includes, which
+    // the edit may have changed.
+    const auto &spirv_path = shaders.get_path(shader);
+    auto compiled_path{spirv_path};
+    compiled_path += ".reload";
+    auto depfile_path{compiled_path};
+    depfile_path += ".d";
+    auto command = quote(compiler) + " --target-env=vulkan1.3 -O";
+    for (const auto &define: source.defines)
+        command += " -D" + define;
+    command += " -MD -MF " + quote(depfile_path) + " -o " + quote(compiled_path) + " " + quote(source.path);
+    if (std::system(command.c_str()) != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Compiling %s failed, keeping the running version",
+                    spirv_path.filename().string().c_str());
+        return;
+    }
+
+    try {
+        const auto words = read_words(compiled_path);
+        shaders.stage(shader, words);
+        auto rebuilt = pipelines.rebuild(shader);
+        // The next launch starts from the new version too.
+        std::filesystem::rename(compiled_path, spirv_path);
+        std::error_code ignored;
+        std::filesystem::rename(depfile_path, spirv_path.string() + ".d", ignored);
+        const auto reflection = serialize(shaders.get_reflection(shader, ShaderVersion::Staged));
+        std::ofstream{get_reflection_path(spirv_path), std::ios::binary | std::ios::trunc}.write(
+                reinterpret_cast<const char *>(reflection.data()), static_cast<std::streamsize>(reflection.size()));
+
+        const std::scoped_lock lock{mutex};
+        ready.emplace_back(shader, std::move(rebuilt));
+    } catch (const std::exception &error) {
+        shaders.discard_staged(shader);
+        std::error_code ignored;
+        std::filesystem::remove(compiled_path, ignored);
+        std::filesystem::remove(depfile_path, ignored);
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Reloading %s failed, keeping the running version: %s",
+                    spirv_path.filename().string().c_str(), error.what());
+    }
+}
+
+void ShaderHotReloader::apply() {
+    std::vector<Reload> reloads;
+    {
+        const std::scoped_lock lock{mutex};
+        reloads.swap(ready);
+    }
+    for (auto &[shader, rebuilt]: reloads) {
+        const auto pipeline_count = rebuilt.size();
+        if (auto previous = shaders.commit(shader))
+            deletion_queue.retire(std::move(previous));
+        for (auto &pipeline: pipelines.replace(std::move(rebuilt)))
+            deletion_queue.retire(std::move(pipeline));
+        SDL_Log("Reloaded %s with %zu pipelines", shaders.get_path(shader).string().c_str(), pipeline_count);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "file_watcher.hpp"
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "shaders.hpp"
+
+struct ShaderHotReloadConfig {
+    bool enabled{};
+    // Where the GLSL sources and the files they include live. Which modules a source builds comes from the files
+    // add_shaders writes next to them, without those "shader.frag" there replaces the loaded "shader.frag.spv".
+    std::vector<std::filesystem::path> source_directories;
+    std::string compiler{"glslc"};
+
+    [[nodiscard]] static ShaderHotReloadConfig from_environment();
+};
+
+// Development mode: recompiles shaders whose sources change on its own thread, rebuilds the pipelines using them
+// against the new modules and hands both over to the render thread, which swaps them in between frames. A changed
+// source recompiles every module built from it, variants with their defines included, and so does a changed file
+// they include.
+class ShaderHotReloader : Noncopyable {
+    struct Reload {
+        ShaderId shader;
+        std::vector<std::pair<PipelineStateKey, vk::raii::Pipeline>> pipelines;
+    };
+
+    // How a loaded module was compiled.
+    struct ShaderSource {
+        std::filesystem::path path;
+        std::vector<std::string> defines;
+        // The files it includes, as of its last compile.
+        std::vector<std::filesystem::path> includes;
+    };
+
+    ShaderRegistry &shaders;
+    PipelineStateCache &pipelines;
+    DeferredDeletionQueue &deletion_queue;
+    const std::string compiler;
+    FileWatcher watcher;
+
+    std::mutex mutex;
+    std::vector<Reload> ready;
+    std::jthread thread;
+
+    void run(const std::stop_token &stop_token);
+
+    [[nodiscard]] std::vector<std::pair<ShaderId, ShaderSource>> get_affected(
+            std::span<const std::filesystem::path> changed) const;
+
+    void reload(ShaderId shader, const ShaderSource &source);
+
+public:
+    ShaderHotReloader(ShaderRegistry &shaders, PipelineStateCache &pipelines, DeferredDeletionQueue &deletion_queue,
+                      const ShaderHotReloadConfig &config);
+
+    // Call from the render thread between frames.
+    void apply();
+};
@@ -0,0 +1,453 @@
+#include "shader_reflection.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "binary_io.hpp"
+
+namespace {
+    constexpr uint32_t spirv_magic{0x07230203};
+    constexpr uint32_t reflection_magic{0x4c464552}; // "REFL"
+    constexpr uint32_t reflection_version{1};
+
+    // Opcodes, enumerants and decorations from the SPIR-V specification, only the ones reflection needs.
+    enum Op : uint16_t {
+        OpEntryPoint = 15,
+        OpExecutionMode = 16,
+        OpTypeInt = 21,
+        OpTypeFloat = 22,
+        OpTypeVector = 23,
+        OpTypeMatrix = 24,
+        OpTypeImage = 25,
+        OpTypeSampler = 26,
+        OpTypeSampledImage = 27,
+        OpTypeArray = 28,
+        OpTypeRuntimeArray = 29,
+        OpTypeStruct = 30,
+        OpTypePointer = 32,
+        OpConstant = 43,
+        OpVariable = 59,
+        OpDecorate = 71,
+        OpMemberDecorate = 72,
+        OpTypeAccelerationStructureKHR = 5341,
+    };
+
+    enum Decoration : uint32_t {
+        DecorationBlock = 2,
+        DecorationBufferBlock = 3,
+        DecorationArrayStride = 6,
+        DecorationMatrixStride = 7,
+        DecorationBuiltIn = 11,
+        DecorationLocation = 30,
+        DecorationBinding = 33,
+        DecorationDescriptorSet = 34,
+        DecorationOffset = 35,
+    };
+
+    enum StorageClass : uint32_t {
+        StorageClassUniformConstant = 0,
+        StorageClassInput = 1,
+        StorageClassUniform = 2,
+        StorageClassPushConstant = 9,
+        StorageClassStorageBuffer = 12,
+    };
+
+    constexpr uint32_t ExecutionModeLocalSize{17};
+    constexpr uint32_t DimBuffer{5};
+    constexpr uint32_t DimSubpassData{6};
+
+    struct Type {
+        uint16_t opcode{};
+        std::vector<uint32_t> operands;
+    };
+
+    struct Decorations {
+        std::optional<uint32_t> set;
+        std::optional<uint32_t> binding;
+        std::optional<uint32_t> location;
+        std::optional<uint32_t> array_stride;
+        bool is_builtin{};
+        bool is_buffer_block{};
+        std::unordered_map<uint32_t, uint32_t> member_offsets;
+        std::unordered_map<uint32_t, uint32_t> member_matrix_strides;
+    };
+
+    struct Variable {
+        uint32_t type;
+        uint32_t storage_class;
+    };
+
+    class SpirvModule {
+        std::unordered_map<uint32_t, Type> types;
+        std::unordered_map<uint32_t, uint32_t> constants;
+        std::unordered_map<uint32_t, Decorations> decorations;
+        std::unordered_map<uint32_t, Variable> variables;
+
+    public:
+        uint32_t execution_model{};
+        uint32_t entry_point_id{};
+        std::string entry_point;
+        std::array<uint32_t, 3> workgroup_size{};
+
+        explicit SpirvModule(const std::span<const uint32_t> words) {
+            if (words.size() < 5 || words[0] != spirv_magic)
+                throw std::runtime_error{"Not a SPIR-V module"};
+            auto found_entry_point{false};
+            for (size_t offset{5}; offset < words.size();) {
+                const auto opcode = static_cast<uint16_t>(words[offset] & 0xffff);
+                const auto count = words[offset] >> 16;
+                if (count == 0 || offset + count > words.size())
+                    throw std::runtime_error{"Truncated SPIR-V instruction"};
+                const auto operands = words.subspan(offset + 1, count - 1);
+                offset += count;
+
+                switch (opcode) {
+                    case OpEntryPoint:
+                        // Modules with several entry points are reflected for the first one.
+                        if (!found_entry_point) {
+                            found_entry_point = true;
+                            execution_model = operands[0];
+                            entry_point_id = operands[1];
+                            const auto name = reinterpret_cast<const char *>(&operands[2]);
+                            entry_point = std::string{name, strnlen(name, (operands.size() - 2) * 4)};
+                        }
+                        break;
+                    case OpExecutionMode:
+                        if (operands[0] == entry_point_id && operands[1] == ExecutionModeLocalSize)
+                            workgroup_size = {operands[2], operands[3], operands[4]};
+                        break;
+                    case OpTypeInt:
+                    case OpTypeFloat:
+                    case OpTypeVector:
+                    case OpTypeMatrix:
+                    case OpTypeImage:
+                    case OpTypeSampler:
+                    case OpTypeSampledImage:
+                    case OpTypeArray:
+                    case OpTypeRuntimeArray:
+                    case OpTypeStruct:
+                    case OpTypePointer:
+                    case OpTypeAccelerationStructureKHR:
+                        types[operands[0]] = {opcode, {operands.begin() + 1, operands.end()}};
+                        break;
+                    case OpConstant:
+                        constants[operands[1]] = operands[2];
+                        break;
+                    case OpVariable:
+                        variables[operands[1]] = {operands[0], operands[2]};
+                        break;
+                    case OpDecorate: {
+                        auto &target = decorations[operands[0]];
+                        switch (operands[1]) {
+                            case DecorationDescriptorSet:
+                                target.set = operands[2];
+                                break;
+                            case DecorationBinding:
+                                target.binding = operands[2];
+                                break;
+                            case DecorationLocation:
+                                target.location = operands[2];
+                                break;
+                            case DecorationArrayStride:
+                                target.array_stride = operands[2];
+                                break;
+                            case DecorationBuiltIn:
+                                target.is_builtin = true;
+                                break;
+                            case DecorationBufferBlock:
+                                target.is_buffer_block = true;
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+                    }
+                    case OpMemberDecorate: {
+                        auto &target = decorations[operands[0]];
+                        if (operands[2] == DecorationOffset)
+                            target.member_offsets[operands[1]] = operands[3];
+                        else if (operands[2] == DecorationMatrixStride)
+                            target.member_matrix_strides[operands[1]] = operands[3];
+                        else if (operands[2] == DecorationBuiltIn)
+                            target.is_builtin = true;
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            if (!found_entry_point)
+                throw std::runtime_error{"SPIR-V module has no entry point"};
+        }
+
+        [[nodiscard]] const Type &get_type(const uint32_t id) const {
+            if (const auto type = types.find(id); type != types.end())
+                return type->second;
+            throw std::runtime_error{"SPIR-V references an unknown type"};
+        }
+
+        [[nodiscard]] const Decorations *find_decorations(const uint32_t id) const {
+            const auto found = decorations.find(id);
+            return found == decorations.end() ? nullptr : &found->second;
+        }
+
+        [[nodiscard]] const Variable *find_variable(const uint32_t id) const {
+            const auto found = variables.find(id);
+            return found == variables.end() ? nullptr : &found->second;
+        }
+
+        [[nodiscard]] auto get_variables() const -> const auto & {
+            return variables;
+        }
+
+        [[nodiscard]] uint32_t get_constant(const uint32_t id) const {
+            if (const auto constant = constants.find(id); constant != constants.end())
+                return constant->second;
+            throw std::runtime_error{"SPIR-V array length is not a plain constant"};
+        }
+
+        // Size of a type laid out with the explicit offsets and strides SPIR-V requires for interface blocks.
+        [[nodiscard]] uint32_t get_size(const uint32_t id, const std::optional<uint32_t> matrix_stride = {}) const {
+            const auto &[opcode, operands] = get_type(id);
+            switch (opcode) {
+                case OpTypeInt:
+                case OpTypeFloat:
+                    return operands[0] / 8;
+                case OpTypeVector:
+                    return get_size(operands[0]) * operands[1];
+                case OpTypeMatrix:
+                    return matrix_stride.value_or(get_size(operands[0])) * operands[1];
+                case OpTypeArray: {
+                    const auto *const array_decorations = find_decorations(id);
+                    const auto stride = array_decorations && array_decorations->array_stride
+                                        ? *array_decorations->array_stride : get_size(operands[0]);
+                    return stride * get_constant(operands[1]);
+                }
+                case OpTypeStruct: {
+                    const auto *const struct_decorations = find_decorations(id);
+                    uint32_t size{};
+                    for (uint32_t member{}; member < operands.size(); ++member) {
+                        std::optional<uint32_t> offset;
+                        std::optional<uint32_t> member_matrix_stride;
+                        if (struct_decorations) {
+                            if (const auto found = struct_decorations->member_offsets.find(member);
+                                    found != struct_decorations->member_offsets.end())
+                                offset = found->second;
+                            if (const auto found = struct_decorations->member_matrix_strides.find(member);
+                                    found != struct_decorations->member_matrix_strides.end())
+                                member_matrix_stride = found->second;
+                        }
+                        size = std::max(size, offset.value_or(size) + get_size(operands[member], member_matrix_stride));
+                    }
+                    return size;
+                }
+                default:
+                    return 0;
+            }
+        }
+    };
+
+    VkShaderStageFlagBits get_stage(const uint32_t execution_model) {
+        switch (execution_model) {
+            case 0:
+                return VK_SHADER_STAGE_VERTEX_BIT;
+            case 1:
+                return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+            case 2:
+                return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+            case 3:
+                return VK_SHADER_STAGE_GEOMETRY_BIT;
+            case 4:
+                return VK_SHADER_STAGE_FRAGMENT_BIT;
+            case 5:
+                return VK_SHADER_STAGE_COMPUTE_BIT;
+            case 5364:
+                return VK_SHADER_STAGE_TASK_BIT_EXT;
+            case 5365:
+                return VK_SHADER_STAGE_MESH_BIT_EXT;
+            default:
+                throw std::runtime_error{"Unsupported SPIR-V execution model"};
+        }
+    }
+
+    VkFormat get_vertex_format(const SpirvModule &module, const uint32_t type_id) {
+        const auto *type = &module.get_type(type_id);
+        uint32_t component_count{1};
+        if (type->opcode == OpTypeVector) {
+            component_count = type->operands[1];
+            type = &module.get_type(type->operands[0]);
+        }
+        if (type->operands[0] != 32 || component_count < 1 || component_count > 4)
+            return VK_FORMAT_UNDEFINED;
+        const auto index = component_count - 1;
+        if (type->opcode == OpTypeFloat)
+            return std::array{VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT,
+                              VK_FORMAT_R32G32B32A32_SFLOAT}[index];
+        if (type->operands[1])
+            return std::array{VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT,
+                              VK_FORMAT_R32G32B32A32_SINT}[index];
+        return std::array{VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+                          VK_FORMAT_R32G32B32A32_UINT}[index];
+    }
+
+    std::optional<VkDescriptorType> get_descriptor_type(const SpirvModule &module, const uint32_t storage_class,
+                                                        const uint32_t type_id) {
+        const auto &type = module.get_type(type_id);
+        switch (storage_class) {
+            case StorageClassStorageBuffer:
+                return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            case StorageClassUniform: {
+                // Before SPIR-V 1.3 storage buffers were uniform blocks decorated with BufferBlock.
+                const auto *const block_decorations = module.find_decorations(type_id);
+                return block_decorations && block_decorations->is_buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                                                                               : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            }
+            case StorageClassUniformConstant:
+                switch (type.opcode) {
+                    case OpTypeSampler:
+                        return VK_DESCRIPTOR_TYPE_SAMPLER;
+                    case OpTypeSampledImage:
+                        return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                    case OpTypeAccelerationStructureKHR:
+                        return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+                    case OpTypeImage: {
+                        const auto dimension = type.operands[1];
+                        const auto sampled = type.operands[5];
+                        if (dimension == DimSubpassData)
+                            return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                        if (dimension == DimBuffer)
+                            return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                                : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                        return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+                    }
+                    default:
+                        return std::nullopt;
+                }
+            default:
+                return std::nullopt;
+        }
+    }
+}
+
+ShaderReflection reflect_spirv(const std::span<const uint32_t> words) {
+    const SpirvModule module{words};
+
+    ShaderReflection reflection{};
+    reflection.stage = get_stage(module.execution_model);
+    reflection.entry_point = module.entry_point;
+    reflection.workgroup_size = module.workgroup_size;
+
+    for (const auto &[id, variable]: module.get_variables()) {
+        const auto &pointer = module.get_type(variable.type);
+        if (pointer.opcode != OpTypePointer)
+            continue;
+        const auto *const variable_decorations = module.find_decorations(id);
+
+        if (variable.storage_class == StorageClassPushConstant) {
+            reflection.push_constant_size = std::max(reflection.push_constant_size,
+                                                     module.get_size(pointer.operands[1]));
+            continue;
+        }
+
+        if (variable.storage_class == StorageClassInput) {
+            if (reflection.stage != VK_SHADER_STAGE_VERTEX_BIT || !variable_decorations ||
+                variable_decorations->is_builtin || !variable_decorations->location)
+                continue;
+            reflection.vertex_inputs.emplace_back(*variable_decorations->location,
+                                                  get_vertex_format(module, pointer.operands[1]));
+            continue;
+        }
+
+        if (!variable_decorations || !variable_decorations->binding)
+            continue;
+        auto type_id = pointer.operands[1];
+        uint32_t count{1};
+        for (auto *type = &module.get_type(type_id);
+             type->opcode == OpTypeArray || type->opcode == OpTypeRuntimeArray; type = &module.get_type(type_id)) {
+            count = type->opcode == OpTypeArray ? count * module.get_constant(type->operands[1]) : 0;
+            type_id = type->operands[0];
+        }
+        if (const auto descriptor_type = get_descriptor_type(module, variable.storage_class, type_id))
+            reflection.bindings.emplace_back(variable_decorations->set.value_or(0), *variable_decorations->binding,
+                                             *descriptor_type, count);
+    }
+
+    std::ranges::sort(reflection.bindings, {}, [](const ReflectedBinding &binding) {
+        return std::pair{binding.set, binding.binding};
+    });
+    std::ranges::sort(reflection.vertex_inputs, {}, &ReflectedVertexInput::location);
+    return reflection;
+}
+
+std::vector<std::byte> serialize(const ShaderReflection &reflection) {
+    std::vector<std::byte> data;
+    write(data, reflection_magic);
+    write(data, reflection_version);
+    write(data, static_cast<uint32_t>(reflection.stage));
+    write(data, static_cast<uint32_t>(reflection.entry_point.size()));
+    for (const auto character: reflection.entry_point)
+        write(data, character);
+    write(data, static_cast<uint32_t>(reflection.bindings.size()));
+    for (const auto &[set, binding, type, count]: reflection.bindings) {
+        write(data, set);
+        write(data, binding);
+        write(data, static_cast<uint32_t>(type));
+        write(data, count);
+    }
+    write(data, reflection.push_constant_size);
+    write(data, static_cast<uint32_t>(reflection.vertex_inputs.size()));
+    for (const auto &[location, format]: reflection.vertex_inputs) {
+        write(data, location);
+        write(data, static_cast<uint32_t>(format));
+    }
+    for (const auto size: reflection.workgroup_size)
+        write(data, size);
+    return data;
+}
+
+ShaderReflection deserialize_shader_reflection(const std::span<const std::byte> data) {
+    Reader reader{data, "shader reflection"};
+    if (reader.read<uint32_t>() != reflection_magic || reader.read<uint32_t>() != reflection_version)
+        throw std::runtime_error{"Shader reflection was written by another version, recompile the shaders"};
+
+    ShaderReflection reflection{};
+    reflection.stage = static_cast<VkShaderStageFlagBits>(reader.read<uint32_t>());
+    reflection.entry_point.resize(reader.read<uint32_t>());
+    for (auto &character: reflection.entry_point)
+        character = reader.read<char>();
+    reflection.bindings.resize(reader.read<uint32_t>());
+    for (auto &[set, binding, type, count]: reflection.bindings) {
+        set = reader.read<uint32_t>();
+        binding = reader.read<uint32_t>();
+        type = static_cast<VkDescriptorType>(reader.read<uint32_t>());
+        count = reader.read<uint32_t>();
+    }
+    reflection.push_constant_size = reader.read<uint32_t>();
+    reflection.vertex_inputs.resize(reader.read<uint32_t>());
+    for (auto &[location, format]: reflection.vertex_inputs) {
+        location = reader.read<uint32_t>();
+        format = static_cast<VkFormat>(reader.read<uint32_t>());
+    }
+    for (auto &size: reflection.workgroup_size)
+        size = reader.read<uint32_t>();
+    return reflection;
+}
+
+std::filesystem::path get_reflection_path(const std::filesystem::path &spirv_path) {
+    auto path{spirv_path};
+    path += ".refl";
+    return path;
+}
+
+ShaderReflection load_shader_reflection(const std::filesystem::path &spirv_path) {
+    const auto path = get_reflection_path(spirv_path);
+    std::ifstream file{path, std::ios::binary};
+    if (!file)
+        throw std::runtime_error{"Couldn't open shader reflection " + path.string()};
+    const std::vector<char> content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    return deserialize_shader_reflection(std::as_bytes(std::span{content}));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+// Only depends on the C headers so the offline reflection tool builds without SDL or the C++ bindings.
+
+struct ReflectedBinding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    // Zero for runtime sized arrays.
+    uint32_t count;
+};
+
+struct ReflectedVertexInput {
+    uint32_t location;
+    VkFormat format;
+};
+
+struct ShaderReflection {
+    VkShaderStageFlagBits stage{};
+    std::string entry_point;
+    std::vector<ReflectedBinding> bindings;
+    // Size of the push constant block, zero without one.
+    uint32_t push_constant_size{};
+    std::vector<ReflectedVertexInput> vertex_inputs;
+    std::array<uint32_t, 3> workgroup_size{};
+};
+
+// Parses the SPIR-V words, throws std::runtime_error on malformed modules.
+[[nodiscard]] ShaderReflection reflect_spirv(std::span<const uint32_t> words);
+
+[[nodiscard]] std::vector<std::byte> serialize(const ShaderReflection &reflection);
+
+[[nodiscard]] ShaderReflection deserialize_shader_reflection(std::span<const std::byte> data);
+
+// The reflection is stored next to the compiled module, "shader.comp.spv" gets "shader.comp.spv.refl".
+[[nodiscard]] std::filesystem::path get_reflection_path(const std::filesystem::path &spirv_path);
+
+[[nodiscard]] ShaderReflection load_shader_reflection(const std::filesystem::path &spirv_path);
@@ -0,0 +1,107 @@
+#include "shaders.hpp"
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    std::vector<uint32_t> read_spirv(const std::filesystem::path &path) {
+        std::ifstream file{path, std::ios::binary};
+        if (!file)
+            throw std::runtime_error{"Couldn't open shader " + path.string()};
+        std::vector<uint32_t> words(std::filesystem::file_size(path) / sizeof(uint32_t));
+        file.read(reinterpret_cast<char *>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint32_t)));
+        return words;
+    }
+}
+
+const ShaderRegistry::Shader &ShaderRegistry::get(const ShaderId id, const ShaderVersion version) const {
+    const std::shared_lock lock{mutex};
+    if (id == 0 || id > shaders.size())
+        throw std::out_of_range{"Unknown shader id " + std::to_string(id)};
+    if (version == ShaderVersion::Staged)
+        if (const auto found = staged.find(id); found != staged.end())
+            return *found->second;
+    return *shaders[id - 1];
+}
+
+std::unique_ptr<ShaderRegistry::Shader> ShaderRegistry::create(const std::filesystem::path &path,
+                                                               const std::span<const uint32_t> words) const {
+    vk::ShaderModuleCreateInfo create_info{};
+    create_info.setCode(words);
+    return std::make_unique<Shader>(path, vk::raii::ShaderModule{device, create_info}, reflect_spirv(words));
+}
+
+ShaderId ShaderRegistry::load(const std::filesystem::path &spirv_path) {
+    const auto path = std::filesystem::weakly_canonical(spirv_path);
+    {
+        const std::shared_lock lock{mutex};
+        if (const auto id = ids.find(path); id != ids.end())
+            return id->second;
+    }
+
+    const auto words = read_spirv(path);
+    vk::ShaderModuleCreateInfo create_info{};
+    create_info.setCode(words);
+    auto shader = std::make_unique<Shader>(path, vk::raii::ShaderModule{device, create_info},
+                                           load_shader_reflection(path));
+
+    const std::scoped_lock lock{mutex};
+    // Another thread may have loaded it meanwhile, its id wins.
+    if (const auto id = ids.find(path); id != ids.end())
+        return id->second;
+    shaders.emplace_back(std::move(shader));
+    const auto id = static_cast<ShaderId>(shaders.size());
+    ids.emplace(path, id);
+    return id;
+}
+
+ShaderId ShaderRegistry::find(const std::string_view file_name) const {
+    const std::shared_lock lock{mutex};
+    for (const auto &[path, id]: ids)
+        if (path.filename() == file_name)
+            return id;
+    return 0;
+}
+
+std::vector<ShaderId> ShaderRegistry::get_ids() const {
+    const std::shared_lock lock{mutex};
+    std::vector<ShaderId> result;
+    for (ShaderId id{1}; id <= shaders.size(); ++id)
+        result.emplace_back(id);
+    return result;
+}
+
+void ShaderRegistry::stage(const ShaderId id, const std::span<const uint32_t> words) {
+    auto shader = create(get_path(id), words);
+    const std::scoped_lock lock{mutex};
+    staged.insert_or_assign(id, std::move(shader));
+}
+
+void ShaderRegistry::discard_staged(const ShaderId id) {
+    const std::scoped_lock lock{mutex};
+    staged.erase(id);
+}
+
+std::unique_ptr<ShaderRegistry::Shader> ShaderRegistry::commit(const ShaderId id) {
+    const std::scoped_lock lock{mutex};
+    const auto found = staged.find(id);
+    if (found == staged.end())
+        return nullptr;
+    auto previous = std::exchange(shaders.at(id - 1), std::move(found->second));
+    staged.erase(found);
+    return previous;
+}
+
+vk::ShaderModule ShaderRegistry::get_module(const ShaderId id, const ShaderVersion version) const {
+    return *get(id, version).module;
+}
+
+const ShaderReflection &ShaderRegistry::get_reflection(const ShaderId id, const ShaderVersion version) const {
+    return get(id, version).reflection;
+}
+
+const std::filesystem::path &ShaderRegistry::get_path(const ShaderId id) const {
+    return get(id, ShaderVersion::Live).path;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "noncopyable.hpp"
+#include "platform.hpp"
+#include "shader_reflection.hpp"
+
+// Zero stands for an unused stage.
+using ShaderId = uint32_t;
+
+// Hot reload compiles replacements next to the live shaders first and swaps them in between frames.
+enum class ShaderVersion {
+    Live,
+    // The replacement waiting for its swap, falls back to the live shader when none is staged.
+    Staged,
+};
+
+// Loads compiled shaders with their reflection once and hands out small stable ids pipeline keys can refer to.
+class ShaderRegistry : Noncopyable {
+public:
+    struct Shader {
+        std::filesystem::path path;
+        vk::raii::ShaderModule module;
+        ShaderReflection reflection;
+    };
+
+private:
+    const vk::raii::Device &device;
+    mutable std::shared_mutex mutex;
+    std::vector<std::unique_ptr<Shader>> shaders;
+    std::unordered_map<std::filesystem::path, ShaderId> ids;
+    std::unordered_map<ShaderId, std::unique_ptr<Shader>> staged;
+
+    [[nodiscard]] const Shader &get(ShaderId id, ShaderVersion version) const;
+
+    [[nodiscard]] std::unique_ptr<Shader> create(const std::filesystem::path &path,
+                                                 std::span<const uint32_t> words) const;
+
+public:
+    explicit ShaderRegistry(const vk::raii::Device &device) : device{device} {}
+
+    // Thread safe, loading the same path twice returns the same id.
+    [[nodiscard]] ShaderId load(const std::filesystem::path &spirv_path);
+
+    // Zero when no loaded shader has that file name.
+    [[nodiscard]] ShaderId find(std::string_view file_name) const;
+
+    // Every shader loaded so far.
+    [[nodiscard]] std::vector<ShaderId> get_ids() const;
+
+    // Thread safe, replaces an earlier staged version that wasn't committed yet.
+    void stage(ShaderId id, std::span<const uint32_t> words);
+
+    void discard_staged(ShaderId id);
+
+    // Makes the staged version live. The previous one comes back so it can outlive the frames still using it, and so
+    // do references handed out by get_reflection and get_path.
+    [[nodiscard]] std::unique_ptr<Shader> commit(ShaderId id);
+
+    [[nodiscard]] vk::ShaderModule get_module(ShaderId id, ShaderVersion version = ShaderVersion::Live) const;
+
+    [[nodiscard]] const ShaderReflection &get_reflection(ShaderId id,
+                                                         ShaderVersion version = ShaderVersion::Live) const;
+
+    [[nodiscard]] const std::filesystem::path &get_path(ShaderId id) const;
+};
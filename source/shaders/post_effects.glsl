@@ -0,0 +1,70 @@
+// Per pixel post-processing effects, fused into whichever pass of the chain they follow. PostProcessor turns them on
+// through the specialization constants, disabled effects compile away.
+
+// Intermediates are rgba16f. Only the OUTPUT variant of the last pass writes without a format, which swapchain images
+// need and which depends on shaderStorageImageWriteWithoutFormat.
+#ifdef OUTPUT
+layout(set = 0, binding = 1) uniform writeonly image2D destination;
+#else
+layout(set = 0, binding = 1, rgba16f) uniform writeonly image2D destination;
+#endif
+
+layout(constant_id = 0) const uint effects = 0;
+// Swapchain images written through a UNORM storage view store sRGB encoded values.
+layout(constant_id = 1) const bool encode_srgb = false;
+
+const uint effect_tonemap = 1;
+const uint effect_color_grade = 2;
+const uint effect_vignette = 4;
+const uint effect_dither = 8;
+
+// PostProcessParameters.
+layout(push_constant) uniform Parameters {
+    vec3 lift;
+    float exposure;
+    vec3 gamma;
+    float vignette;
+    vec3 gain;
+    uint frame;
+} parameters;
+
+// ACES fitted by Krzysztof Narkowicz.
+vec3 tonemap(const vec3 color) {
+    const vec3 x = color * parameters.exposure;
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+vec3 color_grade(const vec3 color) {
+    const vec3 lifted = parameters.gain * (color + parameters.lift * (1.0 - color));
+    return pow(max(lifted, 0.0), 1.0 / parameters.gamma);
+}
+
+float hash(uvec3 value) {
+    value = value * 1664525u + 1013904223u;
+    value.x += value.y * value.z;
+    value.y += value.z * value.x;
+    value.z += value.x * value.y;
+    value ^= value >> 16u;
+    return float(value.x + value.y + value.z) * (1.0 / 4294967296.0);
+}
+
+vec3 encode_srgb_color(const vec3 color) {
+    return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055, greaterThan(color, vec3(0.0031308)));
+}
+
+vec3 apply_per_pixel(vec3 color, const uvec2 pixel, const uvec2 extent) {
+    if ((effects & effect_tonemap) != 0)
+        color = tonemap(color);
+    if ((effects & effect_color_grade) != 0)
+        color = color_grade(color);
+    if ((effects & effect_vignette) != 0) {
+        const vec2 offset = (vec2(pixel) + 0.5) / vec2(extent) - 0.5;
+        color *= clamp(1.0 - parameters.vignette * dot(offset, offset) * 4.0, 0.0, 1.0);
+    }
+    if (encode_srgb)
+        color = encode_srgb_color(clamp(color, 0.0, 1.0));
+    // Triangular noise of one 8 bit step against banding, after the encode so the step is even.
+    if ((effects & effect_dither) != 0)
+        color += (hash(uvec3(pixel, parameters.frame)) - hash(uvec3(pixel.yx, parameters.frame + 1))) / 255.0;
+    return color;
+}
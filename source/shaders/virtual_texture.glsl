@@ -0,0 +1,44 @@
+// Sampling side of VirtualTextureSystem. The including shader declares these before including it:
+//   layout(std430) buffer VirtualTextureFeedback { uint feedback[]; };
+//   layout(std430) readonly buffer VirtualTexturePageTable { uint page_table[]; };
+// and samples with GL_ARB_sparse_texture_clamp:
+//   const float min_lod = virtual_texture_request(texture, uv, textureQueryLod(virtual_sampler, uv).y);
+//   color = textureClampARB(virtual_sampler, uv, min_lod);
+// Requesting from every pixel contends on the atomics, a dithered one in a few is enough.
+
+struct VirtualTexture {
+    // VirtualTextureSystem::get_feedback_offset.
+    uint feedback_offset;
+    // Size of mip zero in texels and pages, and the page size, as in the sparse image format properties.
+    uvec2 extent;
+    uvec2 pages;
+    uvec2 page_extent;
+    // Paged mips, the mip tail starts after them.
+    uint paged_mip_count;
+};
+
+// Index of the page covering uv at mip within the texture, mips numbered from the finest.
+uint virtual_texture_page(const VirtualTexture texture, const vec2 uv, const uint mip) {
+    uint first_page = 0;
+    for (uint level = 0; level < mip; ++level) {
+        const uvec2 level_extent = max(texture.extent >> level, uvec2(1));
+        const uvec2 level_pages = (level_extent + texture.page_extent - 1) / texture.page_extent;
+        first_page += level_pages.x * level_pages.y;
+    }
+    const uvec2 level_extent = max(texture.extent >> mip, uvec2(1));
+    const uvec2 level_pages = (level_extent + texture.page_extent - 1) / texture.page_extent;
+    const uvec2 page = min(uvec2(clamp(uv, 0.0, 1.0) * vec2(level_extent)) / texture.page_extent, level_pages - 1);
+    return first_page + page.y * level_pages.x + page.x;
+}
+
+// Marks the page sampled at uv for streaming and returns the finest LOD resident there.
+float virtual_texture_request(const VirtualTexture texture, const vec2 uv, const float lod) {
+    const uint mip = uint(max(lod, 0.0));
+    if (mip < texture.paged_mip_count) {
+        const uint bit = texture.feedback_offset + virtual_texture_page(texture, uv, mip);
+        atomicOr(feedback[bit >> 5], 1u << (bit & 31));
+    }
+    const uvec2 pages = max(texture.pages, uvec2(1));
+    const uvec2 page = min(uvec2(clamp(uv, 0.0, 1.0) * vec2(pages)), pages - 1);
+    return float(page_table[page.y * pages.x + page.x]);
+}
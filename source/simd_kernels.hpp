@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The kernels behind simd_math.hpp, written once against a vector type V and instantiated for each instruction set in
+// the translation unit compiled for it. They only touch raw pointers and V, nothing inline and shared with other
+// translation units gets compiled with a wider instruction set than the CPU may have.
+//
+// V provides Type and Mask, width, load, store, broadcast, add, sub, mul, greater, both and store_mask. Each kernel
+// handles whole vectors from begin on and returns where it stopped, the scalar instantiation finishes the rest.
+
+namespace simd_kernels {
+    // Inward plane equations and the absolute values of their normals, the box test needs both.
+    struct Planes {
+        float planes[6][4];
+        float absolute_normals[6][3];
+    };
+
+    template<typename V>
+    typename V::Type get_distance(const float (&plane)[4], const typename V::Type x, const typename V::Type y,
+                                  const typename V::Type z) {
+        return V::add(V::add(V::add(V::mul(V::broadcast(plane[0]), x), V::mul(V::broadcast(plane[1]), y)),
+                             V::mul(V::broadcast(plane[2]), z)), V::broadcast(plane[3]));
+    }
+
+    template<typename V>
+    size_t cull_spheres(const Planes &planes, const float *const x, const float *const y, const float *const z,
+                        const float *const radius, uint8_t *const visible, size_t begin, const size_t count) {
+        for (; begin + V::width <= count; begin += V::width) {
+            const auto center_x = V::load(x + begin);
+            const auto center_y = V::load(y + begin);
+            const auto center_z = V::load(z + begin);
+            const auto negative_radius = V::sub(V::broadcast(0.0f), V::load(radius + begin));
+            auto inside = V::greater(get_distance<V>(planes.planes[0], center_x, center_y, center_z),
+                                     negative_radius);
+            for (size_t plane{1}; plane < 6; ++plane)
+                inside = V::both(inside, V::greater(get_distance<V>(planes.planes[plane], center_x, center_y,
+                                                                    center_z), negative_radius));
+            V::store_mask(visible + begin, inside);
+        }
+        return begin;
+    }
+
+    template<typename V>
+    size_t cull_boxes(const Planes &planes, const float *const x, const float *const y, const float *const z,
+                      const float *const extent_x, const float *const extent_y, const float *const extent_z,
+                      uint8_t *const visible, size_t begin, const size_t count) {
+        for (; begin + V::width <= count; begin += V::width) {
+            const auto center_x = V::load(x + begin);
+            const auto center_y = V::load(y + begin);
+            const auto center_z = V::load(z + begin);
+            const auto half_x = V::load(extent_x + begin);
+            const auto half_y = V::load(extent_y + begin);
+            const auto half_z = V::load(extent_z + begin);
+            typename V::Mask inside{};
+            for (size_t plane{}; plane < 6; ++plane) {
+                // How far the box reaches towards the plane from its center.
+                const auto &normal = planes.absolute_normals[plane];
+                const auto reach = V::add(V::add(V::mul(V::broadcast(normal[0]), half_x),
+                                                 V::mul(V::broadcast(normal[1]), half_y)),
+                                          V::mul(V::broadcast(normal[2]), half_z));
+                const auto plane_inside = V::greater(get_distance<V>(planes.planes[plane], center_x, center_y,
+                                                                     center_z), V::sub(V::broadcast(0.0f), reach));
+                inside = plane == 0 ? plane_inside : V::both(inside, plane_inside);
+            }
+            V::store_mask(visible + begin, inside);
+        }
+        return begin;
+    }
+
+    template<typename V>
+    size_t transform_points(const float *const matrix, const float *const x, const float *const y,
+                            const float *const z, float *const output_x, float *const output_y,
+                            float *const output_z, size_t begin, const size_t count) {
+        for (; begin + V::width <= count; begin += V::width) {
+            const auto point_x = V::load(x + begin);
+            const auto point_y = V::load(y + begin);
+            const auto point_z = V::load(z + begin);
+            typename V::Type results[3];
+            for (size_t row{}; row < 3; ++row)
+                results[row] = V::add(V::add(V::add(V::mul(V::broadcast(matrix[row]), point_x),
+                                                    V::mul(V::broadcast(matrix[4 + row]), point_y)),
+                                             V::mul(V::broadcast(matrix[8 + row]), point_z)),
+                                      V::broadcast(matrix[12 + row]));
+            V::store(output_x + begin, results[0]);
+            V::store(output_y + begin, results[1]);
+            V::store(output_z + begin, results[2]);
+        }
+        return begin;
+    }
+
+    // Column major 4x4 matrices, V holds 1 or 4 rows of a column. Every column is the left matrix's columns weighted by
+    // the right one's, completed before storing so the output may alias the inputs.
+    template<typename V>
+    void multiply(const float *const left, const float *const right, float *const output) {
+        static_assert(4 % V::width == 0);
+        constexpr size_t blocks{4 / V::width};
+        typename V::Type columns[4][blocks];
+        for (size_t column{}; column < 4; ++column) {
+            const auto *const weights = right + column * 4;
+            for (size_t block{}; block < blocks; ++block) {
+                const auto row = block * V::width;
+                columns[column][block] = V::add(V::add(V::add(
+                        V::mul(V::load(left + row), V::broadcast(weights[0])),
+                        V::mul(V::load(left + 4 + row), V::broadcast(weights[1]))),
+                        V::mul(V::load(left + 8 + row), V::broadcast(weights[2]))),
+                        V::mul(V::load(left + 12 + row), V::broadcast(weights[3])));
+            }
+        }
+        for (size_t column{}; column < 4; ++column)
+            for (size_t block{}; block < blocks; ++block)
+                V::store(output + column * 4 + block * V::width, columns[column][block]);
+    }
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // From simd_math_avx2.cpp, the only code compiled for AVX2.
+    size_t cull_spheres_avx2(const Planes &planes, const float *x, const float *y, const float *z,
+                             const float *radius, uint8_t *visible, size_t count);
+
+    size_t cull_boxes_avx2(const Planes &planes, const float *x, const float *y, const float *z,
+                           const float *extent_x, const float *extent_y, const float *extent_z, uint8_t *visible,
+                           size_t count);
+
+    size_t transform_points_avx2(const float *matrix, const float *x, const float *y, const float *z,
+                                 float *output_x, float *output_y, float *output_z, size_t count);
+#endif
+}
@@ -0,0 +1,494 @@
+#include "simd_math.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "simd_kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_MATH_X86
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SIMD_MATH_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+    struct Scalar {
+        using Type = float;
+        using Mask = bool;
+
+        static constexpr size_t width{1};
+
+        static Type load(const float *const values) {
+            return *values;
+        }
+
+        static void store(float *const values, const Type value) {
+            *values = value;
+        }
+
+        static Type broadcast(const float value) {
+            return value;
+        }
+
+        // No FMA contraction here either, CMakeLists.txt turns it off for these files.
+        static Type add(const Type left, const Type right) {
+            return left + right;
+        }
+
+        static Type sub(const Type left, const Type right) {
+            return left - right;
+        }
+
+        static Type mul(const Type left, const Type right) {
+            return left * right;
+        }
+
+        static Mask greater(const Type left, const Type right) {
+            return left > right;
+        }
+
+        static Mask both(const Mask left, const Mask right) {
+            return left && right;
+        }
+
+        static void store_mask(uint8_t *const values, const Mask mask) {
+            *values = mask ? 1 : 0;
+        }
+    };
+
+#ifdef SIMD_MATH_X86
+    struct Sse2 {
+        using Type = __m128;
+        using Mask = __m128;
+
+        static constexpr size_t width{4};
+
+        static Type load(const float *const values) {
+            return _mm_loadu_ps(values);
+        }
+
+        static void store(float *const values, const Type value) {
+            _mm_storeu_ps(values, value);
+        }
+
+        static Type broadcast(const float value) {
+            return _mm_set1_ps(value);
+        }
+
+        static Type add(const Type left, const Type right) {
+            return _mm_add_ps(left, right);
+        }
+
+        static Type sub(const Type left, const Type right) {
+            return _mm_sub_ps(left, right);
+        }
+
+        static Type mul(const Type left, const Type right) {
+            return _mm_mul_ps(left, right);
+        }
+
+        static Mask greater(const Type left, const Type right) {
+            return _mm_cmpgt_ps(left, right);
+        }
+
+        static Mask both(const Mask left, const Mask right) {
+            return _mm_and_ps(left, right);
+        }
+
+        static void store_mask(uint8_t *const values, const Mask mask) {
+            const auto bits = static_cast<uint32_t>(_mm_movemask_ps(mask));
+            for (uint32_t lane{}; lane < width; ++lane)
+                values[lane] = static_cast<uint8_t>((bits >> lane) & 1);
+        }
+    };
+
+    bool has_avx2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        // The OS has to save the YMM registers too.
+        __cpuid(info, 1);
+        if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return info[1] & (1 << 5);
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+#ifdef SIMD_MATH_NEON
+    struct Neon {
+        using Type = float32x4_t;
+        using Mask = uint32x4_t;
+
+        static constexpr size_t width{4};
+
+        static Type load(const float *const values) {
+            return vld1q_f32(values);
+        }
+
+        static void store(float *const values, const Type value) {
+            vst1q_f32(values, value);
+        }
+
+        static Type broadcast(const float value) {
+            return vdupq_n_f32(value);
+        }
+
+        static Type add(const Type left, const Type right) {
+            return vaddq_f32(left, right);
+        }
+
+        static Type sub(const Type left, const Type right) {
+            return vsubq_f32(left, right);
+        }
+
+        // Not vmlaq_f32, which may be fused.
+        static Type mul(const Type left, const Type right) {
+            return vmulq_f32(left, right);
+        }
+
+        static Mask greater(const Type left, const Type right) {
+            return vcgtq_f32(left, right);
+        }
+
+        static Mask both(const Mask left, const Mask right) {
+            return vandq_u32(left, right);
+        }
+
+        static void store_mask(uint8_t *const values, const Mask mask) {
+            values[0] = static_cast<uint8_t>(vgetq_lane_u32(mask, 0) & 1);
+            values[1] = static_cast<uint8_t>(vgetq_lane_u32(mask, 1) & 1);
+            values[2] = static_cast<uint8_t>(vgetq_lane_u32(mask, 2) & 1);
+            values[3] = static_cast<uint8_t>(vgetq_lane_u32(mask, 3) & 1);
+        }
+    };
+#endif
+
+    // Below this many objects a job costs more than it saves.
+    constexpr size_t min_job_size{16384};
+
+    void check_supported(const SimdLevel level) {
+        if (!is_supported(level))
+            throw std::invalid_argument{"The SIMD level isn't supported on this CPU or build"};
+    }
+
+    simd_kernels::Planes prepare_planes(const Frustum &frustum) {
+        simd_kernels::Planes planes{};
+        for (size_t plane{}; plane < 6; ++plane) {
+            std::ranges::copy(frustum.planes[plane], planes.planes[plane]);
+            for (size_t axis{}; axis < 3; ++axis)
+                planes.absolute_normals[plane][axis] = std::abs(frustum.planes[plane][axis]);
+        }
+        return planes;
+    }
+
+    void check_sizes(const SphereArrays &spheres, const size_t count) {
+        if (spheres.x.size() != count || spheres.y.size() != count || spheres.z.size() != count ||
+            spheres.radius.size() != count)
+            throw std::invalid_argument{"Sphere arrays differ in size from the visibility"};
+    }
+
+    void check_sizes(const BoxArrays &boxes, const size_t count) {
+        if (boxes.x.size() != count || boxes.y.size() != count || boxes.z.size() != count ||
+            boxes.extent_x.size() != count || boxes.extent_y.size() != count || boxes.extent_z.size() != count)
+            throw std::invalid_argument{"Box arrays differ in size from the visibility"};
+    }
+
+    SphereArrays slice(const SphereArrays &spheres, const size_t begin, const size_t count) {
+        return {spheres.x.subspan(begin, count), spheres.y.subspan(begin, count), spheres.z.subspan(begin, count),
+                spheres.radius.subspan(begin, count)};
+    }
+
+    BoxArrays slice(const BoxArrays &boxes, const size_t begin, const size_t count) {
+        return {boxes.x.subspan(begin, count), boxes.y.subspan(begin, count), boxes.z.subspan(begin, count),
+                boxes.extent_x.subspan(begin, count), boxes.extent_y.subspan(begin, count),
+                boxes.extent_z.subspan(begin, count)};
+    }
+
+    // Runs work(begin, count) over slices of at least min_job_size. Jobs and the calling thread take slices from a
+    // shared counter, so the caller works through whatever no worker got to instead of blocking on queued jobs and
+    // only ever waits for slices already running. That keeps it deadlock free when called from a job itself.
+    template<typename F>
+    void split_over_jobs(JobSystem &jobs, const size_t count, const F &work) {
+        const auto job_count = std::clamp<size_t>(count / min_job_size, 1, jobs.get_worker_count() + 1);
+        // Whole AVX2 vectors, so only the last slice has a scalar tail.
+        const auto job_size = (count / job_count + 7) & ~size_t{7};
+        const auto slice_count = job_size ? (count + job_size - 1) / job_size : 0;
+        if (slice_count <= 1) {
+            work(0, count);
+            return;
+        }
+
+        // Jobs still queued when the caller returns find no slice left and never touch work.
+        struct Progress {
+            std::atomic<size_t> next_slice{};
+            std::atomic<size_t> finished_slices{};
+            std::mutex mutex;
+            std::exception_ptr error;
+        };
+        const auto progress = std::make_shared<Progress>();
+        const auto run_slices = [&work, progress, count, job_size, slice_count]() {
+            for (size_t slice; (slice = progress->next_slice.fetch_add(1)) < slice_count;) {
+                const auto begin = slice * job_size;
+                try {
+                    work(begin, std::min(job_size, count - begin));
+                } catch (...) {
+                    const std::scoped_lock lock{progress->mutex};
+                    if (!progress->error)
+                        progress->error = std::current_exception();
+                }
+                if (progress->finished_slices.fetch_add(1) + 1 == slice_count)
+                    progress->finished_slices.notify_all();
+            }
+        };
+        for (size_t job{1}; job < slice_count; ++job)
+            jobs.submit(run_slices);
+        run_slices();
+        for (auto finished = progress->finished_slices.load(); finished < slice_count;
+             finished = progress->finished_slices.load())
+            progress->finished_slices.wait(finished);
+        if (progress->error)
+            std::rethrow_exception(progress->error);
+    }
+}
+
+std::string_view to_string(const SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Scalar:
+            return "scalar";
+        case SimdLevel::Sse2:
+            return "SSE2";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Neon:
+            return "NEON";
+    }
+    std::unreachable();
+}
+
+bool is_supported(const SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Scalar:
+            return true;
+#ifdef SIMD_MATH_X86
+        case SimdLevel::Sse2:
+            return true;
+        case SimdLevel::Avx2: {
+            static const auto has_avx2_support{has_avx2()};
+            return has_avx2_support;
+        }
+#endif
+#ifdef SIMD_MATH_NEON
+        case SimdLevel::Neon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+SimdLevel get_simd_level() {
+    static const auto level{[]() {
+        for (const auto level: {SimdLevel::Avx2, SimdLevel::Sse2, SimdLevel::Neon})
+            if (is_supported(level))
+                return level;
+        return SimdLevel::Scalar;
+    }()};
+    return level;
+}
+
+Frustum extract_frustum(const Matrix4 &view_projection) {
+    const auto get_row = [&](const size_t row) {
+        return std::array{view_projection[row], view_projection[4 + row], view_projection[8 + row],
+                          view_projection[12 + row]};
+    };
+    const auto combine = [](const std::array<float, 4> &left, const std::array<float, 4> &right, const float sign) {
+        return std::array{left[0] + sign * right[0], left[1] + sign * right[1], left[2] + sign * right[2],
+                          left[3] + sign * right[3]};
+    };
+    const auto x = get_row(0);
+    const auto y = get_row(1);
+    const auto z = get_row(2);
+    const auto w = get_row(3);
+    Frustum frustum{{combine(w, x, 1.0f), combine(w, x, -1.0f), combine(w, y, 1.0f), combine(w, y, -1.0f), z,
+                     combine(w, z, -1.0f)}};
+    for (auto &plane: frustum.planes) {
+        const auto length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f)
+            std::ranges::transform(plane, plane.begin(), [&](const float value) { return value / length; });
+        else
+            plane = {0.0f, 0.0f, 0.0f, 1.0f};
+    }
+    return frustum;
+}
+
+void cull_spheres(const Frustum &frustum, const SphereArrays &spheres, const std::span<uint8_t> visible,
+                  const SimdLevel level) {
+    check_supported(level);
+    const auto count = visible.size();
+    check_sizes(spheres, count);
+    const auto planes = prepare_planes(frustum);
+    size_t begin{};
+    switch (level) {
+#ifdef SIMD_MATH_X86
+        case SimdLevel::Avx2:
+            begin = simd_kernels::cull_spheres_avx2(planes, spheres.x.data(), spheres.y.data(), spheres.z.data(),
+                                                    spheres.radius.data(), visible.data(), count);
+            break;
+        case SimdLevel::Sse2:
+            begin = simd_kernels::cull_spheres<Sse2>(planes, spheres.x.data(), spheres.y.data(), spheres.z.data(),
+                                                     spheres.radius.data(), visible.data(), 0, count);
+            break;
+#endif
+#ifdef SIMD_MATH_NEON
+        case SimdLevel::Neon:
+            begin = simd_kernels::cull_spheres<Neon>(planes, spheres.x.data(), spheres.y.data(), spheres.z.data(),
+                                                     spheres.radius.data(), visible.data(), 0, count);
+            break;
+#endif
+        default:
+            break;
+    }
+    simd_kernels::cull_spheres<Scalar>(planes, spheres.x.data(), spheres.y.data(), spheres.z.data(),
+                                       spheres.radius.data(), visible.data(), begin, count);
+}
+
+void cull_boxes(const Frustum &frustum, const BoxArrays &boxes, const std::span<uint8_t> visible,
+                const SimdLevel level) {
+    check_supported(level);
+    const auto count = visible.size();
+    check_sizes(boxes, count);
+    const auto planes = prepare_planes(frustum);
+    size_t begin{};
+    switch (level) {
+#ifdef SIMD_MATH_X86
+        case SimdLevel::Avx2:
+            begin = simd_kernels::cull_boxes_avx2(planes, boxes.x.data(), boxes.y.data(), boxes.z.data(),
+                                                  boxes.extent_x.data(), boxes.extent_y.data(),
+                                                  boxes.extent_z.data(), visible.data(), count);
+            break;
+        case SimdLevel::Sse2:
+            begin = simd_kernels::cull_boxes<Sse2>(planes, boxes.x.data(), boxes.y.data(), boxes.z.data(),
+                                                   boxes.extent_x.data(), boxes.extent_y.data(),
+                                                   boxes.extent_z.data(), visible.data(), 0, count);
+            break;
+#endif
+#ifdef SIMD_MATH_NEON
+        case SimdLevel::Neon:
+            begin = simd_kernels::cull_boxes<Neon>(planes, boxes.x.data(), boxes.y.data(), boxes.z.data(),
+                                                   boxes.extent_x.data(), boxes.extent_y.data(),
+                                                   boxes.extent_z.data(), visible.data(), 0, count);
+            break;
+#endif
+        default:
+            break;
+    }
+    simd_kernels::cull_boxes<Scalar>(planes, boxes.x.data(), boxes.y.data(), boxes.z.data(), boxes.extent_x.data(),
+                                     boxes.extent_y.data(), boxes.extent_z.data(), visible.data(), begin, count);
+}
+
+void cull_spheres(JobSystem &jobs, const Frustum &frustum, const SphereArrays &spheres,
+                  const std::span<uint8_t> visible, const SimdLevel level) {
+    check_supported(level);
+    check_sizes(spheres, visible.size());
+    split_over_jobs(jobs, visible.size(), [&](const size_t begin, const size_t count) {
+        cull_spheres(frustum, slice(spheres, begin, count), visible.subspan(begin, count), level);
+    });
+}
+
+void cull_boxes(JobSystem &jobs, const Frustum &frustum, const BoxArrays &boxes, const std::span<uint8_t> visible,
+                const SimdLevel level) {
+    check_supported(level);
+    check_sizes(boxes, visible.size());
+    split_over_jobs(jobs, visible.size(), [&](const size_t begin, const size_t count) {
+        cull_boxes(frustum, slice(boxes, begin, count), visible.subspan(begin, count), level);
+    });
+}
+
+void transform_points(const Matrix4 &matrix, const PointArrays &points, const OutputPointArrays &output,
+                      const SimdLevel level) {
+    check_supported(level);
+    const auto count = points.x.size();
+    if (points.y.size() != count || points.z.size() != count || output.x.size() != count ||
+        output.y.size() != count || output.z.size() != count)
+        throw std::invalid_argument{"Point arrays differ in size"};
+    size_t begin{};
+    switch (level) {
+#ifdef SIMD_MATH_X86
+        case SimdLevel::Avx2:
+            begin = simd_kernels::transform_points_avx2(matrix.data(), points.x.data(), points.y.data(),
+                                                        points.z.data(), output.x.data(), output.y.data(),
+                                                        output.z.data(), count);
+            break;
+        case SimdLevel::Sse2:
+            begin = simd_kernels::transform_points<Sse2>(matrix.data(), points.x.data(), points.y.data(),
+                                                         points.z.data(), output.x.data(), output.y.data(),
+                                                         output.z.data(), 0, count);
+            break;
+#endif
+#ifdef SIMD_MATH_NEON
+        case SimdLevel::Neon:
+            begin = simd_kernels::transform_points<Neon>(matrix.data(), points.x.data(), points.y.data(),
+                                                         points.z.data(), output.x.data(), output.y.data(),
+                                                         output.z.data(), 0, count);
+            break;
+#endif
+        default:
+            break;
+    }
+    simd_kernels::transform_points<Scalar>(matrix.data(), points.x.data(), points.y.data(), points.z.data(),
+                                           output.x.data(), output.y.data(), output.z.data(), begin, count);
+}
+
+Matrix4 multiply(const Matrix4 &left, const Matrix4 &right, const SimdLevel level) {
+    Matrix4 output{};
+    multiply(std::span{&left, 1}, std::span{&right, 1}, std::span{&output, 1}, level);
+    return output;
+}
+
+void multiply(const std::span<const Matrix4> left, const std::span<const Matrix4> right,
+              const std::span<Matrix4> output, const SimdLevel level) {
+    check_supported(level);
+    if (left.size() != output.size() || right.size() != output.size())
+        throw std::invalid_argument{"Matrix arrays differ in size"};
+    for (size_t index{}; index < output.size(); ++index) {
+        const auto *const left_values = left[index].data();
+        const auto *const right_values = right[index].data();
+        auto *const output_values = output[index].data();
+        switch (level) {
+#ifdef SIMD_MATH_X86
+            // A column is 4 floats, AVX2 has nothing to add over SSE2 here.
+            case SimdLevel::Avx2:
+            case SimdLevel::Sse2:
+                simd_kernels::multiply<Sse2>(left_values, right_values, output_values);
+                break;
+#endif
+#ifdef SIMD_MATH_NEON
+            case SimdLevel::Neon:
+                simd_kernels::multiply<Neon>(left_values, right_values, output_values);
+                break;
+#endif
+            default:
+                simd_kernels::multiply<Scalar>(left_values, right_values, output_values);
+                break;
+        }
+    }
+}
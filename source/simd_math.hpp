@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#include "threading.hpp"
+
+// Batch math for culling and transforms over structure of arrays data, with SSE2, AVX2 and NEON paths picked at
+// runtime. Every path applies the same operations in the same order without fused multiply-adds, so they all give
+// results bit for bit equal to the scalar one, which every function can be asked for explicitly.
+
+enum class SimdLevel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+};
+
+[[nodiscard]] std::string_view to_string(SimdLevel level);
+
+// Whether the build has the level and the CPU runs it. Asking the functions below for any other level throws.
+[[nodiscard]] bool is_supported(SimdLevel level);
+
+// The best supported level, detected once.
+[[nodiscard]] SimdLevel get_simd_level();
+
+// Column major, like the matrices shaders get.
+using Matrix4 = std::array<float, 16>;
+
+// Planes as a, b, c, d with normals pointing inwards and a unit length, so their distances are in world units.
+struct Frustum {
+    std::array<std::array<float, 4>, 6> planes;
+};
+
+// The frustum of a view projection matrix with clip space depth from 0 to 1, reversed or not. An infinite far plane
+// turns into a plane everything is inside of.
+[[nodiscard]] Frustum extract_frustum(const Matrix4 &view_projection);
+
+struct SphereArrays {
+    std::span<const float> x;
+    std::span<const float> y;
+    std::span<const float> z;
+    std::span<const float> radius;
+};
+
+// Centers and half extents of axis aligned boxes.
+struct BoxArrays {
+    std::span<const float> x;
+    std::span<const float> y;
+    std::span<const float> z;
+    std::span<const float> extent_x;
+    std::span<const float> extent_y;
+    std::span<const float> extent_z;
+};
+
+struct PointArrays {
+    std::span<const float> x;
+    std::span<const float> y;
+    std::span<const float> z;
+};
+
+struct OutputPointArrays {
+    std::span<float> x;
+    std::span<float> y;
+    std::span<float> z;
+};
+
+// Writes 1 for every sphere touching the frustum and 0 for the others, visible has one entry per sphere.
+void cull_spheres(const Frustum &frustum, const SphereArrays &spheres, std::span<uint8_t> visible,
+                  SimdLevel level = get_simd_level());
+
+void cull_boxes(const Frustum &frustum, const BoxArrays &boxes, std::span<uint8_t> visible,
+                SimdLevel level = get_simd_level());
+
+// Splits the work over the job system, the calling thread takes a share too. Fine to call from a job.
+void cull_spheres(JobSystem &jobs, const Frustum &frustum, const SphereArrays &spheres, std::span<uint8_t> visible,
+                  SimdLevel level = get_simd_level());
+
+void cull_boxes(JobSystem &jobs, const Frustum &frustum, const BoxArrays &boxes, std::span<uint8_t> visible,
+                SimdLevel level = get_simd_level());
+
+// Transforms points by an affine matrix.
+void transform_points(const Matrix4 &matrix, const PointArrays &points, const OutputPointArrays &output,
+                      SimdLevel level = get_simd_level());
+
+[[nodiscard]] Matrix4 multiply(const Matrix4 &left, const Matrix4 &right, SimdLevel level = get_simd_level());
+
+// Composes matrices pairwise, such as parent world matrices with local ones. The output may alias either input.
+void multiply(std::span<const Matrix4> left, std::span<const Matrix4> right, std::span<Matrix4> output,
+              SimdLevel level = get_simd_level());
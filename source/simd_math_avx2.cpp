@@ -0,0 +1,75 @@
+#include "simd_kernels.hpp"
+
+// Compiled with AVX2 enabled, see CMakeLists.txt, and only called after checking the CPU has it.
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <immintrin.h>
+
+namespace simd_kernels {
+    namespace {
+        struct Avx2 {
+            using Type = __m256;
+            using Mask = __m256;
+
+            static constexpr size_t width{8};
+
+            static Type load(const float *const values) {
+                return _mm256_loadu_ps(values);
+            }
+
+            static void store(float *const values, const Type value) {
+                _mm256_storeu_ps(values, value);
+            }
+
+            static Type broadcast(const float value) {
+                return _mm256_set1_ps(value);
+            }
+
+            static Type add(const Type left, const Type right) {
+                return _mm256_add_ps(left, right);
+            }
+
+            static Type sub(const Type left, const Type right) {
+                return _mm256_sub_ps(left, right);
+            }
+
+            static Type mul(const Type left, const Type right) {
+                return _mm256_mul_ps(left, right);
+            }
+
+            static Mask greater(const Type left, const Type right) {
+                return _mm256_cmp_ps(left, right, _CMP_GT_OQ);
+            }
+
+            static Mask both(const Mask left, const Mask right) {
+                return _mm256_and_ps(left, right);
+            }
+
+            static void store_mask(uint8_t *const values, const Mask mask) {
+                const auto bits = static_cast<uint32_t>(_mm256_movemask_ps(mask));
+                for (uint32_t lane{}; lane < width; ++lane)
+                    values[lane] = static_cast<uint8_t>((bits >> lane) & 1);
+            }
+        };
+    }
+
+    size_t cull_spheres_avx2(const Planes &planes, const float *const x, const float *const y, const float *const z,
+                             const float *const radius, uint8_t *const visible, const size_t count) {
+        return cull_spheres<Avx2>(planes, x, y, z, radius, visible, 0, count);
+    }
+
+    size_t cull_boxes_avx2(const Planes &planes, const float *const x, const float *const y, const float *const z,
+                           const float *const extent_x, const float *const extent_y, const float *const extent_z,
+                           uint8_t *const visible, const size_t count) {
+        return cull_boxes<Avx2>(planes, x, y, z, extent_x, extent_y, extent_z, visible, 0, count);
+    }
+
+    size_t transform_points_avx2(const float *const matrix, const float *const x, const float *const y,
+                                 const float *const z, float *const output_x, float *const output_y,
+                                 float *const output_z, const size_t count) {
+        return transform_points<Avx2>(matrix, x, y, z, output_x, output_y, output_z, 0, count);
+    }
+}
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+#include "platform.hpp"
+
+// Maps the members of a plain config struct to shader specialization constants, with the map entries and packed
+// layout computed at compile time. A variant is described once next to its config struct:
+//
+//     struct LightingVariant {
+//         uint32_t light_count;
+//         bool msaa;
+//     };
+//
+//     template<>
+//     struct SpecializationTraits<LightingVariant> {
+//         using Map = SpecializationMap<SpecializationMember<0, &LightingVariant::light_count>,
+//                                       SpecializationMember<1, &LightingVariant::msaa>>;
+//     };
+//
+// and Specialization<LightingVariant>{{.light_count = 4, .msaa = true}} then yields the vk::SpecializationInfo.
+
+template<uint32_t Id, auto Member>
+struct SpecializationMember;
+
+template<typename Class, typename Field, uint32_t Id, Field Class::*Member>
+struct SpecializationMember<Id, Member> {
+    using Config = Class;
+    // SPIR-V booleans are 32 bit wide.
+    using Type = std::conditional_t<std::is_same_v<Field, bool>, vk::Bool32, Field>;
+
+    static_assert(std::is_arithmetic_v<Type> && (sizeof(Type) == 4 || sizeof(Type) == 8),
+                  "Specialization constants have to be 32 or 64 bit scalars");
+
+    static constexpr uint32_t id{Id};
+
+    static constexpr Type get(const Config &config) {
+        return static_cast<Type>(config.*Member);
+    }
+};
+
+template<typename... Members>
+struct SpecializationMap {
+    static constexpr size_t size{(sizeof(typename Members::Type) + ... + 0)};
+
+    static constexpr std::array<vk::SpecializationMapEntry, sizeof...(Members)> entries{[]() {
+        std::array<vk::SpecializationMapEntry, sizeof...(Members)> result{};
+        uint32_t offset{};
+        size_t index{};
+        ((result[index++] = {Members::id, offset, sizeof(typename Members::Type)},
+                offset += sizeof(typename Members::Type)), ...);
+        return result;
+    }()};
+
+    template<typename Config>
+    static constexpr std::array<std::byte, size> pack(const Config &config) {
+        std::array<std::byte, size> data{};
+        size_t offset{};
+        ((std::ranges::copy(std::bit_cast<std::array<std::byte, sizeof(typename Members::Type)>>(Members::get(config)),
+                            data.begin() + static_cast<std::ptrdiff_t>(offset)),
+                offset += sizeof(typename Members::Type)), ...);
+        return data;
+    }
+};
+
+template<typename Config>
+struct SpecializationTraits;
+
+template<typename Config>
+concept SpecializedConfig = requires { typename SpecializationTraits<Config>::Map; };
+
+template<SpecializedConfig Config>
+class Specialization {
+    using Map = typename SpecializationTraits<Config>::Map;
+
+    std::array<std::byte, Map::size> data;
+
+public:
+    constexpr explicit Specialization(const Config &config) : data{Map::pack(config)} {}
+
+    [[nodiscard]] static constexpr std::span<const vk::SpecializationMapEntry> get_entries() {
+        return Map::entries;
+    }
+
+    [[nodiscard]] constexpr std::span<const std::byte> get_data() const {
+        return data;
+    }
+
+    // Points into this object, which has to outlive the pipeline creation using it.
+    [[nodiscard]] vk::SpecializationInfo get_info() const {
+        vk::SpecializationInfo info{};
+        info.setMapEntries(Map::entries);
+        info.dataSize = data.size();
+        info.pData = data.data();
+        return info;
+    }
+};
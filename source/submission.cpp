@@ -0,0 +1,199 @@
+#include "submission.hpp"
+
+
+namespace {
+    void update_maximum(std::atomic<int64_t> &maximum, const int64_t value) {
+        for (auto current = maximum.load(std::memory_order_relaxed);
+             value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed);) {}
+    }
+}
+
+SubmissionThread::SubmissionThread(vk::raii::Queue queue, const ThreadPlacement &placement, const size_t capacity)
+        : queue{std::move(queue)}, work{capacity}, thread{[this, placement]() { run(placement); }} {}
+
+SubmissionThread::~SubmissionThread() {
+    stopping.store(true, std::memory_order_release);
+    wake_signal.fetch_add(1, std::memory_order_release);
+    wake_signal.notify_one();
+}
+
+void SubmissionThread::rethrow_error() const {
+    if (failed.load(std::memory_order_acquire))
+        std::rethrow_exception(error);
+}
+
+void SubmissionThread::push(Work &&item) {
+    rethrow_error();
+    // A full queue means the recording side is frames ahead of the driver, waiting for it is the correct back pressure.
+    while (!work.try_push(std::move(item)))
+        std::this_thread::yield();
+    pushed_count.fetch_add(1, std::memory_order_release);
+
+    const auto depth = work.get_size();
+    for (auto current = max_queue_depth.load(std::memory_order_relaxed);
+         depth > current && !max_queue_depth.compare_exchange_weak(current, depth, std::memory_order_relaxed);) {}
+
+    wake_signal.fetch_add(1, std::memory_order_release);
+    wake_signal.notify_one();
+}
+
+void SubmissionThread::submit(QueueSubmission submission) {
+    push(std::move(submission));
+}
+
+void SubmissionThread::bind_sparse(QueueSparseBinding binding) {
+    push(std::move(binding));
+}
+
+void SubmissionThread::present(QueuePresentation presentation) {
+    push(std::move(presentation));
+}
+
+void SubmissionThread::flush() {
+    const auto target = pushed_count.load(std::memory_order_acquire);
+    for (auto completed = completed_count.load(std::memory_order_acquire); completed < target;
+         completed = completed_count.load(std::memory_order_acquire))
+        completed_count.wait(completed, std::memory_order_acquire);
+    rethrow_error();
+}
+
+void SubmissionThread::process(QueueSubmission &submission) {
+    std::vector<vk::SubmitInfo2> submit_infos;
+    submit_infos.reserve(submission.batches.size());
+    for (const auto &batch: submission.batches) {
+        auto &submit_info = submit_infos.emplace_back();
+        submit_info.setWaitSemaphoreInfos(batch.wait_semaphores);
+        submit_info.setCommandBufferInfos(batch.command_buffers);
+        submit_info.setSignalSemaphoreInfos(batch.signal_semaphores);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    queue.submit2(submit_infos, submission.fence);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    submit_count.fetch_add(1, std::memory_order_relaxed);
+    last_submit_time.store(elapsed, std::memory_order_relaxed);
+    total_submit_time.fetch_add(elapsed, std::memory_order_relaxed);
+    update_maximum(max_submit_time, elapsed);
+}
+
+void SubmissionThread::process(const QueueSparseBinding &binding) {
+    const auto get_semaphores = [](const std::vector<vk::SemaphoreSubmitInfo> &infos) {
+        std::pair<std::vector<vk::Semaphore>, std::vector<uint64_t>> semaphores;
+        for (const auto &info: infos) {
+            semaphores.first.emplace_back(info.semaphore);
+            semaphores.second.emplace_back(info.value);
+        }
+        return semaphores;
+    };
+    const auto [wait_semaphores, wait_values] = get_semaphores(binding.wait_semaphores);
+    const auto [signal_semaphores, signal_values] = get_semaphores(binding.signal_semaphores);
+    std::vector<vk::SparseImageMemoryBindInfo> image_bind_infos;
+    for (const auto &[image, binds]: binding.image_binds)
+        image_bind_infos.emplace_back(image, binds);
+    std::vector<vk::SparseImageOpaqueMemoryBindInfo> opaque_bind_infos;
+    for (const auto &[image, binds]: binding.opaque_binds)
+        opaque_bind_infos.emplace_back(image, binds);
+
+    const vk::TimelineSemaphoreSubmitInfo timeline_info{wait_values, signal_values};
+    vk::BindSparseInfo bind_info{wait_semaphores, {}, opaque_bind_infos, image_bind_infos, signal_semaphores,
+                                 &timeline_info};
+    const auto start = std::chrono::steady_clock::now();
+    queue.bindSparse(bind_info, binding.fence);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    sparse_bind_count.fetch_add(1, std::memory_order_relaxed);
+    last_sparse_bind_time.store(elapsed, std::memory_order_relaxed);
+    total_sparse_bind_time.fetch_add(elapsed, std::memory_order_relaxed);
+    update_maximum(max_sparse_bind_time, elapsed);
+}
+
+void SubmissionThread::process(const QueuePresentation &presentation) {
+    vk::PresentInfoKHR present_info{};
+    present_info.setWaitSemaphores(presentation.wait_semaphores);
+    present_info.setSwapchains(presentation.swapchain);
+    present_info.setImageIndices(presentation.image_index);
+
+    const auto start = std::chrono::steady_clock::now();
+    vk::Result result;
+    try {
+        result = queue.presentKHR(present_info);
+    } catch (const vk::OutOfDateKHRError &) {
+        result = vk::Result::eErrorOutOfDateKHR;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    if (result != vk::Result::eSuccess)
+        last_present_result.store(result, std::memory_order_relaxed);
+    present_count.fetch_add(1, std::memory_order_relaxed);
+    last_present_time.store(elapsed, std::memory_order_relaxed);
+    update_maximum(max_present_time, elapsed);
+}
+
+void SubmissionThread::run(const ThreadPlacement &placement) {
+    placement.apply(ThreadRole::Submit);
+    for (;;) {
+        const auto observed_signal = wake_signal.load(std::memory_order_acquire);
+        while (auto item = work.try_pop()) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    std::visit([this](auto &work_item) { process(work_item); }, *item);
+                } catch (...) {
+                    // Device loss and friends surface on the recording thread the next time it hands over work.
+                    error = std::current_exception();
+                    failed.store(true, std::memory_order_release);
+                }
+            }
+            completed_count.fetch_add(1, std::memory_order_release);
+            completed_count.notify_all();
+        }
+        if (stopping.load(std::memory_order_acquire))
+            return;
+        wake_signal.wait(observed_signal, std::memory_order_acquire);
+    }
+}
+
+SubmissionStats SubmissionThread::get_stats() const {
+    return {
+            .submit_count = submit_count.load(std::memory_order_relaxed),
+            .sparse_bind_count = sparse_bind_count.load(std::memory_order_relaxed),
+            .present_count = present_count.load(std::memory_order_relaxed),
+            .last_submit_time = std::chrono::nanoseconds{last_submit_time.load(std::memory_order_relaxed)},
+            .max_submit_time = std::chrono::nanoseconds{max_submit_time.load(std::memory_order_relaxed)},
+            .total_submit_time = std::chrono::nanoseconds{total_submit_time.load(std::memory_order_relaxed)},
+            .last_sparse_bind_time = std::chrono::nanoseconds{last_sparse_bind_time.load(std::memory_order_relaxed)},
+            .max_sparse_bind_time = std::chrono::nanoseconds{max_sparse_bind_time.load(std::memory_order_relaxed)},
+            .total_sparse_bind_time = std::chrono::nanoseconds{
+                    total_sparse_bind_time.load(std::memory_order_relaxed)},
+            .last_present_time = std::chrono::nanoseconds{last_present_time.load(std::memory_order_relaxed)},
+            .max_present_time = std::chrono::nanoseconds{max_present_time.load(std::memory_order_relaxed)},
+            .queue_depth = work.get_size(),
+            .max_queue_depth = max_queue_depth.load(std::memory_order_relaxed),
+    };
+}
+
+void SubmissionThread::log_stats(const char *const name) const {
+    const auto stats = get_stats();
+    const auto to_microseconds = [](const std::chrono::nanoseconds time) {
+        return std::chrono::duration<double, std::micro>{time}.count();
+    };
+    const auto get_average = [&](const std::chrono::nanoseconds total, const uint64_t count) {
+        return count ? to_microseconds(total) / static_cast<double>(count) : 0.0;
+    };
+    SDL_Log("%s queue: %llu submits, %.1f us average, %.1f us max", name,
+            static_cast<unsigned long long>(stats.submit_count),
+            get_average(stats.total_submit_time, stats.submit_count), to_microseconds(stats.max_submit_time));
+    if (stats.sparse_bind_count)
+        SDL_Log("%s queue: %llu sparse binds, %.1f us average, %.1f us max", name,
+                static_cast<unsigned long long>(stats.sparse_bind_count),
+                get_average(stats.total_sparse_bind_time, stats.sparse_bind_count),
+                to_microseconds(stats.max_sparse_bind_time));
+    if (stats.present_count)
+        SDL_Log("%s queue: %llu presents, %.1f us last, %.1f us max", name,
+                static_cast<unsigned long long>(stats.present_count), to_microseconds(stats.last_present_time),
+                to_microseconds(stats.max_present_time));
+    SDL_Log("%s queue: depth %zu, %zu max", name, stats.queue_depth, stats.max_queue_depth);
+}
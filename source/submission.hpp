@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "lockfree_queue.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+#include "threading.hpp"
+
+struct SubmitBatch {
+    std::vector<vk::SemaphoreSubmitInfo> wait_semaphores;
+    std::vector<vk::CommandBufferSubmitInfo> command_buffers;
+    std::vector<vk::SemaphoreSubmitInfo> signal_semaphores;
+};
+
+// Becomes exactly one vkQueueSubmit2 call, the command buffers must be fully recorded before it is handed over.
+struct QueueSubmission {
+    std::vector<SubmitBatch> batches;
+    vk::Fence fence{};
+};
+
+struct SparseImageBinds {
+    vk::Image image;
+    std::vector<vk::SparseImageMemoryBind> binds;
+};
+
+struct SparseOpaqueBinds {
+    vk::Image image;
+    std::vector<vk::SparseMemoryBind> binds;
+};
+
+// Becomes one vkQueueBindSparse call, the queue's family has to support sparse binding. Semaphore values are used for
+// timeline semaphores, stage masks are ignored.
+struct QueueSparseBinding {
+    std::vector<vk::SemaphoreSubmitInfo> wait_semaphores;
+    std::vector<SparseImageBinds> image_binds;
+    std::vector<SparseOpaqueBinds> opaque_binds;
+    std::vector<vk::SemaphoreSubmitInfo> signal_semaphores;
+    vk::Fence fence{};
+};
+
+struct QueuePresentation {
+    std::vector<vk::Semaphore> wait_semaphores;
+    vk::SwapchainKHR swapchain{};
+    uint32_t image_index{};
+};
+
+struct SubmissionStats {
+    uint64_t submit_count{};
+    uint64_t sparse_bind_count{};
+    uint64_t present_count{};
+    std::chrono::nanoseconds last_submit_time{};
+    std::chrono::nanoseconds max_submit_time{};
+    std::chrono::nanoseconds total_submit_time{};
+    std::chrono::nanoseconds last_sparse_bind_time{};
+    std::chrono::nanoseconds max_sparse_bind_time{};
+    std::chrono::nanoseconds total_sparse_bind_time{};
+    std::chrono::nanoseconds last_present_time{};
+    std::chrono::nanoseconds max_present_time{};
+    size_t queue_depth{};
+    size_t max_queue_depth{};
+};
+
+// Owns the queue and talks to the driver on its own thread, because submit and present can block for milliseconds.
+class SubmissionThread : Noncopyable {
+    using Work = std::variant<QueueSubmission, QueueSparseBinding, QueuePresentation>;
+
+    const vk::raii::Queue queue;
+    LockFreeQueue<Work> work;
+    std::atomic<uint32_t> wake_signal{0};
+    std::atomic<uint64_t> pushed_count{0};
+    std::atomic<uint64_t> completed_count{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<vk::Result> last_present_result{vk::Result::eSuccess};
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+
+    std::atomic<uint64_t> submit_count{0};
+    std::atomic<uint64_t> sparse_bind_count{0};
+    std::atomic<uint64_t> present_count{0};
+    std::atomic<int64_t> last_submit_time{0};
+    std::atomic<int64_t> max_submit_time{0};
+    std::atomic<int64_t> total_submit_time{0};
+    std::atomic<int64_t> last_sparse_bind_time{0};
+    std::atomic<int64_t> max_sparse_bind_time{0};
+    std::atomic<int64_t> total_sparse_bind_time{0};
+    std::atomic<int64_t> last_present_time{0};
+    std::atomic<int64_t> max_present_time{0};
+    std::atomic<size_t> max_queue_depth{0};
+
+    std::jthread thread;
+
+    void push(Work &&item);
+
+    void rethrow_error() const;
+
+    void process(QueueSubmission &submission);
+
+    void process(const QueueSparseBinding &binding);
+
+    void process(const QueuePresentation &presentation);
+
+    void run(const ThreadPlacement &placement);
+
+public:
+    SubmissionThread(vk::raii::Queue queue, const ThreadPlacement &placement, size_t capacity = 64);
+
+    ~SubmissionThread();
+
+    void submit(QueueSubmission submission);
+
+    void bind_sparse(QueueSparseBinding binding);
+
+    void present(QueuePresentation presentation);
+
+    // Blocks until everything handed over so far reached the driver.
+    void flush();
+
+    // The result of the latest present, eErrorOutOfDateKHR and eSuboptimalKHR ask for a swapchain recreation.
+    [[nodiscard]] vk::Result take_present_result() {
+        return last_present_result.exchange(vk::Result::eSuccess);
+    }
+
+    [[nodiscard]] SubmissionStats get_stats() const;
+
+    void log_stats(const char *name) const;
+
+    // Only touch it from other threads after a flush, the submission thread may be using it concurrently otherwise.
+    [[nodiscard]] const vk::raii::Queue &get_queue() const {
+        return queue;
+    }
+};
@@ -0,0 +1,230 @@
+// Checks that every SIMD path the machine runs gives results bit for bit equal to the scalar one, on random data and
+// on the cases vector code gets wrong most easily: NaNs, empty spheres and boxes, and tails shorter than a vector.
+// With --benchmark it times culling a million spheres and boxes on every level instead, on one thread and over jobs.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "simd_math.hpp"
+
+namespace {
+    // Cover empty input, tails of every length up to two AVX2 vectors and counts large enough to split over jobs.
+    constexpr std::array counts{size_t{0}, size_t{1}, size_t{3}, size_t{4}, size_t{5}, size_t{7}, size_t{8},
+                                size_t{9}, size_t{15}, size_t{16}, size_t{17}, size_t{1000}, size_t{100003}};
+
+    int failure_count{};
+
+    void check(const bool passed, const SimdLevel level, const std::string &what, const size_t count) {
+        if (passed)
+            return;
+        std::fprintf(stderr, "%s differs from scalar: %s with %zu elements\n", to_string(level).data(), what.c_str(),
+                     count);
+        ++failure_count;
+    }
+
+    // Bit for bit, except that any NaN matches any other. Which payload survives when two NaNs meet depends on the
+    // operand order, which the compiler may swap in the scalar code.
+    bool is_identical(const std::span<const float> left, const std::span<const float> right) {
+        return std::ranges::equal(left, right, [](const float left_value, const float right_value) {
+            return std::bit_cast<uint32_t>(left_value) == std::bit_cast<uint32_t>(right_value) ||
+                   (std::isnan(left_value) && std::isnan(right_value));
+        });
+    }
+
+    bool is_identical(const std::span<const Matrix4> left, const std::span<const Matrix4> right) {
+        return std::ranges::equal(left, right, [](const Matrix4 &left_matrix, const Matrix4 &right_matrix) {
+            return is_identical(std::span<const float>{left_matrix}, std::span<const float>{right_matrix});
+        });
+    }
+
+    struct TestData {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> extent_x;
+        std::vector<float> extent_y;
+        std::vector<float> extent_z;
+
+        TestData(const size_t count, std::mt19937 &random) {
+            std::uniform_real_distribution<float> position{-200.0f, 200.0f};
+            std::uniform_real_distribution<float> size{0.0f, 20.0f};
+            for (auto *const values: {&x, &y, &z})
+                for (size_t index{}; index < count; ++index)
+                    values->emplace_back(position(random));
+            for (auto *const values: {&extent_x, &extent_y, &extent_z})
+                for (size_t index{}; index < count; ++index)
+                    values->emplace_back(size(random));
+            // Every few elements one of the edge cases, at varying positions within the vectors.
+            constexpr auto nan = std::numeric_limits<float>::quiet_NaN();
+            constexpr auto infinity = std::numeric_limits<float>::infinity();
+            for (size_t index{}; index < count; index += 5) {
+                switch (index / 5 % 6) {
+                    case 0:
+                        x[index] = nan;
+                        break;
+                    case 1:
+                        extent_x[index] = 0.0f;
+                        extent_y[index] = 0.0f;
+                        extent_z[index] = 0.0f;
+                        break;
+                    case 2:
+                        extent_y[index] = nan;
+                        break;
+                    case 3:
+                        z[index] = infinity;
+                        break;
+                    case 4:
+                        x[index] = 0.0f;
+                        y[index] = 0.0f;
+                        z[index] = 0.0f;
+                        break;
+                    default:
+                        z[index] = -0.0f;
+                        break;
+                }
+            }
+        }
+    };
+
+    Matrix4 get_perspective(const float near, const float far) {
+        // Reversed depth, an infinite far plane when far is infinity.
+        const auto depth_scale = std::isinf(far) ? 0.0f : near / (far - near);
+        const auto depth_offset = std::isinf(far) ? near : far * near / (far - near);
+        return {1.2f, 0.0f, 0.0f, 0.0f, 0.0f, 1.8f, 0.0f, 0.0f, 0.0f, 0.0f, depth_scale, 1.0f,
+                0.0f, 0.0f, depth_offset, 0.0f};
+    }
+
+    void test_level(const SimdLevel level, JobSystem &jobs) {
+        std::mt19937 random{1};
+        const Matrix4 view{0.8f, 0.1f, 0.2f, 0.0f, -0.1f, 0.9f, 0.3f, 0.0f, 0.2f, -0.3f, 0.9f, 0.0f,
+                           10.0f, -20.0f, 30.0f, 1.0f};
+        const std::array frustums{
+                extract_frustum(multiply(get_perspective(0.1f, 500.0f), view, SimdLevel::Scalar)),
+                extract_frustum(multiply(get_perspective(0.1f, std::numeric_limits<float>::infinity()), view,
+                                         SimdLevel::Scalar))};
+
+        for (const auto count: counts) {
+            const TestData data{count, random};
+            const SphereArrays spheres{data.x, data.y, data.z, data.extent_x};
+            const BoxArrays boxes{data.x, data.y, data.z, data.extent_x, data.extent_y, data.extent_z};
+
+            for (const auto &frustum: frustums) {
+                std::vector<uint8_t> expected(count);
+                std::vector<uint8_t> visible(count);
+                cull_spheres(frustum, spheres, expected, SimdLevel::Scalar);
+                cull_spheres(frustum, spheres, visible, level);
+                check(expected == visible, level, "cull_spheres", count);
+                std::ranges::fill(visible, uint8_t{2});
+                cull_spheres(jobs, frustum, spheres, visible, level);
+                check(expected == visible, level, "cull_spheres over jobs", count);
+
+                cull_boxes(frustum, boxes, expected, SimdLevel::Scalar);
+                cull_boxes(frustum, boxes, visible, level);
+                check(expected == visible, level, "cull_boxes", count);
+                std::ranges::fill(visible, uint8_t{2});
+                cull_boxes(jobs, frustum, boxes, visible, level);
+                check(expected == visible, level, "cull_boxes over jobs", count);
+            }
+
+            const PointArrays points{data.x, data.y, data.z};
+            std::array<std::vector<float>, 3> expected{std::vector<float>(count), std::vector<float>(count),
+                                                       std::vector<float>(count)};
+            std::array<std::vector<float>, 3> transformed{expected};
+            transform_points(view, points, {expected[0], expected[1], expected[2]}, SimdLevel::Scalar);
+            transform_points(view, points, {transformed[0], transformed[1], transformed[2]}, level);
+            for (size_t axis{}; axis < 3; ++axis)
+                check(is_identical(expected[axis], transformed[axis]), level, "transform_points", count);
+
+            // Random matrices with edge case entries, and the output aliasing the left input.
+            std::uniform_real_distribution<float> entry{-4.0f, 4.0f};
+            std::vector<Matrix4> left(count);
+            std::vector<Matrix4> right(count);
+            for (auto &matrix: left)
+                for (auto &value: matrix)
+                    value = entry(random);
+            for (auto &matrix: right)
+                for (auto &value: matrix)
+                    value = entry(random);
+            for (size_t index{}; index < count; index += 7)
+                right[index][index % 16] = data.x[index];
+            std::vector<Matrix4> expected_products(count);
+            std::vector<Matrix4> products(count);
+            multiply(left, right, expected_products, SimdLevel::Scalar);
+            multiply(left, right, products, level);
+            check(is_identical(expected_products, products), level, "multiply", count);
+            multiply(left, right, left, level);
+            check(is_identical(expected_products, left), level, "multiply in place", count);
+            if (count > 0) {
+                const auto product = multiply(right[0], view, level);
+                const auto expected_product = multiply(right[0], view, SimdLevel::Scalar);
+                check(is_identical(std::span{&product, 1}, std::span{&expected_product, 1}), level,
+                      "multiply of one matrix", count);
+            }
+        }
+    }
+
+    // The best of a few runs, the first one warms the caches and the workers up.
+    template<typename Function>
+    double get_best_milliseconds(const Function &function) {
+        std::chrono::duration<double, std::milli> best{std::chrono::duration<double, std::milli>::max()};
+        for (int run{}; run < 10; ++run) {
+            const auto start = std::chrono::steady_clock::now();
+            function();
+            best = std::min(best, std::chrono::duration<double, std::milli>{std::chrono::steady_clock::now() - start});
+        }
+        return best.count();
+    }
+
+    void benchmark(JobSystem &jobs) {
+        constexpr size_t count{1'000'000};
+        std::mt19937 random{1};
+        const TestData data{count, random};
+        const SphereArrays spheres{data.x, data.y, data.z, data.extent_x};
+        const BoxArrays boxes{data.x, data.y, data.z, data.extent_x, data.extent_y, data.extent_z};
+        const Matrix4 view{0.8f, 0.1f, 0.2f, 0.0f, -0.1f, 0.9f, 0.3f, 0.0f, 0.2f, -0.3f, 0.9f, 0.0f,
+                           10.0f, -20.0f, 30.0f, 1.0f};
+        const auto frustum = extract_frustum(multiply(get_perspective(0.1f, 500.0f), view, SimdLevel::Scalar));
+        std::vector<uint8_t> visible(count);
+
+        std::printf("%zu elements, %zu workers, milliseconds\n", count, jobs.get_worker_count());
+        std::printf("%-8s %10s %10s %10s %10s\n", "", "spheres", "over jobs", "boxes", "over jobs");
+        for (const auto level: {SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon}) {
+            if (!is_supported(level))
+                continue;
+            std::printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", to_string(level).data(),
+                        get_best_milliseconds([&]() { cull_spheres(frustum, spheres, visible, level); }),
+                        get_best_milliseconds([&]() { cull_spheres(jobs, frustum, spheres, visible, level); }),
+                        get_best_milliseconds([&]() { cull_boxes(frustum, boxes, visible, level); }),
+                        get_best_milliseconds([&]() { cull_boxes(jobs, frustum, boxes, visible, level); }));
+        }
+    }
+}
+
+int main(const int argc, const char *const *const argv) {
+    JobSystem jobs{ThreadPlacement::plan(CpuTopology::detect(), ThreadingConfig{.pinning = false})};
+    if (argc > 1 && std::string_view{argv[1]} == "--benchmark") {
+        benchmark(jobs);
+        return EXIT_SUCCESS;
+    }
+    for (const auto level: {SimdLevel::Sse2, SimdLevel::Avx2, SimdLevel::Neon}) {
+        if (!is_supported(level)) {
+            std::printf("%s isn't supported, skipped\n", to_string(level).data());
+            continue;
+        }
+        test_level(level, jobs);
+        std::printf("%s checked\n", to_string(level).data());
+    }
+    return failure_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
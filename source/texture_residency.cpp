@@ -0,0 +1,299 @@
+#include "texture_residency.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <ranges>
+#include <stdexcept>
+
+#include "config.hpp"
+#include "gpu_helpers.hpp"
+
+namespace {
+    constexpr vk::ImageSubresourceRange all_mips{vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0, 1};
+
+    vk::Extent2D get_mip_extent(const vk::Extent2D extent, const uint32_t mip) {
+        return {std::max(extent.width >> mip, 1u), std::max(extent.height >> mip, 1u)};
+    }
+
+    vk::DeviceSize get_mip_bytes(const TextureDescription &description, const uint32_t mip) {
+        return get_image_bytes(description.format, get_mip_extent(description.extent, mip));
+    }
+}
+
+TextureResidencyConfig TextureResidencyConfig::from_environment() {
+    TextureResidencyConfig config{};
+    config.budget = get_config("APP_TEXTURE_BUDGET", config.budget);
+    config.budget_share = get_config("APP_TEXTURE_BUDGET_SHARE", config.budget_share);
+    config.grace_frames = get_config("APP_TEXTURE_GRACE_FRAMES", config.grace_frames);
+    config.resident_tail_size = get_config("APP_TEXTURE_RESIDENT_TAIL_SIZE", config.resident_tail_size);
+    config.upload_bytes_per_frame = get_config("APP_TEXTURE_UPLOAD_BYTES_PER_FRAME", config.upload_bytes_per_frame);
+    return config;
+}
+
+TextureResidencyManager::TextureResidencyManager(const vk::raii::Device &device, DeviceAllocator &allocator,
+                                                 DeferredDeletionQueue &deferred_deletion_queue,
+                                                 MemoryGovernor &memory_governor, const TextureResidencyConfig config)
+        : device{device}, allocator{allocator}, deferred_deletion_queue{deferred_deletion_queue},
+          memory_governor{memory_governor}, config{config},
+          pressure_callback_id{memory_governor.add_pressure_callback([this](const MemoryPressureEvent &event) {
+              if (!event.heap.is_device_local)
+                  return;
+              // Gives the excess back from the textures, the least recently used mips go first.
+              const auto limit = resident_bytes - std::min(event.excess, resident_bytes);
+              pressure_limit = std::min(pressure_limit.value_or(limit), limit);
+              ignore_grace = ignore_grace || event.pressure == MemoryPressure::Hard;
+          })} {}
+
+TextureResidencyManager::~TextureResidencyManager() {
+    memory_governor.remove_pressure_callback(pressure_callback_id);
+}
+
+TextureResidencyManager::Texture &TextureResidencyManager::get(const TextureId id) {
+    return *textures.at(id - 1);
+}
+
+const TextureResidencyManager::Texture &TextureResidencyManager::get(const TextureId id) const {
+    return *textures.at(id - 1);
+}
+
+TextureId TextureResidencyManager::create(const TextureDescription &description, MipLoader loader) {
+    if (description.mip_count == 0)
+        throw std::invalid_argument{"Textures need at least one mip"};
+    uint32_t tail_mip{description.mip_count - 1};
+    while (tail_mip > 0) {
+        const auto extent = get_mip_extent(description.extent, tail_mip - 1);
+        if (std::max(extent.width, extent.height) > config.resident_tail_size)
+            break;
+        --tail_mip;
+    }
+    Texture texture{description, std::move(loader), {}, std::nullopt, description.mip_count, tail_mip,
+                    std::vector<uint64_t>(description.mip_count)};
+    if (!free_ids.empty()) {
+        const auto id = free_ids.back();
+        free_ids.pop_back();
+        textures[id - 1].emplace(std::move(texture));
+        return id;
+    }
+    textures.emplace_back(std::move(texture));
+    return static_cast<TextureId>(textures.size());
+}
+
+void TextureResidencyManager::destroy(const TextureId id) {
+    auto &texture = get(id);
+    for (auto mip = texture.resident_mip; mip < texture.description.mip_count; ++mip)
+        resident_bytes -= get_mip_bytes(texture.description, mip);
+    if (texture.image)
+        allocator.destroy(texture.image);
+    if (texture.view)
+        deferred_deletion_queue.retire(std::move(*texture.view));
+    textures[id - 1].reset();
+    free_ids.emplace_back(id);
+}
+
+void TextureResidencyManager::mark_used(const TextureId id, const uint32_t mip) {
+    auto &texture = get(id);
+    for (auto used = std::min(mip, texture.description.mip_count - 1); used < texture.description.mip_count; ++used)
+        texture.last_used[used] = frame;
+}
+
+void TextureResidencyManager::apply_feedback(const std::span<const uint32_t> finest_mips) {
+    for (size_t index{}; index < std::min(finest_mips.size(), textures.size()); ++index)
+        if (textures[index] && finest_mips[index] != std::numeric_limits<uint32_t>::max())
+            mark_used(static_cast<TextureId>(index + 1), finest_mips[index]);
+}
+
+void TextureResidencyManager::begin_frame() {
+    ++frame;
+    if (memory_governor.get_pressure() == MemoryPressure::None) {
+        pressure_limit.reset();
+        ignore_grace = false;
+    }
+}
+
+vk::DeviceSize TextureResidencyManager::get_budget() const {
+    auto budget = config.budget;
+    if (!budget) {
+        for (const auto &heap: memory_governor.get_heaps())
+            if (heap.is_device_local)
+                budget += heap.budget;
+        budget = static_cast<vk::DeviceSize>(static_cast<double>(budget) * config.budget_share);
+    }
+    return std::min(budget, pressure_limit.value_or(budget));
+}
+
+void TextureResidencyManager::record(const vk::raii::CommandBuffer &command_buffer) {
+    // Finest resident mip every texture ends up with this frame.
+    std::vector<uint32_t> targets(textures.size());
+    vk::DeviceSize target_bytes{resident_bytes};
+    vk::DeviceSize upload_bytes{};
+
+    // Tails aren't optional, they come in whatever the budget says.
+    for (auto &&[index, texture]: std::views::enumerate(textures)) {
+        if (!texture)
+            continue;
+        targets[index] = texture->resident_mip;
+        for (; targets[index] > texture->tail_mip; --targets[index]) {
+            const auto bytes = get_mip_bytes(texture->description, targets[index] - 1);
+            target_bytes += bytes;
+            upload_bytes += bytes;
+        }
+    }
+
+    // Mips sampled this frame but missing, coarse ones first since they're cheaper and more visible.
+    struct Wanted {
+        size_t index;
+        uint32_t mip;
+    };
+    std::vector<Wanted> wanted;
+    vk::DeviceSize wanted_bytes{};
+    for (auto &&[index, texture]: std::views::enumerate(textures)) {
+        if (!texture)
+            continue;
+        for (auto mip = targets[index]; mip > 0 && texture->last_used[mip - 1] == frame; --mip) {
+            wanted.push_back({static_cast<size_t>(index), mip - 1});
+            wanted_bytes += get_mip_bytes(texture->description, mip - 1);
+        }
+    }
+    std::ranges::stable_sort(wanted, std::ranges::greater{}, &Wanted::mip);
+
+    // Least recently used finest resident mips go until the wanted ones fit, only the finest one of a texture can go.
+    const auto budget = get_budget();
+    using Candidate = std::pair<uint64_t, size_t>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> candidates;
+    const auto push_candidate = [&](const size_t index) {
+        const auto &texture = *textures[index];
+        const auto mip = targets[index];
+        if (mip >= texture.tail_mip)
+            return;
+        const auto last_used = texture.last_used[mip];
+        if (last_used == frame || (!ignore_grace && last_used + config.grace_frames > frame))
+            return;
+        candidates.emplace(last_used, index);
+    };
+    for (size_t index{}; index < textures.size(); ++index)
+        if (textures[index])
+            push_candidate(index);
+    while (target_bytes + wanted_bytes > budget && !candidates.empty()) {
+        const auto index = candidates.top().second;
+        candidates.pop();
+        target_bytes -= get_mip_bytes(textures[index]->description, targets[index]);
+        ++targets[index];
+        ++evicted_mips;
+        push_candidate(index);
+    }
+
+    for (const auto &[index, mip]: wanted) {
+        // Coarser mips of the texture must have made it for this one to count.
+        if (targets[index] != mip + 1) {
+            ++deferred_mips;
+            continue;
+        }
+        const auto bytes = get_mip_bytes(textures[index]->description, mip);
+        if (target_bytes + bytes > budget || upload_bytes + bytes > config.upload_bytes_per_frame) {
+            ++deferred_mips;
+            continue;
+        }
+        target_bytes += bytes;
+        upload_bytes += bytes;
+        targets[index] = mip;
+        ++streamed_mips;
+    }
+
+    for (auto &&[index, texture]: std::views::enumerate(textures))
+        if (texture && targets[index] != texture->resident_mip)
+            record_resize(command_buffer, *texture, targets[index]);
+    resident_bytes = target_bytes;
+}
+
+void TextureResidencyManager::record_resize(const vk::raii::CommandBuffer &command_buffer, Texture &texture,
+                                            const uint32_t resident_mip) {
+    const auto &description = texture.description;
+    const auto old_resident_mip = texture.resident_mip;
+    const auto extent = get_mip_extent(description.extent, resident_mip);
+    const auto image_id = allocator.create_image(
+            vk::ImageCreateInfo{{}, vk::ImageType::e2D, description.format, vk::Extent3D{extent, 1},
+                                description.mip_count - resident_mip, 1, vk::SampleCountFlagBits::e1,
+                                vk::ImageTiling::eOptimal,
+                                description.usage | vk::ImageUsageFlagBits::eTransferSrc |
+                                vk::ImageUsageFlagBits::eTransferDst}, MemoryUsage::DeviceLocal);
+    const auto image = allocator.get_image(image_id);
+
+    std::vector barriers{get_image_barrier(image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                                           all_mips)};
+    if (texture.image)
+        barriers.emplace_back(get_image_barrier(allocator.get_image(texture.image),
+                                                vk::ImageLayout::eShaderReadOnlyOptimal,
+                                                vk::ImageLayout::eTransferSrcOptimal, all_mips));
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barriers});
+
+    // Kept mips move over on the GPU.
+    if (texture.image) {
+        std::vector<vk::ImageCopy> copies;
+        for (auto mip = std::max(resident_mip, old_resident_mip); mip < description.mip_count; ++mip)
+            copies.emplace_back(vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, mip - old_resident_mip, 0, 1},
+                                vk::Offset3D{},
+                                vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, mip - resident_mip, 0, 1},
+                                vk::Offset3D{}, vk::Extent3D{get_mip_extent(description.extent, mip), 1});
+        command_buffer.copyImage(allocator.get_image(texture.image), vk::ImageLayout::eTransferSrcOptimal, image,
+                                 vk::ImageLayout::eTransferDstOptimal, copies);
+    }
+
+    // New mips come from the loader through staging memory, released by the allocator once the frame is done.
+    if (resident_mip < old_resident_mip) {
+        vk::DeviceSize staging_size{};
+        for (auto mip = resident_mip; mip < old_resident_mip; ++mip)
+            staging_size += get_mip_bytes(description, mip);
+        const auto staging = allocator.create_buffer(
+                vk::BufferCreateInfo{{}, staging_size, vk::BufferUsageFlagBits::eTransferSrc}, MemoryUsage::Upload);
+        const auto mapped = allocator.get_mapped(staging);
+        std::vector<vk::BufferImageCopy> copies;
+        vk::DeviceSize offset{};
+        for (auto mip = resident_mip; mip < old_resident_mip; ++mip) {
+            const auto bytes = get_mip_bytes(description, mip);
+            texture.loader(mip, {mapped + offset, bytes});
+            copies.emplace_back(offset, 0, 0,
+                                vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, mip - resident_mip, 0, 1},
+                                vk::Offset3D{}, vk::Extent3D{get_mip_extent(description.extent, mip), 1});
+            offset += bytes;
+        }
+        allocator.flush(staging);
+        command_buffer.copyBufferToImage(allocator.get_buffer(staging), image, vk::ImageLayout::eTransferDstOptimal,
+                                         copies);
+        allocator.destroy(staging);
+    }
+
+    const auto ready = get_image_barrier(image, vk::ImageLayout::eTransferDstOptimal,
+                                         vk::ImageLayout::eShaderReadOnlyOptimal, all_mips);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, ready});
+    allocator.set_image_layout(image_id, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    if (texture.image)
+        allocator.destroy(texture.image);
+    texture.image = image_id;
+    texture.resident_mip = resident_mip;
+    create_view(texture);
+}
+
+void TextureResidencyManager::create_view(Texture &texture) {
+    if (texture.view)
+        deferred_deletion_queue.retire(std::move(*texture.view));
+    texture.view.emplace(device, vk::ImageViewCreateInfo{
+            {}, allocator.get_image(texture.image), vk::ImageViewType::e2D, texture.description.format, {},
+            all_mips});
+}
+
+void TextureResidencyManager::handle_move(const AllocationId id) {
+    for (auto &texture: textures)
+        if (texture && texture->image == id)
+            create_view(*texture);
+}
+
+vk::ImageView TextureResidencyManager::get_view(const TextureId id) const {
+    const auto &texture = get(id);
+    return texture.view ? **texture.view : vk::ImageView{};
+}
+
+TextureResidencyStats TextureResidencyManager::get_stats() const {
+    return {get_budget(), resident_bytes, streamed_mips, evicted_mips, deferred_mips};
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "memory_allocator.hpp"
+#include "memory_budget.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+
+// Zero stands for no texture.
+using TextureId = uint32_t;
+
+struct TextureResidencyConfig {
+    // Zero takes budget_share of the device local budget instead.
+    vk::DeviceSize budget{};
+    float budget_share{0.5f};
+    // Mips used within this many frames are never evicted, so a camera swinging back doesn't stream them in again.
+    uint32_t grace_frames{60};
+    // Mips at most this size always stay resident, there is always something to sample.
+    uint32_t resident_tail_size{64};
+    vk::DeviceSize upload_bytes_per_frame{32ull << 20};
+
+    [[nodiscard]] static TextureResidencyConfig from_environment();
+};
+
+struct TextureDescription {
+    vk::Extent2D extent;
+    vk::Format format;
+    uint32_t mip_count;
+    vk::ImageUsageFlags usage{vk::ImageUsageFlagBits::eSampled};
+};
+
+// Writes the tightly packed data of a mip into the staging memory, called on the thread recording the uploads.
+using MipLoader = std::function<void(uint32_t mip, std::span<std::byte> destination)>;
+
+struct TextureResidencyStats {
+    vk::DeviceSize budget{};
+    vk::DeviceSize resident_bytes{};
+    uint64_t streamed_mips{};
+    uint64_t evicted_mips{};
+    // Mips wanted but left out because the budget was full of recently used ones.
+    uint64_t deferred_mips{};
+};
+
+// Keeps the mips textures are sampled at resident and evicts the least recently used ones once over budget. A texture
+// is one image holding a contiguous range of its mips down to the smallest, changing the range recreates the image at
+// the new size and copies the kept mips over on the GPU. Normalized coordinates sample the smaller image just the
+// same, only sharper mips are missing. Views change with that, so they are looked up every frame.
+class TextureResidencyManager : Noncopyable {
+    struct Texture {
+        TextureDescription description;
+        MipLoader loader;
+        AllocationId image{};
+        std::optional<vk::raii::ImageView> view;
+        // Finest resident mip, mip_count while nothing is.
+        uint32_t resident_mip;
+        // Mips finer than this are never evicted since they are the tail.
+        uint32_t tail_mip;
+        std::vector<uint64_t> last_used;
+    };
+
+    const vk::raii::Device &device;
+    DeviceAllocator &allocator;
+    DeferredDeletionQueue &deferred_deletion_queue;
+    MemoryGovernor &memory_governor;
+    const TextureResidencyConfig config;
+    const uint32_t pressure_callback_id;
+
+    std::vector<std::optional<Texture>> textures;
+    std::vector<TextureId> free_ids;
+    uint64_t frame{};
+    vk::DeviceSize resident_bytes{};
+    // Lowered by memory pressure below the configured budget, lifted again once the pressure is gone.
+    std::optional<vk::DeviceSize> pressure_limit;
+    bool ignore_grace{};
+    uint64_t streamed_mips{};
+    uint64_t evicted_mips{};
+    uint64_t deferred_mips{};
+
+    [[nodiscard]] Texture &get(TextureId id);
+
+    [[nodiscard]] const Texture &get(TextureId id) const;
+
+    [[nodiscard]] vk::DeviceSize get_budget() const;
+
+    // Records the switch of a texture to its new resident range.
+    void record_resize(const vk::raii::CommandBuffer &command_buffer, Texture &texture, uint32_t resident_mip);
+
+    void create_view(Texture &texture);
+
+public:
+    TextureResidencyManager(const vk::raii::Device &device, DeviceAllocator &allocator,
+                            DeferredDeletionQueue &deferred_deletion_queue, MemoryGovernor &memory_governor,
+                            TextureResidencyConfig config = TextureResidencyConfig::from_environment());
+
+    ~TextureResidencyManager();
+
+    // Only the tail becomes resident right away, on the next record.
+    [[nodiscard]] TextureId create(const TextureDescription &description, MipLoader loader);
+
+    void destroy(TextureId id);
+
+    // CPU visibility: the texture is sampled at the mip this frame, coarser ones come with it.
+    void mark_used(TextureId id, uint32_t mip);
+
+    // GPU feedback: the finest mip each texture was sampled at, indexed by id - 1, UINT32_MAX for textures that
+    // weren't sampled. Shaders atomicMin into a buffer read back a few frames later.
+    void apply_feedback(std::span<const uint32_t> finest_mips);
+
+    // Call once per frame before the uses of the frame are marked.
+    void begin_frame();
+
+    // Evicts and streams in for the uses marked so far, has to come before any command buffer sampling the textures.
+    void record(const vk::raii::CommandBuffer &command_buffer);
+
+    // For the allocator's move callback, defragmentation gives images new handles.
+    void handle_move(AllocationId id);
+
+    // Null until the tail got recorded. Valid for this frame.
+    [[nodiscard]] vk::ImageView get_view(TextureId id) const;
+
+    [[nodiscard]] uint32_t get_resident_mip(TextureId id) const {
+        return get(id).resident_mip;
+    }
+
+    [[nodiscard]] TextureResidencyStats get_stats() const;
+};
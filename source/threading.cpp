@@ -0,0 +1,393 @@
+#include "threading.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <ranges>
+#include <string>
+
+#include <SDL.h>
+
+#include "config.hpp"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+    std::optional<std::string> read_sysfs(const std::string &path) {
+        std::ifstream file{path};
+        if (!file)
+            return std::nullopt;
+        std::string content;
+        std::getline(file, content);
+        return content;
+    }
+
+    std::optional<uint32_t> read_sysfs_uint(const std::string &path) {
+        if (const auto content = read_sysfs(path)) {
+            try {
+                return static_cast<uint32_t>(std::stoul(*content));
+            } catch (const std::exception &) {}
+        }
+        return std::nullopt;
+    }
+
+    // Parses the kernel cpu list format, for example "0-3,8,10-11".
+    std::vector<uint32_t> parse_cpu_list(const std::string &list) {
+        std::vector<uint32_t> cpus;
+        for (const auto range: list | std::views::split(',')) {
+            const std::string item{range.begin(), range.end()};
+            if (item.empty())
+                continue;
+            try {
+                if (const auto dash = item.find('-'); dash != std::string::npos) {
+                    const auto first = std::stoul(item.substr(0, dash));
+                    const auto last = std::stoul(item.substr(dash + 1));
+                    for (auto cpu = first; cpu <= last; ++cpu)
+                        cpus.emplace_back(static_cast<uint32_t>(cpu));
+                } else {
+                    cpus.emplace_back(static_cast<uint32_t>(std::stoul(item)));
+                }
+            } catch (const std::exception &) {}
+        }
+        return cpus;
+    }
+
+    // Marks the less capable cores as efficiency cores, using the most precise source the kernel exposes.
+    void classify_core_kinds(std::vector<LogicalCore> &cores) {
+        // Intel hybrid parts register separate PMUs for their P and E cores.
+        if (const auto atom_cpus = read_sysfs("/sys/devices/cpu_atom/cpus")) {
+            const auto efficiency_cpus = parse_cpu_list(*atom_cpus);
+            for (auto &core: cores)
+                if (std::ranges::contains(efficiency_cpus, core.index))
+                    core.kind = CoreKind::Efficiency;
+            return;
+        }
+        // ARM big.LITTLE reports a normalized capacity, everything else at least has a maximum frequency.
+        for (const auto *const metric: {"/cpu_capacity", "/cpufreq/cpuinfo_max_freq"}) {
+            std::vector<uint32_t> values;
+            for (const auto &core: cores) {
+                const auto value = read_sysfs_uint("/sys/devices/system/cpu/cpu" + std::to_string(core.index) + metric);
+                if (!value)
+                    break;
+                values.emplace_back(*value);
+            }
+            if (values.size() != cores.size())
+                continue;
+            const auto [minimum, maximum] = std::ranges::minmax(values);
+            if (minimum == maximum)
+                return;
+            for (auto &&[core, value]: std::views::zip(cores, values))
+                if (value < maximum)
+                    core.kind = CoreKind::Efficiency;
+            return;
+        }
+    }
+
+    std::vector<LogicalCore> detect_logical_cores() {
+        std::vector<uint32_t> online_cpus;
+        if (const auto online = read_sysfs("/sys/devices/system/cpu/online"))
+            online_cpus = parse_cpu_list(*online);
+
+        std::vector<LogicalCore> cores;
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> physical_cores;
+        for (const auto cpu: online_cpus) {
+            const auto topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+            const auto package = read_sysfs_uint(topology + "physical_package_id").value_or(0);
+            auto siblings = parse_cpu_list(read_sysfs(topology + "thread_siblings_list").value_or(""));
+            if (siblings.empty())
+                siblings.emplace_back(cpu);
+            const auto first_sibling = std::ranges::min(siblings);
+            const auto [iterator, _] = physical_cores.try_emplace({package, first_sibling},
+                                                                  static_cast<uint32_t>(physical_cores.size()));
+            cores.emplace_back(cpu, iterator->second, package, CoreKind::Performance, first_sibling == cpu);
+        }
+        classify_core_kinds(cores);
+        return cores;
+    }
+#elif defined(_WIN32)
+    std::vector<LogicalCore> detect_logical_cores() {
+        DWORD length{};
+        GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &length);
+        std::vector<std::byte> buffer(length);
+        if (!GetLogicalProcessorInformationEx(RelationProcessorCore,
+                                              reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()),
+                                              &length))
+            return {};
+
+        std::vector<std::pair<BYTE, std::vector<uint32_t>>> physical_cores;
+        for (size_t offset{}; offset < length;) {
+            const auto &info = *reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+            offset += info.Size;
+            // Affinity masks are only handled for the first processor group.
+            if (info.Processor.GroupMask[0].Group != 0)
+                continue;
+            std::vector<uint32_t> threads;
+            for (uint32_t bit{}; bit < sizeof(KAFFINITY) * 8; ++bit)
+                if (info.Processor.GroupMask[0].Mask & (KAFFINITY{1} << bit))
+                    threads.emplace_back(bit);
+            physical_cores.emplace_back(info.Processor.EfficiencyClass, std::move(threads));
+        }
+
+        if (physical_cores.empty())
+            return {};
+        const auto highest_class = std::ranges::max(physical_cores | std::views::keys);
+        std::vector<LogicalCore> cores;
+        for (const auto &[physical_core, entry]: std::views::enumerate(physical_cores)) {
+            const auto &[efficiency_class, threads] = entry;
+            for (const auto thread: threads)
+                cores.emplace_back(thread, static_cast<uint32_t>(physical_core), 0,
+                                   efficiency_class < highest_class ? CoreKind::Efficiency : CoreKind::Performance,
+                                   thread == threads.front());
+        }
+        std::ranges::sort(cores, {}, &LogicalCore::index);
+        return cores;
+    }
+#else
+    std::vector<LogicalCore> detect_logical_cores() {
+        return {};
+    }
+#endif
+
+#if defined(__linux__) || defined(_WIN32)
+    constexpr auto is_pinning_supported{true};
+#else
+    constexpr auto is_pinning_supported{false};
+#endif
+
+    std::optional<ThreadPriority> parse_priority(const std::optional<std::string_view> name) {
+        if (name == "normal")
+            return ThreadPriority::Normal;
+        if (name == "high")
+            return ThreadPriority::High;
+        if (name == "realtime")
+            return ThreadPriority::Realtime;
+        return std::nullopt;
+    }
+
+    std::string to_string(std::span<const uint32_t> cores) {
+        if (cores.empty())
+            return "any";
+        std::string result;
+        for (const auto core: cores)
+            result += (result.empty() ? "" : ",") + std::to_string(core);
+        return result;
+    }
+}
+
+CpuTopology CpuTopology::detect() {
+    auto cores = detect_logical_cores();
+    // Without topology information every hardware thread is treated as its own performance core.
+    if (cores.empty())
+        for (uint32_t index{}; index < std::max(std::thread::hardware_concurrency(), 1u); ++index)
+            cores.emplace_back(index, index, 0, CoreKind::Performance, true);
+    return CpuTopology{std::move(cores)};
+}
+
+std::vector<uint32_t> CpuTopology::get_siblings(const uint32_t index) const {
+    const auto core = std::ranges::find(logical_cores, index, &LogicalCore::index);
+    if (core == logical_cores.end())
+        return {};
+    std::vector<uint32_t> siblings;
+    for (const auto &other: logical_cores)
+        if (other.physical_core == core->physical_core && other.index != index)
+            siblings.emplace_back(other.index);
+    return siblings;
+}
+
+size_t CpuTopology::get_physical_core_count() const {
+    return std::ranges::count(logical_cores, true, &LogicalCore::is_primary_thread);
+}
+
+bool CpuTopology::has_efficiency_cores() const {
+    return std::ranges::contains(logical_cores, CoreKind::Efficiency, &LogicalCore::kind);
+}
+
+ThreadingConfig ThreadingConfig::from_environment() {
+    ThreadingConfig config{};
+    config.pinning = get_config("APP_THREAD_PINNING", config.pinning);
+    config.render_core = get_config<uint32_t>("APP_RENDER_CORE");
+    config.submit_core = get_config<uint32_t>("APP_SUBMIT_CORE");
+    config.render_priority = parse_priority(get_config<std::string_view>("APP_RENDER_PRIORITY")).value_or(
+            config.render_priority);
+    config.submit_priority = parse_priority(get_config<std::string_view>("APP_SUBMIT_PRIORITY")).value_or(
+            config.submit_priority);
+    config.worker_count = get_config("APP_WORKER_COUNT", config.worker_count);
+    config.workers_use_smt_siblings = get_config("APP_WORKERS_USE_SMT", config.workers_use_smt_siblings);
+    config.workers_use_efficiency_cores = get_config("APP_WORKERS_USE_EFFICIENCY_CORES",
+                                                     config.workers_use_efficiency_cores);
+    return config;
+}
+
+ThreadPlacement ThreadPlacement::plan(const CpuTopology &topology, const ThreadingConfig &config) {
+    ThreadPlacement placement{};
+    placement.render_priority = config.render_priority;
+    placement.submit_priority = config.submit_priority;
+
+    std::vector<uint32_t> performance_cores;
+    std::vector<uint32_t> efficiency_cores;
+    for (const auto &core: topology.get_logical_cores())
+        if (core.is_primary_thread)
+            (core.kind == CoreKind::Performance ? performance_cores : efficiency_cores).emplace_back(core.index);
+    if (performance_cores.empty())
+        std::swap(performance_cores, efficiency_cores);
+
+    std::vector<uint32_t> taken;
+    const auto take_performance_core = [&](const std::optional<uint32_t> requested) -> std::vector<uint32_t> {
+        if (requested) {
+            taken.emplace_back(*requested);
+            return {*requested};
+        }
+        // Core 0 services most interrupts, so frame critical threads start looking from the second core.
+        for (const auto core: performance_cores | std::views::drop(performance_cores.size() > 2 ? 1 : 0))
+            if (!std::ranges::contains(taken, core)) {
+                taken.emplace_back(core);
+                return {core};
+            }
+        return {};
+    };
+
+    const auto worker_count_hint = std::max<size_t>(std::thread::hardware_concurrency(), 2) - 1;
+    if (config.pinning && is_pinning_supported) {
+        placement.render_cores = take_performance_core(config.render_core);
+        placement.submit_cores = take_performance_core(config.submit_core);
+
+        std::vector<uint32_t> worker_candidates;
+        for (const auto core: performance_cores)
+            if (!std::ranges::contains(taken, core))
+                worker_candidates.emplace_back(core);
+        if (config.workers_use_smt_siblings)
+            for (const auto core: std::vector{worker_candidates})
+                std::ranges::copy(topology.get_siblings(core), std::back_inserter(worker_candidates));
+        if (config.workers_use_efficiency_cores)
+            std::ranges::copy(efficiency_cores, std::back_inserter(worker_candidates));
+
+        const auto worker_count = config.worker_count ? config.worker_count : std::max<size_t>(
+                worker_candidates.size(), 1);
+        for (size_t worker{}; worker < worker_count; ++worker) {
+            if (worker < worker_candidates.size())
+                placement.worker_cores.push_back({worker_candidates[worker]});
+            else
+                placement.worker_cores.emplace_back();
+        }
+    } else {
+        placement.worker_cores.resize(config.worker_count ? config.worker_count : worker_count_hint);
+    }
+    return placement;
+}
+
+void ThreadPlacement::apply(const ThreadRole role, const size_t worker_index) const {
+    const auto [cores, priority] = [&]() -> std::pair<std::span<const uint32_t>, ThreadPriority> {
+        switch (role) {
+            case ThreadRole::Render:
+                return {render_cores, render_priority};
+            case ThreadRole::Submit:
+                return {submit_cores, submit_priority};
+            case ThreadRole::Worker:
+                return {worker_index < worker_cores.size() ? std::span{worker_cores[worker_index]}
+                                                           : std::span<const uint32_t>{}, ThreadPriority::Normal};
+            default:
+                std::unreachable();
+        }
+    }();
+    if (!cores.empty() && !pin_current_thread(cores))
+        SDL_LogWarn(SDL_LOG_CATEGORY_SYSTEM, "Couldn't pin thread to cores %s", to_string(cores).data());
+    if (priority != ThreadPriority::Normal && !set_current_thread_priority(priority))
+        SDL_LogWarn(SDL_LOG_CATEGORY_SYSTEM, "Couldn't raise thread priority, missing privileges?");
+}
+
+void ThreadPlacement::log() const {
+    SDL_Log("Thread placement: render {%s} submit {%s}", to_string(render_cores).data(),
+            to_string(submit_cores).data());
+    for (const auto &[worker, cores]: std::views::enumerate(worker_cores))
+        SDL_Log("Thread placement: worker %zu {%s}", static_cast<size_t>(worker), to_string(cores).data());
+}
+
+bool pin_current_thread(const std::span<const uint32_t> cores) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto core: cores)
+        CPU_SET(core, &set);
+    // A thread id of 0 targets the calling thread, which also works on Android where pthread affinity is missing.
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    DWORD_PTR mask{};
+    for (const auto core: cores)
+        mask |= DWORD_PTR{1} << core;
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+
+bool set_current_thread_priority(const ThreadPriority priority) {
+#if defined(__linux__)
+    if (priority == ThreadPriority::Realtime) {
+        sched_param parameters{};
+        parameters.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+        if (sched_setscheduler(0, SCHED_FIFO, &parameters) == 0)
+            return true;
+    }
+    // Linux schedules threads individually, so a per thread nice value only affects the calling thread.
+    return setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+                       priority == ThreadPriority::Normal ? 0 : -10) == 0;
+#elif defined(_WIN32)
+    switch (priority) {
+        case ThreadPriority::Normal:
+            return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+        case ThreadPriority::High:
+            return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+        case ThreadPriority::Realtime:
+            return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+        default:
+            std::unreachable();
+    }
+#else
+    return priority == ThreadPriority::Normal;
+#endif
+}
+
+JobSystem::JobSystem(const ThreadPlacement &placement) {
+    for (size_t index{}; index < placement.get_worker_count(); ++index) {
+        workers.emplace_back([this, placement, index]() {
+            placement.apply(ThreadRole::Worker, index);
+            for (;;) {
+                std::move_only_function<void()> job;
+                {
+                    std::unique_lock lock{mutex};
+                    condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        });
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        const std::scoped_lock lock{mutex};
+        stopping = true;
+    }
+    condition.notify_all();
+}
+
+void JobSystem::push(std::move_only_function<void()> job) {
+    {
+        const std::scoped_lock lock{mutex};
+        jobs.emplace_back(std::move(job));
+    }
+    condition.notify_one();
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "noncopyable.hpp"
+
+enum class CoreKind {
+    Performance,
+    Efficiency,
+};
+
+struct LogicalCore {
+    uint32_t index;
+    uint32_t physical_core;
+    uint32_t package;
+    CoreKind kind;
+    // The first hardware thread of its physical core, the others are its SMT siblings.
+    bool is_primary_thread;
+};
+
+class CpuTopology {
+    std::vector<LogicalCore> logical_cores;
+
+    explicit CpuTopology(std::vector<LogicalCore> logical_cores) : logical_cores{std::move(logical_cores)} {}
+
+public:
+    [[nodiscard]] static CpuTopology detect();
+
+    [[nodiscard]] std::span<const LogicalCore> get_logical_cores() const {
+        return logical_cores;
+    }
+
+    [[nodiscard]] std::vector<uint32_t> get_siblings(uint32_t index) const;
+
+    [[nodiscard]] size_t get_physical_core_count() const;
+
+    [[nodiscard]] bool has_efficiency_cores() const;
+};
+
+enum class ThreadRole {
+    Render,
+    Submit,
+    Worker,
+};
+
+enum class ThreadPriority {
+    Normal,
+    High,
+    Realtime,
+};
+
+struct ThreadingConfig {
+    bool pinning{true};
+    std::optional<uint32_t> render_core{};
+    std::optional<uint32_t> submit_core{};
+    ThreadPriority render_priority{ThreadPriority::High};
+    ThreadPriority submit_priority{ThreadPriority::High};
+    // Zero picks one worker per free physical core.
+    uint32_t worker_count{};
+    bool workers_use_smt_siblings{false};
+    bool workers_use_efficiency_cores{true};
+
+    // APP_THREAD_PINNING, APP_{RENDER,SUBMIT}_CORE, APP_{RENDER,SUBMIT}_PRIORITY (normal|high|realtime),
+    // APP_WORKER_COUNT, APP_WORKERS_USE_SMT and APP_WORKERS_USE_EFFICIENCY_CORES.
+    [[nodiscard]] static ThreadingConfig from_environment();
+};
+
+// Which logical cores every thread role may run on, an empty set leaves the thread to the scheduler.
+class ThreadPlacement {
+    std::vector<uint32_t> render_cores;
+    std::vector<uint32_t> submit_cores;
+    std::vector<std::vector<uint32_t>> worker_cores;
+    ThreadPriority render_priority;
+    ThreadPriority submit_priority;
+
+    ThreadPlacement() = default;
+
+public:
+    [[nodiscard]] static ThreadPlacement plan(const CpuTopology &topology, const ThreadingConfig &config);
+
+    [[nodiscard]] size_t get_worker_count() const {
+        return worker_cores.size();
+    }
+
+    // Pins and prioritizes the calling thread, failures are logged since the application still works without them.
+    void apply(ThreadRole role, size_t worker_index = 0) const;
+
+    void log() const;
+};
+
+bool pin_current_thread(std::span<const uint32_t> cores);
+
+bool set_current_thread_priority(ThreadPriority priority);
+
+class JobSystem : Noncopyable {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::move_only_function<void()>> jobs;
+    bool stopping{false};
+    std::vector<std::jthread> workers;
+
+    void push(std::move_only_function<void()> job);
+
+public:
+    explicit JobSystem(const ThreadPlacement &placement);
+
+    ~JobSystem();
+
+    [[nodiscard]] size_t get_worker_count() const {
+        return workers.size();
+    }
+
+    template<typename F>
+    auto submit(F &&function) {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        std::packaged_task<Result()> task{std::forward<F>(function)};
+        auto future{task.get_future()};
+        push([task = std::move(task)]() mutable { task(); });
+        return future;
+    }
+};
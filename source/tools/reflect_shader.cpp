@@ -0,0 +1,31 @@
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "../shader_reflection.hpp"
+
+// Build step that stores the reflection of a compiled shader next to it, so the application never parses SPIR-V.
+auto main(const int argc, const char *const *const argv) -> int {
+    if (argc != 2) {
+        std::cerr << "usage: " << argv[0] << " <shader.spv>\n";
+        return 1;
+    }
+    try {
+        const std::filesystem::path spirv_path{argv[1]};
+        std::ifstream input{spirv_path, std::ios::binary};
+        if (!input)
+            throw std::runtime_error{"Couldn't open " + spirv_path.string()};
+        std::vector<uint32_t> words(std::filesystem::file_size(spirv_path) / sizeof(uint32_t));
+        input.read(reinterpret_cast<char *>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint32_t)));
+
+        const auto data = serialize(reflect_spirv(words));
+        std::ofstream output{get_reflection_path(spirv_path), std::ios::binary};
+        output.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!output)
+            throw std::runtime_error{"Couldn't write the reflection of " + spirv_path.string()};
+    } catch (const std::exception &exception) {
+        std::cerr << argv[1] << ": " << exception.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
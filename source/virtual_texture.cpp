@@ -0,0 +1,499 @@
+#include "virtual_texture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <ranges>
+#include <stdexcept>
+#include <tuple>
+
+#include "config.hpp"
+#include "gpu_helpers.hpp"
+
+namespace {
+    constexpr vk::ImageSubresourceRange all_mips{vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0, 1};
+
+    vk::MemoryBarrier2 get_transfer_barrier() {
+        return {vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eAllCommands,
+                vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite};
+    }
+
+    vk::raii::Semaphore create_timeline_semaphore(const vk::raii::Device &device) {
+        const vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> create_info{
+                {}, vk::SemaphoreTypeCreateInfo{vk::SemaphoreType::eTimeline, 0}};
+        return {device, create_info.get<vk::SemaphoreCreateInfo>()};
+    }
+}
+
+VirtualTextureConfig VirtualTextureConfig::from_environment() {
+    VirtualTextureConfig config{};
+    config.pool_pages = get_config("APP_VIRTUAL_TEXTURE_POOL_PAGES", config.pool_pages);
+    config.pages_per_frame = get_config("APP_VIRTUAL_TEXTURE_PAGES_PER_FRAME", config.pages_per_frame);
+    config.grace_frames = get_config("APP_VIRTUAL_TEXTURE_GRACE_FRAMES", config.grace_frames);
+    config.feedback_pages = get_config("APP_VIRTUAL_TEXTURE_FEEDBACK_PAGES", config.feedback_pages);
+    return config;
+}
+
+VirtualTextureSystem::VirtualTextureSystem(const vk::raii::Device &device, const MemoryTypes &memory_types,
+                                           DeviceAllocator &allocator, DeferredDeletionQueue &deferred_deletion_queue,
+                                           SubmissionThread &bind_queue, const uint32_t frames_in_flight,
+                                           const VirtualTextureConfig config)
+        : device{device}, memory_types{memory_types}, allocator{allocator},
+          deferred_deletion_queue{deferred_deletion_queue}, bind_queue{bind_queue},
+          frames_in_flight{frames_in_flight}, config{config}, free_feedback_ranges{{0, config.feedback_pages}},
+          bind_semaphore{create_timeline_semaphore(device)} {
+    // Words, so shaders can atomicOr into them.
+    const vk::DeviceSize feedback_size{(config.feedback_pages + 31) / 32 * sizeof(uint32_t)};
+    for (uint32_t index{}; index < frames_in_flight; ++index) {
+        const auto buffer = feedback_buffers.emplace_back(allocator.create_buffer(
+                vk::BufferCreateInfo{{}, feedback_size, vk::BufferUsageFlagBits::eStorageBuffer |
+                                                        vk::BufferUsageFlagBits::eTransferDst},
+                MemoryUsage::Readback));
+        // The first read happens before any frame cleared it.
+        std::memset(allocator.get_mapped(buffer), 0, feedback_size);
+        allocator.flush(buffer);
+    }
+}
+
+bool VirtualTextureSystem::is_supported(const vk::raii::PhysicalDevice &physical_device,
+                                        const uint32_t queue_family_index) {
+    const auto features = physical_device.getFeatures();
+    const auto family_properties = physical_device.getQueueFamilyProperties();
+    return features.sparseBinding && features.sparseResidencyImage2D && features.shaderResourceMinLod &&
+           (family_properties[queue_family_index].queueFlags & vk::QueueFlagBits::eSparseBinding);
+}
+
+VirtualTextureSystem::Texture &VirtualTextureSystem::get(const VirtualTextureId id) {
+    return *textures.at(id - 1);
+}
+
+const VirtualTextureSystem::Texture &VirtualTextureSystem::get(const VirtualTextureId id) const {
+    return *textures.at(id - 1);
+}
+
+void VirtualTextureSystem::create_pool(const vk::MemoryRequirements &requirements) {
+    const auto type_index = memory_types.find(requirements.memoryTypeBits, MemoryUsage::DeviceLocal);
+    if (!type_index)
+        throw std::runtime_error{"No memory type fits the virtual texture pages"};
+    pool_type_index = *type_index;
+    page_size = requirements.alignment;
+    pool.emplace(device, vk::MemoryAllocateInfo{page_size * config.pool_pages, pool_type_index});
+    slots.resize(config.pool_pages);
+    // Handed out from the back, so the pool fills from its start.
+    for (auto slot = config.pool_pages; slot > 0; --slot)
+        free_slots.emplace_back(slot - 1);
+    SDL_Log("Virtual texture pool of %u pages of %llu KiB", config.pool_pages,
+            static_cast<unsigned long long>(page_size >> 10));
+}
+
+bool VirtualTextureSystem::has_feedback_space(const uint32_t page_count) const {
+    return page_count == 0 || std::ranges::any_of(free_feedback_ranges, [&](const auto &range) {
+        return range.second >= page_count;
+    });
+}
+
+uint32_t VirtualTextureSystem::allocate_feedback(const uint32_t page_count) {
+    if (page_count == 0)
+        return 0;
+    // Best fit keeps the large ranges for large textures.
+    auto best = free_feedback_ranges.end();
+    for (auto range = free_feedback_ranges.begin(); range != free_feedback_ranges.end(); ++range)
+        if (range->second >= page_count && (best == free_feedback_ranges.end() || range->second < best->second))
+            best = range;
+
+    const auto [offset, size] = *best;
+    free_feedback_ranges.erase(best);
+    if (size > page_count)
+        free_feedback_ranges.emplace(offset + page_count, size - page_count);
+    return offset;
+}
+
+void VirtualTextureSystem::free_feedback(const uint32_t offset, const uint32_t page_count) {
+    if (page_count == 0)
+        return;
+    auto inserted = free_feedback_ranges.emplace(offset, page_count).first;
+    if (const auto next = std::next(inserted);
+            next != free_feedback_ranges.end() && inserted->first + inserted->second == next->first) {
+        inserted->second += next->second;
+        free_feedback_ranges.erase(next);
+    }
+    if (inserted != free_feedback_ranges.begin()) {
+        if (const auto previous = std::prev(inserted); previous->first + previous->second == inserted->first) {
+            previous->second += inserted->second;
+            free_feedback_ranges.erase(inserted);
+        }
+    }
+}
+
+VirtualTextureId VirtualTextureSystem::create(const VirtualTextureDescription &description, PageLoader loader) {
+    vk::raii::Image image{device, vk::ImageCreateInfo{
+            vk::ImageCreateFlagBits::eSparseBinding | vk::ImageCreateFlagBits::eSparseResidency, vk::ImageType::e2D,
+            description.format, vk::Extent3D{description.extent, 1}, description.mip_count, 1,
+            vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+            vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst}};
+    const auto requirements = image.getMemoryRequirements();
+    const auto sparse_requirements = image.getSparseMemoryRequirements();
+    const auto sparse = std::ranges::find_if(sparse_requirements, [](const vk::SparseImageMemoryRequirements &entry) {
+        return static_cast<bool>(entry.formatProperties.aspectMask & vk::ImageAspectFlagBits::eColor);
+    });
+    if (sparse == sparse_requirements.end())
+        throw std::runtime_error{"The format doesn't support sparse residency"};
+    if (!pool)
+        create_pool(requirements);
+    // One slot holds exactly one page, formats with another block size would need a pool of their own.
+    if (!(requirements.memoryTypeBits & (1u << pool_type_index)) || requirements.alignment != page_size)
+        throw std::runtime_error{"The virtual texture doesn't fit the page pool"};
+
+    const vk::Extent2D page_extent{sparse->formatProperties.imageGranularity.width,
+                                   sparse->formatProperties.imageGranularity.height};
+    const auto mip_tail_first = std::min(sparse->imageMipTailFirstLod, description.mip_count);
+    std::vector<Mip> mips;
+    uint32_t page_count{};
+    for (uint32_t mip{}; mip < description.mip_count; ++mip) {
+        const vk::Extent2D extent{std::max(description.extent.width >> mip, 1u),
+                                  std::max(description.extent.height >> mip, 1u)};
+        const auto is_paged = mip < mip_tail_first;
+        const auto pages_x = is_paged ? (extent.width + page_extent.width - 1) / page_extent.width : 0;
+        const auto pages_y = is_paged ? (extent.height + page_extent.height - 1) / page_extent.height : 0;
+        mips.push_back({extent, pages_x, pages_y, page_count});
+        page_count += pages_x * pages_y;
+    }
+    if (!has_feedback_space(page_count))
+        throw std::runtime_error{"The virtual texture feedback buffer is full"};
+
+    // The tail is small and always resident, it's what gets sampled until finer pages arrive.
+    std::optional<vk::raii::DeviceMemory> mip_tail_memory;
+    if (mip_tail_first < description.mip_count) {
+        mip_tail_memory.emplace(device, vk::MemoryAllocateInfo{sparse->imageMipTailSize, pool_type_index});
+        bind_queue.bind_sparse({
+                .opaque_binds = {{*image, {vk::SparseMemoryBind{sparse->imageMipTailOffset, sparse->imageMipTailSize,
+                                                                **mip_tail_memory, 0}}}},
+                .signal_semaphores = {{*bind_semaphore, ++bind_value}},
+        });
+    }
+
+    vk::raii::ImageView view{device, vk::ImageViewCreateInfo{{}, *image, vk::ImageViewType::e2D, description.format,
+                                                             {}, all_mips}};
+    const auto page_table = allocator.create_buffer(
+            vk::BufferCreateInfo{{}, std::max(mips[0].pages_x * mips[0].pages_y, 1u) * sizeof(uint32_t),
+                                 vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst},
+            MemoryUsage::DeviceLocal);
+
+    Texture texture{description, std::move(loader), std::move(image), std::move(view), page_extent, std::move(mips),
+                    mip_tail_first, std::min(mip_tail_first, description.mip_count - 1), std::move(mip_tail_memory),
+                    std::vector(page_count, no_slot), allocate_feedback(page_count), page_table};
+
+    VirtualTextureId id;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+        textures[id - 1].emplace(std::move(texture));
+    } else {
+        textures.emplace_back(std::move(texture));
+        id = static_cast<VirtualTextureId>(textures.size());
+    }
+    request_pinned(id, get(id));
+    return id;
+}
+
+void VirtualTextureSystem::destroy(const VirtualTextureId id) {
+    auto &texture = get(id);
+    // The slots come back once the frames in flight are done, the image goes at the same time.
+    for (const auto slot: texture.page_slots) {
+        if (slot == no_slot)
+            continue;
+        slots[slot].texture = 0;
+        slots[slot].evicted = frame;
+    }
+    std::erase_if(pending_unbinds, [&](const Request &unbind) { return unbind.texture == id; });
+    std::erase_if(requests, [&](const Request &request) { return request.texture == id; });
+    deferred_deletion_queue.retire(std::move(texture.view));
+    deferred_deletion_queue.retire(std::move(texture.image));
+    if (texture.mip_tail_memory)
+        deferred_deletion_queue.retire(std::move(*texture.mip_tail_memory));
+    allocator.destroy(texture.page_table);
+    // Bits frames in flight still set for the old texture only cost its successor a few needless pages.
+    free_feedback(texture.feedback_offset, static_cast<uint32_t>(texture.page_slots.size()));
+    textures[id - 1].reset();
+    free_ids.emplace_back(id);
+}
+
+uint32_t VirtualTextureSystem::get_page_mip(const Texture &texture, const uint32_t page) const {
+    const auto mip = std::ranges::upper_bound(texture.mips.begin(), texture.mips.begin() + texture.mip_tail_first,
+                                              page, {}, &Mip::first_page);
+    return static_cast<uint32_t>(mip - texture.mips.begin()) - 1;
+}
+
+void VirtualTextureSystem::request(const VirtualTextureId id, Texture &texture, const uint32_t page) {
+    // Sampling a page needs the coarser pages covering it for the page table to point at it.
+    auto mip = get_page_mip(texture, page);
+    auto x = (page - texture.mips[mip].first_page) % texture.mips[mip].pages_x;
+    auto y = (page - texture.mips[mip].first_page) / texture.mips[mip].pages_x;
+    for (; mip < texture.mip_tail_first; ++mip, x /= 2, y /= 2) {
+        const auto &level = texture.mips[mip];
+        const auto covering = level.first_page + std::min(y, level.pages_y - 1) * level.pages_x +
+                              std::min(x, level.pages_x - 1);
+        if (const auto slot = texture.page_slots[covering]; slot != no_slot)
+            slots[slot].last_used = frame;
+        else
+            requests.push_back({id, mip, covering});
+    }
+}
+
+void VirtualTextureSystem::request_pinned(const VirtualTextureId id, const Texture &texture) {
+    // Without a tail the coarsest mip stands in for it.
+    if (texture.pinned_mip >= texture.mip_tail_first)
+        return;
+    for (auto page = texture.mips[texture.pinned_mip].first_page; page < texture.page_slots.size(); ++page)
+        if (texture.page_slots[page] == no_slot)
+            requests.push_back({id, texture.pinned_mip, page});
+}
+
+void VirtualTextureSystem::begin_frame(const uint32_t frame_index) {
+    ++frame;
+    for (auto &&[index, slot]: std::views::enumerate(slots)) {
+        if (!slot.evicted || *slot.evicted + frames_in_flight > frame)
+            continue;
+        // Pages bound again elsewhere in the meantime already moved off the slot.
+        if (slot.texture && get(slot.texture).page_slots[slot.page] == no_slot)
+            pending_unbinds.push_back({slot.texture, 0, slot.page});
+        slot = {};
+        free_slots.emplace_back(static_cast<uint32_t>(index));
+    }
+
+    const auto feedback = feedback_buffers[frame_index];
+    allocator.invalidate(feedback);
+    const auto words = reinterpret_cast<const uint32_t *>(allocator.get_mapped(feedback));
+    for (auto &&[index, texture]: std::views::enumerate(textures)) {
+        if (!texture)
+            continue;
+        const auto id = static_cast<VirtualTextureId>(index + 1);
+        request_pinned(id, *texture);
+        for (uint32_t page{}; page < texture->page_slots.size(); ++page) {
+            const auto bit = texture->feedback_offset + page;
+            // Whole empty words are skipped, most of the buffer is.
+            if (!words[bit / 32]) {
+                page += 31 - bit % 32;
+                continue;
+            }
+            if (words[bit / 32] & (1u << bit % 32))
+                request(id, *texture, page);
+        }
+    }
+
+    // Coarse pages first, they cover the most screen per byte and finer pages need them anyway.
+    std::ranges::sort(requests, [](const Request &left, const Request &right) {
+        if (left.mip != right.mip)
+            return left.mip > right.mip;
+        return std::tie(left.texture, left.page) < std::tie(right.texture, right.page);
+    });
+    const auto [first, last] = std::ranges::unique(requests, [](const Request &left, const Request &right) {
+        return left.texture == right.texture && left.page == right.page;
+    });
+    requests.erase(first, last);
+}
+
+std::optional<uint32_t> VirtualTextureSystem::acquire_slot(std::vector<uint32_t> &eviction_candidates) {
+    if (!free_slots.empty()) {
+        const auto slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+    if (eviction_candidates.empty()) {
+        for (uint32_t slot{}; slot < slots.size(); ++slot) {
+            const auto &[texture, page, last_used, evicted] = slots[slot];
+            if (!texture || evicted || last_used + std::max(config.grace_frames, frames_in_flight) > frame)
+                continue;
+            if (const auto &owner = get(texture); get_page_mip(owner, page) < owner.pinned_mip)
+                eviction_candidates.emplace_back(slot);
+        }
+        // Least recently used last, where pop_back finds it.
+        std::ranges::sort(eviction_candidates, std::ranges::greater{}, [&](const uint32_t slot) {
+            return slots[slot].last_used;
+        });
+    }
+    if (!eviction_candidates.empty()) {
+        auto &slot = slots[eviction_candidates.back()];
+        eviction_candidates.pop_back();
+        auto &texture = get(slot.texture);
+        texture.page_slots[slot.page] = no_slot;
+        texture.is_page_table_dirty = true;
+        slot.evicted = frame;
+        ++evicted_pages;
+    }
+    return std::nullopt;
+}
+
+vk::SparseImageMemoryBind VirtualTextureSystem::get_page_bind(const Texture &texture, const uint32_t mip,
+                                                              const uint32_t page,
+                                                              const std::optional<uint32_t> slot) const {
+    const auto &level = texture.mips[mip];
+    const auto x = (page - level.first_page) % level.pages_x * texture.page_extent.width;
+    const auto y = (page - level.first_page) / level.pages_x * texture.page_extent.height;
+    // Pages at the edge of the mip end with it.
+    return {vk::ImageSubresource{vk::ImageAspectFlagBits::eColor, mip, 0},
+            vk::Offset3D{static_cast<int32_t>(x), static_cast<int32_t>(y), 0},
+            vk::Extent3D{std::min(texture.page_extent.width, level.extent.width - x),
+                         std::min(texture.page_extent.height, level.extent.height - y), 1},
+            slot ? **pool : vk::DeviceMemory{}, slot ? *slot * page_size : 0};
+}
+
+std::vector<uint32_t> VirtualTextureSystem::build_page_table(const Texture &texture) const {
+    const auto &finest = texture.mips[0];
+    std::vector<uint32_t> table(std::max(finest.pages_x * finest.pages_y, 1u), texture.pinned_mip);
+    for (uint32_t y{}; y < finest.pages_y; ++y) {
+        for (uint32_t x{}; x < finest.pages_x; ++x) {
+            auto &lod = table[y * finest.pages_x + x];
+            for (auto mip = texture.pinned_mip; mip > 0; --mip) {
+                const auto &level = texture.mips[mip - 1];
+                const auto page = level.first_page + std::min(y >> (mip - 1), level.pages_y - 1) * level.pages_x +
+                                  std::min(x >> (mip - 1), level.pages_x - 1);
+                if (texture.page_slots[page] == no_slot)
+                    break;
+                lod = mip - 1;
+            }
+        }
+    }
+    return table;
+}
+
+void VirtualTextureSystem::record(const vk::raii::CommandBuffer &command_buffer, const uint32_t frame_index) {
+    // Pages bound this frame, the unbinds of reused slots go first.
+    std::map<VirtualTextureId, std::vector<vk::SparseImageMemoryBind>> binds;
+    for (const auto &[texture, mip, page]: pending_unbinds) {
+        const auto &owner = get(texture);
+        binds[texture].emplace_back(get_page_bind(owner, get_page_mip(owner, page), page, std::nullopt));
+    }
+    pending_unbinds.clear();
+
+    std::vector<Request> streamed;
+    std::vector<uint32_t> eviction_candidates;
+    for (const auto &request: requests) {
+        auto &texture = get(request.texture);
+        if (texture.page_slots[request.page] != no_slot)
+            continue;
+        if (streamed.size() == config.pages_per_frame) {
+            ++deferred_pages;
+            continue;
+        }
+        const auto slot = acquire_slot(eviction_candidates);
+        if (!slot) {
+            ++deferred_pages;
+            continue;
+        }
+        texture.page_slots[request.page] = *slot;
+        texture.is_page_table_dirty = true;
+        slots[*slot] = {request.texture, request.page, frame, std::nullopt};
+        binds[request.texture].emplace_back(get_page_bind(texture, request.mip, request.page, slot));
+        streamed.emplace_back(request);
+        ++bound_pages;
+    }
+    // What got put off comes back, through the feedback of later frames or request_pinned in begin_frame.
+    requests.clear();
+
+    if (!binds.empty()) {
+        QueueSparseBinding binding{};
+        for (auto &[texture, texture_binds]: binds)
+            binding.image_binds.push_back({*get(texture).image, std::move(texture_binds)});
+        binding.signal_semaphores.emplace_back(*bind_semaphore, ++bind_value);
+        bind_queue.bind_sparse(std::move(binding));
+    }
+
+    // Texels of the new pages and tails of new textures, through one staging buffer.
+    struct Upload {
+        VirtualTextureId texture;
+        uint32_t mip;
+        uint32_t page_x;
+        uint32_t page_y;
+        vk::Extent2D extent;
+    };
+    std::vector<Upload> uploads;
+    for (auto &&[index, texture]: std::views::enumerate(textures)) {
+        if (!texture || texture->is_initialized)
+            continue;
+        for (auto mip = texture->mip_tail_first; mip < texture->description.mip_count; ++mip)
+            uploads.push_back({static_cast<VirtualTextureId>(index + 1), mip, 0, 0, texture->mips[mip].extent});
+    }
+    for (const auto &[texture_id, mip, page]: streamed) {
+        const auto &texture = get(texture_id);
+        const auto bind = get_page_bind(texture, mip, page, std::nullopt);
+        uploads.push_back({texture_id, mip, (page - texture.mips[mip].first_page) % texture.mips[mip].pages_x,
+                           (page - texture.mips[mip].first_page) / texture.mips[mip].pages_x,
+                           {bind.extent.width, bind.extent.height}});
+    }
+
+    std::vector<vk::ImageMemoryBarrier2> barriers;
+    for (auto &&[index, texture]: std::views::enumerate(textures)) {
+        if (!texture)
+            continue;
+        const auto is_written = !texture->is_initialized || std::ranges::any_of(streamed, [&](const Request &request) {
+            return request.texture == static_cast<VirtualTextureId>(index + 1);
+        });
+        if (is_written)
+            barriers.emplace_back(get_image_barrier(*texture->image, texture->is_initialized
+                                                                     ? vk::ImageLayout::eShaderReadOnlyOptimal
+                                                                     : vk::ImageLayout::eUndefined,
+                                                    vk::ImageLayout::eTransferDstOptimal, all_mips));
+    }
+    if (!uploads.empty()) {
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barriers});
+        vk::DeviceSize staging_size{};
+        for (const auto &upload: uploads)
+            staging_size += get_image_bytes(get(upload.texture).description.format, upload.extent);
+        const auto staging = allocator.create_buffer(
+                vk::BufferCreateInfo{{}, staging_size, vk::BufferUsageFlagBits::eTransferSrc}, MemoryUsage::Upload);
+        const auto mapped = allocator.get_mapped(staging);
+        vk::DeviceSize offset{};
+        for (const auto &[texture_id, mip, page_x, page_y, extent]: uploads) {
+            const auto &texture = get(texture_id);
+            const auto bytes = get_image_bytes(texture.description.format, extent);
+            texture.loader(mip, page_x, page_y, {mapped + offset, bytes});
+            const vk::BufferImageCopy copy{
+                    offset, 0, 0, vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, mip, 0, 1},
+                    vk::Offset3D{static_cast<int32_t>(page_x * texture.page_extent.width),
+                                 static_cast<int32_t>(page_y * texture.page_extent.height), 0},
+                    vk::Extent3D{extent, 1}};
+            command_buffer.copyBufferToImage(allocator.get_buffer(staging), *texture.image,
+                                             vk::ImageLayout::eTransferDstOptimal, copy);
+            offset += bytes;
+        }
+        allocator.flush(staging);
+        allocator.destroy(staging);
+    }
+    for (auto &barrier: barriers) {
+        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    }
+    if (!barriers.empty())
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, {}, {}, barriers});
+    for (auto &texture: textures)
+        if (texture)
+            texture->is_initialized = true;
+
+    // Page tables change after the texels they point at arrived.
+    for (auto &texture: textures) {
+        if (!texture || !texture->is_page_table_dirty)
+            continue;
+        const auto table = build_page_table(*texture);
+        const auto staging = allocator.create_buffer(
+                vk::BufferCreateInfo{{}, table.size() * sizeof(uint32_t), vk::BufferUsageFlagBits::eTransferSrc},
+                MemoryUsage::Upload);
+        std::memcpy(allocator.get_mapped(staging), table.data(), table.size() * sizeof(uint32_t));
+        allocator.flush(staging);
+        command_buffer.copyBuffer(allocator.get_buffer(staging), allocator.get_buffer(texture->page_table),
+                                  vk::BufferCopy{0, 0, table.size() * sizeof(uint32_t)});
+        allocator.destroy(staging);
+        texture->is_page_table_dirty = false;
+    }
+
+    // What this frame samples lands in a cleared buffer, read back when the frame index comes around again.
+    command_buffer.fillBuffer(get_feedback_buffer(frame_index), 0, vk::WholeSize, 0);
+    const auto transfer_barrier = get_transfer_barrier();
+    command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, transfer_barrier});
+}
+
+VirtualTextureStats VirtualTextureSystem::get_stats() const {
+    return {config.pool_pages, static_cast<uint32_t>(slots.size() - free_slots.size()), bound_pages, evicted_pages,
+            deferred_pages};
+}
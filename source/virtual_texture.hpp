@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "deferred_deletion.hpp"
+#include "memory.hpp"
+#include "memory_allocator.hpp"
+#include "noncopyable.hpp"
+#include "platform.hpp"
+#include "submission.hpp"
+
+// Zero stands for no virtual texture.
+using VirtualTextureId = uint32_t;
+
+struct VirtualTextureConfig {
+    // Pages are the sparse block size of the format, 64 KiB on every desktop driver.
+    uint32_t pool_pages{2048};
+    uint32_t pages_per_frame{64};
+    // Pages used within this many frames stay, evicted ones are reused once the frames in flight are past them.
+    uint32_t grace_frames{30};
+    // Bits of the feedback buffer, one per page of every mip of every virtual texture.
+    uint32_t feedback_pages{1u << 22};
+
+    [[nodiscard]] static VirtualTextureConfig from_environment();
+};
+
+struct VirtualTextureDescription {
+    vk::Extent2D extent;
+    vk::Format format;
+    uint32_t mip_count;
+};
+
+// Writes the tightly packed texels of a page clipped to its mip, the mip tail comes as whole mips at page zero.
+using PageLoader = std::function<void(uint32_t mip, uint32_t page_x, uint32_t page_y, std::span<std::byte> destination)>;
+
+struct VirtualTextureStats {
+    uint32_t pool_pages{};
+    uint32_t used_pages{};
+    uint64_t bound_pages{};
+    uint64_t evicted_pages{};
+    // Requested but left for later frames because of the per frame limit or a pool full of recently used pages.
+    uint64_t deferred_pages{};
+};
+
+// Backs very large textures with sparse residency images whose pages come from one fixed memory pool.
+//
+// Shaders sampling a virtual texture report what they need through the feedback buffer, which has one bit per page:
+// atomicOr(feedback[bit >> 5], 1u << (bit & 31)) with bit = get_feedback_offset(texture) + the page's index in the
+// texture, pages numbered row by row within a mip and mip after mip starting at the finest. A few frames later the
+// system binds the requested pages on the sparse queue and streams their texels in, coarse mips first, and evicts the
+// least recently used ones when the pool runs out. The page table holds one word per page of the finest mip: the
+// finest mip resident there together with all coarser pages covering it, which shaders pass as minimum LOD
+// (shaderResourceMinLod) so they never sample unbound memory.
+class VirtualTextureSystem : Noncopyable {
+    static constexpr uint32_t no_slot{~0u};
+
+    struct Mip {
+        vk::Extent2D extent;
+        uint32_t pages_x;
+        uint32_t pages_y;
+        // Index of the mip's first page within the texture.
+        uint32_t first_page;
+    };
+
+    struct Texture {
+        VirtualTextureDescription description;
+        PageLoader loader;
+        vk::raii::Image image;
+        vk::raii::ImageView view;
+        vk::Extent2D page_extent;
+        std::vector<Mip> mips;
+        // Mips from here on are the mip tail, bound in one piece at creation.
+        uint32_t mip_tail_first;
+        // Pages from this mip on never leave, the coarsest mip when there is no tail.
+        uint32_t pinned_mip;
+        std::optional<vk::raii::DeviceMemory> mip_tail_memory;
+        // Pool slot of every page, no_slot when it isn't bound.
+        std::vector<uint32_t> page_slots;
+        uint32_t feedback_offset;
+        AllocationId page_table;
+        bool is_initialized{};
+        bool is_page_table_dirty{true};
+    };
+
+    struct Slot {
+        VirtualTextureId texture{};
+        uint32_t page{};
+        uint64_t last_used{};
+        // Frame the page got evicted in, the slot is free again once no frame in flight can sample it.
+        std::optional<uint64_t> evicted;
+    };
+
+    struct Request {
+        VirtualTextureId texture;
+        uint32_t mip;
+        uint32_t page;
+    };
+
+    const vk::raii::Device &device;
+    const MemoryTypes &memory_types;
+    DeviceAllocator &allocator;
+    DeferredDeletionQueue &deferred_deletion_queue;
+    SubmissionThread &bind_queue;
+    const uint32_t frames_in_flight;
+    const VirtualTextureConfig config;
+
+    std::optional<vk::raii::DeviceMemory> pool;
+    vk::DeviceSize page_size{};
+    uint32_t pool_type_index{};
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+
+    std::vector<std::optional<Texture>> textures;
+    std::vector<VirtualTextureId> free_ids;
+    // Offset to size of the feedback bits no texture owns, neighbors are always merged.
+    std::map<uint32_t, uint32_t> free_feedback_ranges;
+    std::vector<AllocationId> feedback_buffers;
+    std::vector<Request> requests;
+    // Pages whose slot got reused, unbound in the next batch before anything else is bound.
+    std::vector<Request> pending_unbinds;
+
+    // Signalled by every vkQueueBindSparse, frames sampling newly bound pages wait for it.
+    vk::raii::Semaphore bind_semaphore;
+    uint64_t bind_value{};
+    uint64_t frame{};
+    uint64_t bound_pages{};
+    uint64_t evicted_pages{};
+    uint64_t deferred_pages{};
+
+    [[nodiscard]] Texture &get(VirtualTextureId id);
+
+    [[nodiscard]] const Texture &get(VirtualTextureId id) const;
+
+    void create_pool(const vk::MemoryRequirements &requirements);
+
+    [[nodiscard]] bool has_feedback_space(uint32_t page_count) const;
+
+    // Best fit, has_feedback_space must have said there is room.
+    [[nodiscard]] uint32_t allocate_feedback(uint32_t page_count);
+
+    void free_feedback(uint32_t offset, uint32_t page_count);
+
+    // A free slot if there is one. Otherwise the least recently used page gets evicted, its slot is free once the
+    // frames in flight are done with it.
+    [[nodiscard]] std::optional<uint32_t> acquire_slot(std::vector<uint32_t> &eviction_candidates);
+
+    void request(VirtualTextureId id, Texture &texture, uint32_t page);
+
+    // Requests the pinned pages that aren't bound yet. Unlike feedback, which asks again every frame, nothing else
+    // would bring back the ones the per frame limit or a pool full of recently used pages put off.
+    void request_pinned(VirtualTextureId id, const Texture &texture);
+
+    [[nodiscard]] vk::SparseImageMemoryBind get_page_bind(const Texture &texture, uint32_t mip, uint32_t page,
+                                                          std::optional<uint32_t> slot) const;
+
+    [[nodiscard]] uint32_t get_page_mip(const Texture &texture, uint32_t page) const;
+
+    // Finest fully backed mip for every page of mip zero.
+    [[nodiscard]] std::vector<uint32_t> build_page_table(const Texture &texture) const;
+
+public:
+    // Needs the device features is_supported checks for enabled and a bind queue whose family supports sparse binding.
+    VirtualTextureSystem(const vk::raii::Device &device, const MemoryTypes &memory_types, DeviceAllocator &allocator,
+                         DeferredDeletionQueue &deferred_deletion_queue, SubmissionThread &bind_queue,
+                         uint32_t frames_in_flight, VirtualTextureConfig config = VirtualTextureConfig::from_environment());
+
+    [[nodiscard]] static bool is_supported(const vk::raii::PhysicalDevice &physical_device,
+                                           uint32_t queue_family_index);
+
+    // The mip tail becomes resident on the next record.
+    [[nodiscard]] VirtualTextureId create(const VirtualTextureDescription &description, PageLoader loader);
+
+    void destroy(VirtualTextureId id);
+
+    // Reads back what frame_index requested the last time it ran, call once its fence was waited for.
+    void begin_frame(uint32_t frame_index);
+
+    // Binds and fills this frame's share of pages and clears the frame's feedback buffer, has to come before the
+    // passes sampling virtual textures. Their submission waits on get_bind_wait.
+    void record(const vk::raii::CommandBuffer &command_buffer, uint32_t frame_index);
+
+    [[nodiscard]] vk::SemaphoreSubmitInfo get_bind_wait() const {
+        return {*bind_semaphore, bind_value, vk::PipelineStageFlagBits2::eAllCommands};
+    }
+
+    [[nodiscard]] vk::Buffer get_feedback_buffer(uint32_t frame_index) const {
+        return allocator.get_buffer(feedback_buffers[frame_index]);
+    }
+
+    [[nodiscard]] uint32_t get_feedback_offset(VirtualTextureId id) const {
+        return get(id).feedback_offset;
+    }
+
+    [[nodiscard]] vk::Buffer get_page_table(VirtualTextureId id) const {
+        return allocator.get_buffer(get(id).page_table);
+    }
+
+    [[nodiscard]] vk::ImageView get_view(VirtualTextureId id) const {
+        return *get(id).view;
+    }
+
+    [[nodiscard]] VirtualTextureStats get_stats() const;
+};
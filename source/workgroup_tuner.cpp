@@ -0,0 +1,251 @@
+#include "workgroup_tuner.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <ranges>
+#include <stdexcept>
+
+#include "binary_io.hpp"
+
+namespace {
+    constexpr uint32_t results_magic{0x4e544757}; // "WGTN"
+    constexpr uint32_t results_version{1};
+    // Larger workgroups rarely win and make the candidate list explode.
+    constexpr uint32_t max_tuned_invocations{1024};
+    // Elongated shapes beyond this ratio between two tuned axes are skipped.
+    constexpr uint32_t max_aspect_ratio{8};
+
+    std::vector<uint32_t> get_powers_of_two(const uint32_t limit) {
+        std::vector<uint32_t> values;
+        for (uint32_t value{1}; value <= limit; value *= 2)
+            values.emplace_back(value);
+        return values;
+    }
+}
+
+WorkgroupTuner::WorkgroupTuner(const vk::raii::PhysicalDevice &physical_device, const vk::raii::Device &device,
+                               const uint32_t queue_family_index, const ShaderRegistry &shaders,
+                               PipelineStateCache &pipelines, SpecializationRegistry &specializations, JobSystem &jobs,
+                               std::filesystem::path results_path)
+        : device{device}, shaders{shaders}, pipelines{pipelines}, specializations{specializations}, jobs{jobs},
+          results_path{std::move(results_path)}, queue_family_index{queue_family_index} {
+    const auto properties_chain{physical_device.getProperties2<vk::PhysicalDeviceProperties2,
+            vk::PhysicalDeviceIDProperties, vk::PhysicalDeviceSubgroupProperties>()};
+    const auto &properties = properties_chain.get<vk::PhysicalDeviceProperties2>().properties;
+    const auto &id_properties = properties_chain.get<vk::PhysicalDeviceIDProperties>();
+    const auto &subgroup_properties = properties_chain.get<vk::PhysicalDeviceSubgroupProperties>();
+
+    std::ranges::copy(id_properties.deviceUUID, device_uuid.begin());
+    driver_version = properties.driverVersion;
+    timestamp_valid_bits = physical_device.getQueueFamilyProperties()[queue_family_index].timestampValidBits;
+    timestamp_period = properties.limits.timestampPeriod;
+    subgroup_size = subgroup_properties.subgroupSize;
+    has_subgroup_arithmetic =
+            (subgroup_properties.supportedStages & vk::ShaderStageFlagBits::eCompute) &&
+            (subgroup_properties.supportedOperations & vk::SubgroupFeatureFlagBits::eArithmetic);
+    std::ranges::copy(properties.limits.maxComputeWorkGroupSize, max_workgroup_size.begin());
+    max_workgroup_invocations = properties.limits.maxComputeWorkGroupInvocations;
+
+    try {
+        load();
+    } catch (const std::exception &error) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "Ignoring workgroup tuning results %s: %s",
+                    this->results_path.string().c_str(), error.what());
+        results.clear();
+    }
+}
+
+std::vector<WorkgroupConfig> WorkgroupTuner::get_candidates(const TuningKernel &kernel) const {
+    const auto max_invocations = std::min(max_workgroup_invocations, max_tuned_invocations);
+    // Fewer invocations than a subgroup leave lanes idle on every dispatch.
+    const auto min_invocations = std::max(subgroup_size, 1u);
+
+    std::array<std::vector<uint32_t>, 3> axis_sizes;
+    for (auto &&[sizes, problem_size, max_size]: std::views::zip(axis_sizes, kernel.problem_size, max_workgroup_size))
+        sizes = problem_size > 1 ? get_powers_of_two(std::min(max_size, max_invocations)) : std::vector<uint32_t>{1};
+
+    std::vector<WorkgroupConfig> candidates;
+    for (const auto x: axis_sizes[0]) {
+        for (const auto y: axis_sizes[1]) {
+            for (const auto z: axis_sizes[2]) {
+                const auto invocations = x * y * z;
+                if (invocations < min_invocations || invocations > max_invocations)
+                    continue;
+                uint32_t smallest{std::numeric_limits<uint32_t>::max()};
+                uint32_t largest{};
+                for (const auto &[size, problem_size]: std::views::zip(std::array{x, y, z}, kernel.problem_size)) {
+                    if (problem_size <= 1)
+                        continue;
+                    smallest = std::min(smallest, size);
+                    largest = std::max(largest, size);
+                }
+                if (largest > smallest * max_aspect_ratio)
+                    continue;
+                candidates.push_back({x, y, z, false});
+                if (kernel.has_subgroup_path && has_subgroup_arithmetic)
+                    candidates.push_back({x, y, z, true});
+            }
+        }
+    }
+    return candidates;
+}
+
+WorkgroupConfig WorkgroupTuner::benchmark(const TuningKernel &kernel, SubmissionThread &queue) {
+    // Without measurements the size the shader declares is the best guess.
+    const auto &declared = shaders.get_reflection(kernel.shader).workgroup_size;
+    const auto fallback = declared[0] ? WorkgroupConfig{declared[0], declared[1], declared[2], false}
+                                      : WorkgroupConfig{};
+    if (!timestamp_valid_bits) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "The queue can't write timestamps, %s keeps its declared workgroup size",
+                    kernel.name.c_str());
+        return fallback;
+    }
+
+    const auto candidates = get_candidates(kernel);
+    std::vector<PipelineStateKey> states;
+    for (const auto &candidate: candidates)
+        states.push_back({.compute_shader = kernel.shader, .specialization = specializations.get_id(candidate)});
+    // Candidates compile on every worker but outside the shared cache, so the losers are gone once the benchmark is
+    // and only the winner ends up cached, and in the manifest, when the kernel asks for it.
+    std::vector<std::future<vk::raii::Pipeline>> compiled;
+    for (const auto &state: states)
+        compiled.emplace_back(jobs.submit([this, state] { return pipelines.create_detached(state); }));
+    std::vector<std::pair<WorkgroupConfig, vk::raii::Pipeline>> usable;
+    for (auto &&[candidate, ready]: std::views::zip(candidates, compiled)) {
+        try {
+            usable.emplace_back(candidate, ready.get());
+        } catch (const vk::SystemError &) {
+            // Sizes the driver rejects, for example because shared memory scales with them, simply drop out.
+        }
+    }
+    if (usable.empty())
+        return fallback;
+    const auto layout = pipelines.get_layout(states.front());
+
+    const auto query_count = static_cast<uint32_t>(usable.size() * repetitions * 2);
+    const vk::raii::QueryPool query_pool{device, vk::QueryPoolCreateInfo{{}, vk::QueryType::eTimestamp, query_count}};
+    const vk::raii::CommandPool command_pool{
+            device, vk::CommandPoolCreateInfo{vk::CommandPoolCreateFlagBits::eTransient, queue_family_index}};
+    const vk::raii::CommandBuffers command_buffers{device, {*command_pool, vk::CommandBufferLevel::ePrimary, 1}};
+    const auto &command_buffer = command_buffers.front();
+
+    const vk::MemoryBarrier2 barrier{
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eShaderStorageRead,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eShaderStorageRead};
+    const auto dispatch = [&](const WorkgroupConfig &config, const vk::Pipeline pipeline) {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        if (kernel.bind)
+            kernel.bind(command_buffer, layout);
+        const auto &[x, y, z] = kernel.problem_size;
+        command_buffer.dispatch((x + config.size_x - 1) / config.size_x, (y + config.size_y - 1) / config.size_y,
+                                (z + config.size_z - 1) / config.size_z);
+        // Serializes the dispatches so every timestamp pair only covers its own.
+        command_buffer.pipelineBarrier2(vk::DependencyInfo{{}, barrier});
+    };
+
+    command_buffer.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    command_buffer.resetQueryPool(*query_pool, 0, query_count);
+    // An untimed round lets clocks ramp up first, the timed rounds interleave the candidates so drift hits all alike.
+    for (const auto &[config, pipeline]: usable)
+        dispatch(config, *pipeline);
+    uint32_t query{};
+    for (uint32_t repetition{}; repetition < repetitions; ++repetition) {
+        for (const auto &[config, pipeline]: usable) {
+            command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *query_pool, query++);
+            dispatch(config, *pipeline);
+            command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *query_pool, query++);
+        }
+    }
+    command_buffer.end();
+
+    const vk::raii::Fence fence{device, vk::FenceCreateInfo{}};
+    queue.submit({{SubmitBatch{{}, {vk::CommandBufferSubmitInfo{*command_buffer}}, {}}}, *fence});
+    if (device.waitForFences({*fence}, vk::True, std::numeric_limits<uint64_t>::max()) != vk::Result::eSuccess)
+        throw std::runtime_error{"Workgroup benchmark of " + kernel.name + " didn't finish"};
+    const auto timestamps = query_pool.getResults<uint64_t>(
+            0, query_count, query_count * sizeof(uint64_t), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait).second;
+
+    const auto mask = timestamp_valid_bits >= 64 ? ~uint64_t{} : (uint64_t{1} << timestamp_valid_bits) - 1;
+    auto best = usable.front().first;
+    auto best_time = std::numeric_limits<double>::max();
+    for (const auto &[index, candidate]: std::views::enumerate(usable)) {
+        std::array<uint64_t, repetitions> ticks{};
+        for (size_t repetition{}; repetition < repetitions; ++repetition) {
+            const auto first = (repetition * usable.size() + static_cast<size_t>(index)) * 2;
+            ticks[repetition] = (timestamps[first + 1] - timestamps[first]) & mask;
+        }
+        // The median ignores the odd preemption or clock change.
+        std::ranges::nth_element(ticks, ticks.begin() + repetitions / 2);
+        if (const auto time = static_cast<double>(ticks[repetitions / 2]) * timestamp_period; time < best_time) {
+            best_time = time;
+            best = candidate.first;
+        }
+    }
+    SDL_Log("Tuned %s to %ux%ux%u workgroups%s, %.3f ms out of %zu candidates", kernel.name.c_str(), best.size_x,
+            best.size_y, best.size_z, best.use_subgroups ? " using subgroups" : "", best_time / 1e6, usable.size());
+    return best;
+}
+
+WorkgroupConfig WorkgroupTuner::tune(const TuningKernel &kernel, SubmissionThread &queue) {
+    const ResultKey key{device_uuid, driver_version, kernel.name};
+    {
+        const std::scoped_lock lock{mutex};
+        if (const auto found = results.find(key); found != results.end())
+            return found->second;
+    }
+    const auto config = benchmark(kernel, queue);
+    const std::scoped_lock lock{mutex};
+    results.insert_or_assign(key, config);
+    try {
+        save();
+    } catch (const std::exception &error) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_RENDER, "%s", error.what());
+    }
+    return config;
+}
+
+void WorkgroupTuner::load() {
+    std::ifstream file{results_path, std::ios::binary};
+    if (!file)
+        return;
+    const std::vector<char> content{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    Reader reader{std::as_bytes(std::span{content}), "workgroup tuning results"};
+    if (reader.read<uint32_t>() != results_magic || reader.read<uint32_t>() != results_version)
+        throw std::runtime_error{"Written by another version"};
+    for (auto count = reader.read<uint32_t>(); count > 0; --count) {
+        const auto uuid = reader.read<DeviceUuid>();
+        const auto version = reader.read<uint32_t>();
+        ResultKey key{uuid, version, reader.read_string()};
+        WorkgroupConfig config{};
+        config.size_x = reader.read<uint32_t>();
+        config.size_y = reader.read<uint32_t>();
+        config.size_z = reader.read<uint32_t>();
+        config.use_subgroups = reader.read<uint32_t>() != 0;
+        results.insert_or_assign(std::move(key), config);
+    }
+}
+
+void WorkgroupTuner::save() const {
+    std::vector<std::byte> data;
+    write(data, results_magic);
+    write(data, results_version);
+    write(data, static_cast<uint32_t>(results.size()));
+    for (const auto &[key, config]: results) {
+        const auto &[uuid, version, name] = key;
+        write(data, uuid);
+        write(data, version);
+        write_string(data, name);
+        write(data, config.size_x);
+        write(data, config.size_y);
+        write(data, config.size_z);
+        write(data, static_cast<uint32_t>(config.use_subgroups));
+    }
+
+    write_file(results_path, data, "workgroup tuning results");
+}
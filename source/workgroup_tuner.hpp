@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "noncopyable.hpp"
+#include "pipelines.hpp"
+#include "platform.hpp"
+#include "shaders.hpp"
+#include "specialization.hpp"
+#include "submission.hpp"
+#include "threading.hpp"
+
+// What the tuner picks for a compute kernel. Tunable shaders declare
+//
+//     layout(local_size_x_id = 100, local_size_y_id = 101, local_size_z_id = 102) in;
+//
+// and those with reductions also
+//
+//     layout(constant_id = 103) const bool use_subgroups = false;
+//
+// to branch between subgroup operations and shared memory. The ids stay clear of the ones kernels number their own
+// constants with from zero, SpecializationRegistry::get_id combines both.
+struct WorkgroupConfig {
+    uint32_t size_x{64};
+    uint32_t size_y{1};
+    uint32_t size_z{1};
+    bool use_subgroups{};
+
+    bool operator==(const WorkgroupConfig &) const = default;
+};
+
+template<>
+struct SpecializationTraits<WorkgroupConfig> {
+    using Map = SpecializationMap<SpecializationMember<100, &WorkgroupConfig::size_x>,
+                                  SpecializationMember<101, &WorkgroupConfig::size_y>,
+                                  SpecializationMember<102, &WorkgroupConfig::size_z>,
+                                  SpecializationMember<103, &WorkgroupConfig::use_subgroups>>;
+};
+
+struct TuningKernel {
+    // Identifies the kernel in the stored results, renaming it tunes it again.
+    std::string name;
+    ShaderId shader{};
+    // Invocations the benchmark dispatch covers, axes of size one aren't tuned.
+    std::array<uint32_t, 3> problem_size{1, 1, 1};
+    // Whether the shader declares use_subgroups, only then are both strategies benchmarked.
+    bool has_subgroup_path{};
+    // Binds the descriptors and push constants the benchmark dispatch needs.
+    std::function<void(const vk::raii::CommandBuffer &, vk::PipelineLayout)> bind;
+};
+
+// Benchmarks workgroup sizes and subgroup strategies of compute kernels with timestamp queries the first time a
+// kernel runs on a device, and remembers the fastest per device UUID and driver version so later runs only look it up.
+class WorkgroupTuner : Noncopyable {
+    using DeviceUuid = std::array<uint8_t, vk::UuidSize>;
+    // Device, driver version and kernel name.
+    using ResultKey = std::tuple<DeviceUuid, uint32_t, std::string>;
+
+    const vk::raii::Device &device;
+    const ShaderRegistry &shaders;
+    PipelineStateCache &pipelines;
+    SpecializationRegistry &specializations;
+    JobSystem &jobs;
+    const std::filesystem::path results_path;
+
+    DeviceUuid device_uuid{};
+    uint32_t driver_version{};
+    uint32_t queue_family_index;
+    // Zero when the queue family can't write timestamps, nothing gets tuned then.
+    uint32_t timestamp_valid_bits{};
+    float timestamp_period{};
+    uint32_t subgroup_size{};
+    bool has_subgroup_arithmetic{};
+    std::array<uint32_t, 3> max_workgroup_size{};
+    uint32_t max_workgroup_invocations{};
+
+    std::mutex mutex;
+    // Results of every device the file has seen, so tuning one GPU doesn't forget another.
+    std::map<ResultKey, WorkgroupConfig> results;
+
+    [[nodiscard]] std::vector<WorkgroupConfig> get_candidates(const TuningKernel &kernel) const;
+
+    [[nodiscard]] WorkgroupConfig benchmark(const TuningKernel &kernel, SubmissionThread &queue);
+
+    void load();
+
+    void save() const;
+
+public:
+    static constexpr uint32_t repetitions{5};
+
+    WorkgroupTuner(const vk::raii::PhysicalDevice &physical_device, const vk::raii::Device &device,
+                   uint32_t queue_family_index, const ShaderRegistry &shaders, PipelineStateCache &pipelines,
+                   SpecializationRegistry &specializations, JobSystem &jobs, std::filesystem::path results_path);
+
+    // Returns the stored result or benchmarks the kernel on the queue, which has to belong to the family the tuner
+    // was created for. Blocks while benchmarking, so it belongs in the loading phase.
+    [[nodiscard]] WorkgroupConfig tune(const TuningKernel &kernel, SubmissionThread &queue);
+
+    // The specialization id for the kernel's pipeline key.
+    [[nodiscard]] uint32_t get_specialization(const TuningKernel &kernel, SubmissionThread &queue) {
+        return specializations.get_id(tune(kernel, queue));
+    }
+};